@@ -175,6 +175,7 @@ for arg in $* ; do
             rm -rf dist
             rm -rf build
             rm -f example/avbin_dump
+            rm -f example/avbin_bench
             rm -f example/minimal
             exit
             ;;
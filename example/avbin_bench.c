@@ -0,0 +1,661 @@
+/* avbin_bench.c
+ * Copyright 2012-2013 AVbin Team
+ *
+ * This file is part of AVbin.
+ *
+ * AVbin is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * AVbin is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/* Throughput benchmark for AVbin.
+ *
+ * For each media file given, measures open latency, demux throughput,
+ * decode throughput of every audio and video stream, the cost of RGB
+ * conversion, and seek latency.  With --stress, also decodes all of the
+ * files on 1, 2, ... N threads at once to check that throughput scales with
+ * the number of threads.  Results are printed as JSON, one object per line,
+ * so that runs against different builds (for example before and after
+ * updating the libav backend) can be compared with a script.
+ *
+ * make_bench_corpus.sh generates a small set of test files to run this on.
+ */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <avbin.h>
+
+#define MAX_STREAMS 16
+#define AUDIO_BUFFER_SIZE (1024 * 1024)
+
+/* Command-line settings */
+static int runs = 5;            /* -r, --runs */
+static int seeks = 10;          /* -s, --seeks */
+static int threads = 1;         /* -t, --threads */
+static int stress = 0;          /* -j, --stress */
+
+static int64_t now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static double per_second(int64_t count, int64_t us)
+{
+    return us > 0 ? count * 1000000.0 / us : 0.0;
+}
+
+static double per_item(int64_t us, int64_t count)
+{
+    return count > 0 ? (double) us / count : 0.0;
+}
+
+/* Print a JSON string, escaping what needs escaping */
+static void print_string(const char *s)
+{
+    putchar('"');
+    for (; s && *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char) *s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+static void begin_result(const char *filename, const char *test)
+{
+    printf("{\"file\": ");
+    print_string(filename);
+    printf(", \"test\": \"%s\"", test);
+}
+
+static void print_stage(const char *name, AVbinStageStats *stage)
+{
+    int i;
+
+    printf(", \"%s_calls\": %" PRId64 ", \"%s_total_us\": %" PRId64
+           ", \"%s_max_us\": %" PRId64 ", \"%s_histogram\": [",
+           name, stage->calls, name, stage->total_time,
+           name, stage->max_time, name);
+    for (i = 0; i < AVBIN_STATS_BUCKETS; i++)
+        printf(i ? ", %" PRId64 : "%" PRId64, stage->histogram[i]);
+    printf("]");
+}
+
+static int sample_bytes(AVbinSampleFormat format)
+{
+    switch (format)
+    {
+        case AVBIN_SAMPLE_FORMAT_U8:
+            return 1;
+        case AVBIN_SAMPLE_FORMAT_S16:
+            return 2;
+        case AVBIN_SAMPLE_FORMAT_S32:
+        case AVBIN_SAMPLE_FORMAT_FLOAT:
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+static void bench_open(const char *filename)
+{
+    int64_t total = 0, best = -1, start, elapsed;
+    int i;
+
+    for (i = 0; i < runs; i++)
+    {
+        start = now_us();
+        AVbinFile *file = avbin_open_filename(filename);
+        elapsed = now_us() - start;
+        if (!file)
+            return;
+        avbin_close_file(file);
+
+        total += elapsed;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+
+    begin_result(filename, "open");
+    printf(", \"runs\": %d, \"mean_us\": %.1f, \"min_us\": %" PRId64 "}\n",
+           runs, per_item(total, runs), best);
+}
+
+static void bench_demux(const char *filename)
+{
+    AVbinFile *file = avbin_open_filename(filename);
+    AVbinPacket packet;
+    int64_t packets = 0, bytes = 0, start, elapsed;
+
+    if (!file)
+        return;
+
+    // No streams are open, so every packet of every stream is read
+    packet.structure_size = sizeof packet;
+    start = now_us();
+    while (!avbin_read(file, &packet))
+    {
+        packets++;
+        bytes += packet.size;
+    }
+    elapsed = now_us() - start;
+    avbin_close_file(file);
+
+    begin_result(filename, "demux");
+    printf(", \"packets\": %" PRId64 ", \"bytes\": %" PRId64
+           ", \"elapsed_us\": %" PRId64 ", \"packets_per_s\": %.1f"
+           ", \"bytes_per_s\": %.1f}\n",
+           packets, bytes, elapsed,
+           per_second(packets, elapsed), per_second(bytes, elapsed));
+}
+
+static void bench_decode(const char *filename)
+{
+    AVbinFile *file = avbin_open_filename(filename);
+    AVbinFileInfo file_info;
+    AVbinStreamInfo8 info[MAX_STREAMS];
+    AVbinStream *streams[MAX_STREAMS];
+    int64_t samples[MAX_STREAMS];
+    uint8_t *video_buffer[MAX_STREAMS];
+    uint8_t *audio_buffer;
+    AVbinPacket packet;
+    int64_t start, elapsed;
+    int n_streams, i;
+
+    if (!file)
+        return;
+
+    file_info.structure_size = sizeof file_info;
+    avbin_file_info(file, &file_info);
+    n_streams = file_info.n_streams < MAX_STREAMS ? file_info.n_streams
+                                                  : MAX_STREAMS;
+
+    audio_buffer = malloc(AUDIO_BUFFER_SIZE);
+    for (i = 0; i < n_streams; i++)
+    {
+        info[i].structure_size = sizeof info[i];
+        avbin_stream_info(file, i, (AVbinStreamInfo *) &info[i]);
+        streams[i] = NULL;
+        video_buffer[i] = NULL;
+        samples[i] = 0;
+        if (info[i].type != AVBIN_STREAM_TYPE_VIDEO &&
+            info[i].type != AVBIN_STREAM_TYPE_AUDIO)
+            continue;
+
+        streams[i] = avbin_open_stream(file, i);
+        if (streams[i] && info[i].type == AVBIN_STREAM_TYPE_VIDEO)
+            video_buffer[i] = malloc(avbin_get_video_output_size(streams[i]));
+    }
+
+    packet.structure_size = sizeof packet;
+    start = now_us();
+    while (!avbin_read(file, &packet))
+    {
+        i = packet.stream_index;
+        if (i >= n_streams || !streams[i])
+            continue;
+
+        if (info[i].type == AVBIN_STREAM_TYPE_VIDEO)
+        {
+            avbin_decode_video_packet(streams[i], &packet, video_buffer[i]);
+            continue;
+        }
+
+        while (packet.size > 0)
+        {
+            int size_out = AUDIO_BUFFER_SIZE;
+            int used = avbin_decode_audio_packet(streams[i], &packet,
+                                                 audio_buffer, &size_out);
+            if (used <= 0)
+                break;
+            packet.data += used;
+            packet.size -= used;
+            samples[i] += size_out;
+        }
+    }
+
+    // Collect what the decoders are still holding, so it is counted too
+    for (i = 0; i < n_streams; i++)
+    {
+        if (!streams[i])
+            continue;
+
+        if (info[i].type == AVBIN_STREAM_TYPE_VIDEO)
+        {
+            while (avbin_drain_video(streams[i], video_buffer[i]) > 0)
+                ;
+            continue;
+        }
+
+        for (;;)
+        {
+            int size_out = AUDIO_BUFFER_SIZE;
+            if (avbin_drain_audio(streams[i], audio_buffer, &size_out) <= 0)
+                break;
+            samples[i] += size_out;
+        }
+    }
+    elapsed = now_us() - start;
+
+    for (i = 0; i < n_streams; i++)
+    {
+        AVbinStats stats;
+
+        if (!streams[i])
+            continue;
+
+        stats.structure_size = sizeof stats;
+        avbin_get_stream_stats(streams[i], &stats);
+
+        begin_result(filename, "decode");
+        printf(", \"stream\": %d", i);
+        if (info[i].type == AVBIN_STREAM_TYPE_VIDEO)
+        {
+            printf(", \"type\": \"video\", \"width\": %u, \"height\": %u",
+                   info[i].video.width, info[i].video.height);
+        }
+        else
+        {
+            int frame_bytes = info[i].audio.channels *
+                sample_bytes(info[i].audio.sample_format);
+            if (frame_bytes)
+                samples[i] /= frame_bytes;
+            printf(", \"type\": \"audio\", \"sample_rate\": %u"
+                   ", \"channels\": %u, \"samples\": %" PRId64
+                   ", \"samples_per_s\": %.1f",
+                   info[i].audio.sample_rate, info[i].audio.channels,
+                   samples[i], per_second(samples[i], stats.decode.total_time));
+        }
+        printf(", \"packets\": %" PRId64 ", \"frames\": %" PRId64
+               ", \"frames_dropped\": %" PRId64 ", \"frames_per_s\": %.1f"
+               ", \"decode_us_per_frame\": %.1f"
+               ", \"convert_us_per_frame\": %.1f",
+               stats.packets, stats.frames, stats.frames_dropped,
+               per_second(stats.frames, stats.decode.total_time),
+               per_item(stats.decode.total_time, stats.frames),
+               per_item(stats.convert.total_time, stats.convert.calls));
+        print_stage("decode", &stats.decode);
+        print_stage("convert", &stats.convert);
+        printf("}\n");
+
+        avbin_close_stream(streams[i]);
+        free(video_buffer[i]);
+    }
+
+    begin_result(filename, "decode_total");
+    printf(", \"elapsed_us\": %" PRId64 "}\n", elapsed);
+
+    free(audio_buffer);
+    avbin_close_file(file);
+}
+
+/* Seek to evenly spaced points and time how long until the first frame
+ * of the first video stream (or, failing that, audio stream) is decoded. */
+static void bench_seek(const char *filename, int accurate)
+{
+    AVbinFile *file = avbin_open_filename(filename);
+    AVbinFileInfo file_info;
+    AVbinStreamInfo8 info;
+    AVbinStream *stream = NULL;
+    AVbinPacket packet;
+    uint8_t *buffer = NULL;
+    int64_t total = 0, worst = 0, start, elapsed;
+    int index = -1, done = 0, i;
+
+    if (!file)
+        return;
+
+    file_info.structure_size = sizeof file_info;
+    avbin_file_info(file, &file_info);
+    for (i = 0; i < file_info.n_streams; i++)
+    {
+        info.structure_size = sizeof info;
+        avbin_stream_info(file, i, (AVbinStreamInfo *) &info);
+        if (info.type == AVBIN_STREAM_TYPE_VIDEO ||
+            (index < 0 && info.type == AVBIN_STREAM_TYPE_AUDIO))
+        {
+            index = i;
+            if (info.type == AVBIN_STREAM_TYPE_VIDEO)
+                break;
+        }
+    }
+
+    if (index >= 0)
+        stream = avbin_open_stream(file, index);
+    if (!stream || file_info.duration <= 0 || seeks <= 0)
+    {
+        if (stream)
+            avbin_close_stream(stream);
+        avbin_close_file(file);
+        return;
+    }
+
+    info.structure_size = sizeof info;
+    avbin_stream_info(file, index, (AVbinStreamInfo *) &info);
+    buffer = malloc(info.type == AVBIN_STREAM_TYPE_VIDEO
+                    ? avbin_get_video_output_size(stream)
+                    : AUDIO_BUFFER_SIZE);
+    packet.structure_size = sizeof packet;
+
+    for (i = 0; i < seeks; i++)
+    {
+        AVbinTimestamp target = file_info.start_time +
+            file_info.duration * (2 * i + 1) / (2 * seeks);
+        int got_frame = 0;
+
+        start = now_us();
+        if (accurate)
+            avbin_seek_file_accurate(file, target);
+        else
+            avbin_seek_file(file, target);
+
+        while (!got_frame && !avbin_read(file, &packet))
+        {
+            if (packet.stream_index != index)
+                continue;
+            if (info.type == AVBIN_STREAM_TYPE_VIDEO)
+                got_frame = avbin_decode_video_packet(stream, &packet,
+                                                      buffer) > 0;
+            else
+            {
+                int size_out = AUDIO_BUFFER_SIZE;
+                got_frame = avbin_decode_audio_packet(stream, &packet, buffer,
+                                                      &size_out) > 0 &&
+                            size_out > 0;
+            }
+        }
+        elapsed = now_us() - start;
+
+        if (!got_frame)
+            continue;
+        done++;
+        total += elapsed;
+        if (elapsed > worst)
+            worst = elapsed;
+    }
+
+    begin_result(filename, accurate ? "seek_accurate" : "seek");
+    printf(", \"stream\": %d, \"seeks\": %d, \"mean_us\": %.1f"
+           ", \"max_us\": %" PRId64 "}\n",
+           index, done, per_item(total, done), worst);
+
+    free(buffer);
+    avbin_close_stream(stream);
+    avbin_close_file(file);
+}
+
+/* Decode every audio and video stream of a file to the end, returning the
+ * number of frames decoded. */
+static int64_t decode_whole_file(const char *filename, uint8_t *audio_buffer)
+{
+    AVbinFile *file = avbin_open_filename(filename);
+    AVbinFileInfo file_info;
+    AVbinStreamInfo info;
+    AVbinStream *streams[MAX_STREAMS];
+    uint8_t *video_buffer[MAX_STREAMS];
+    AVbinPacket packet;
+    int64_t frames = 0;
+    int n_streams, i;
+
+    if (!file)
+        return 0;
+
+    file_info.structure_size = sizeof file_info;
+    avbin_file_info(file, &file_info);
+    n_streams = file_info.n_streams < MAX_STREAMS ? file_info.n_streams
+                                                  : MAX_STREAMS;
+    for (i = 0; i < n_streams; i++)
+    {
+        info.structure_size = sizeof info;
+        avbin_stream_info(file, i, &info);
+        streams[i] = NULL;
+        video_buffer[i] = NULL;
+        if (info.type == AVBIN_STREAM_TYPE_VIDEO ||
+            info.type == AVBIN_STREAM_TYPE_AUDIO)
+            streams[i] = avbin_open_stream(file, i);
+        if (streams[i] && info.type == AVBIN_STREAM_TYPE_VIDEO)
+            video_buffer[i] = malloc(avbin_get_video_output_size(streams[i]));
+    }
+
+    packet.structure_size = sizeof packet;
+    while (!avbin_read(file, &packet))
+    {
+        i = packet.stream_index;
+        if (i >= n_streams || !streams[i])
+            continue;
+
+        if (video_buffer[i])
+        {
+            if (avbin_decode_video_packet(streams[i], &packet,
+                                          video_buffer[i]) > 0)
+                frames++;
+            continue;
+        }
+
+        while (packet.size > 0)
+        {
+            int size_out = AUDIO_BUFFER_SIZE;
+            int used = avbin_decode_audio_packet(streams[i], &packet,
+                                                 audio_buffer, &size_out);
+            if (used <= 0)
+                break;
+            packet.data += used;
+            packet.size -= used;
+            if (size_out > 0)
+                frames++;
+        }
+    }
+
+    for (i = 0; i < n_streams; i++)
+    {
+        if (streams[i])
+            avbin_close_stream(streams[i]);
+        free(video_buffer[i]);
+    }
+    avbin_close_file(file);
+    return frames;
+}
+
+struct stress_job
+{
+    pthread_t thread;
+    char **filenames;
+    int n_files;
+    int index;
+    int64_t frames;
+};
+
+static void *stress_thread(void *arg)
+{
+    struct stress_job *job = arg;
+    uint8_t *audio_buffer = malloc(AUDIO_BUFFER_SIZE);
+    int i;
+
+    // Each thread starts on a different file, so that threads are not all
+    // opening the same file at the same moment.
+    job->frames = 0;
+    for (i = 0; i < job->n_files; i++)
+        job->frames += decode_whole_file(
+            job->filenames[(i + job->index) % job->n_files],
+            audio_buffer);
+    free(audio_buffer);
+    return NULL;
+}
+
+/* Decode all files completely on 1, 2, ... stress threads at once, each
+ * thread getting its own AVbinFile for every file. */
+static void bench_stress(char **filenames, int n_files)
+{
+    struct stress_job *jobs = calloc(stress, sizeof *jobs);
+    double base_rate = 0.0;
+    int n, i;
+
+    for (n = 1; n <= stress; n++)
+    {
+        int64_t frames = 0, start, elapsed;
+        double rate;
+
+        start = now_us();
+        for (i = 0; i < n; i++)
+        {
+            jobs[i].filenames = filenames;
+            jobs[i].n_files = n_files;
+            jobs[i].index = i;
+            if (pthread_create(&jobs[i].thread, NULL, stress_thread, &jobs[i]))
+                break;
+        }
+        n = i;
+        for (i = 0; i < n; i++)
+        {
+            pthread_join(jobs[i].thread, NULL);
+            frames += jobs[i].frames;
+        }
+        elapsed = now_us() - start;
+        if (n == 0)
+            break;
+
+        rate = per_second(frames, elapsed);
+        if (n == 1)
+            base_rate = rate;
+        printf("{\"test\": \"stress\", \"threads\": %d, \"frames\": %" PRId64
+               ", \"elapsed_us\": %" PRId64 ", \"frames_per_s\": %.1f"
+               ", \"speedup\": %.2f}\n",
+               n, frames, elapsed, rate, base_rate > 0 ? rate / base_rate : 0.0);
+        fflush(stdout);
+    }
+    free(jobs);
+}
+
+static void usage(void)
+{
+    printf("Usage: avbin_bench [options] file...\n\n"
+           "  -h, --help       Print this help message.\n"
+           "  -r, --runs N     Times to open each file for open latency (default 5).\n"
+           "  -s, --seeks N    Seeks per file for seek latency (default 10).\n"
+           "  -t, --threads N  Decoder threads, 0 for one per core (default 1).\n"
+           "  -j, --stress N   Afterwards, decode all files on 1 to N threads at\n"
+           "                   once to measure scaling (default off).\n\n"
+           "Results are printed as one JSON object per line.\n");
+}
+
+int main(int argc, char **argv)
+{
+    AVbinOptions options;
+    AVbinInfo *info;
+    int i, first_file = argc;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+        {
+            usage();
+            exit(0);
+        }
+        else if (i + 1 < argc &&
+                 (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--runs") == 0))
+            runs = atoi(argv[++i]);
+        else if (i + 1 < argc &&
+                 (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--seeks") == 0))
+            seeks = atoi(argv[++i]);
+        else if (i + 1 < argc &&
+                 (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0))
+            threads = atoi(argv[++i]);
+        else if (i + 1 < argc &&
+                 (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--stress") == 0))
+            stress = atoi(argv[++i]);
+        else if (argv[i][0] == '-')
+        {
+            printf("Invalid argument.  Try --help\n\n");
+            exit(-3);
+        }
+        else
+        {
+            first_file = i;
+            break;
+        }
+    }
+
+    if (first_file == argc || runs <= 0)
+    {
+        usage();
+        exit(-1);
+    }
+
+    options.structure_size = sizeof options;
+    options.thread_count = threads;
+    if (avbin_init_options(&options))
+    {
+        printf("Fatal: Couldn't initialize AVbin");
+        exit(-1);
+    }
+    avbin_set_log_level(AVBIN_LOG_QUIET);
+
+    if (!avbin_have_feature("stats"))
+    {
+        printf("Fatal: This AVbin does not have the stats feature\n");
+        exit(-1);
+    }
+
+    info = avbin_get_info();
+    printf("{\"test\": \"info\", \"avbin\": ");
+    print_string(info->version_string);
+    printf(", \"commit\": ");
+    print_string(info->commit);
+    printf(", \"backend\": ");
+    print_string(info->backend);
+    printf(", \"backend_version\": ");
+    print_string(info->backend_version_string);
+    printf(", \"backend_commit\": ");
+    print_string(info->backend_commit);
+    printf(", \"threads\": %d}\n", threads);
+
+    for (i = first_file; i < argc; i++)
+    {
+        AVbinFile *file = avbin_open_filename(argv[i]);
+        if (!file)
+        {
+            begin_result(argv[i], "error");
+            printf(", \"error\": \"could not open\"}\n");
+            continue;
+        }
+        avbin_close_file(file);
+
+        bench_open(argv[i]);
+        bench_demux(argv[i]);
+        bench_decode(argv[i]);
+        bench_seek(argv[i], 0);
+        bench_seek(argv[i], 1);
+        fflush(stdout);
+    }
+
+    if (stress > 0)
+    {
+        if (!avbin_have_feature("thread_safe"))
+            printf("Fatal: This AVbin is not safe to use from many threads\n");
+        else
+            bench_stress(argv + first_file, argc - first_file);
+    }
+
+    return 0;
+}
@@ -162,8 +162,13 @@ int main(int argc, char** argv)
         if (packet.stream_index == video_stream_index)
         {
             uint8_t* video_buffer = (uint8_t*) malloc(width*height*3);
-            if (avbin_decode_video(video_stream, packet.data, packet.size,video_buffer)<=0) printf("could not read video packet\n");
-            else printf("read video frame\n");
+            AVbinTimestamp frame_time, frame_duration;
+            if (avbin_decode_video_packet(video_stream, &packet, video_buffer)<=0) printf("could not read video packet\n");
+            else
+            {
+                avbin_get_frame_time(video_stream, &frame_time, &frame_duration);
+                printf("[%" PRId64 "] read video frame\n", frame_time);
+            }
 
             // do something with video_buffer
 
@@ -176,7 +181,7 @@ int main(int argc, char** argv)
             int bytesout = bytesleft;
             int bytesread;
             uint8_t* audio_data = audio_buffer;
-            while ((bytesread = avbin_decode_audio(audio_stream, packet.data, packet.size, audio_data, &bytesout)) > 0)
+            while ((bytesread = avbin_decode_audio_packet(audio_stream, &packet, audio_data, &bytesout)) > 0)
             {
                 packet.data += bytesread;
                 packet.size -= bytesread;
@@ -193,6 +198,31 @@ int main(int argc, char** argv)
         }
     }
 
+    // Frames the video decoder held back to reorder
+    if (video_stream)
+    {
+        uint8_t* video_buffer = (uint8_t*) malloc(width*height*3);
+        AVbinTimestamp frame_time, frame_duration;
+        while (avbin_drain_video(video_stream, video_buffer) > 0)
+        {
+            avbin_get_frame_time(video_stream, &frame_time, &frame_duration);
+            printf("[%" PRId64 "] read delayed video frame\n", frame_time);
+        }
+        free(video_buffer);
+    }
+
+    // Audio still buffered in the decoder or resampler
+    if (audio_stream)
+    {
+        uint8_t audio_buffer[1024*1024];
+        int bytesout = sizeof(audio_buffer);
+        while (avbin_drain_audio(audio_stream, audio_buffer, &bytesout) > 0)
+        {
+            printf("read %d bytes of delayed audio\n", bytesout);
+            bytesout = sizeof(audio_buffer);
+        }
+    }
+
     if (video_stream) avbin_close_stream(video_stream);
     if (audio_stream) avbin_close_stream(audio_stream);
 
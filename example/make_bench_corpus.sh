@@ -0,0 +1,97 @@
+#!/bin/bash
+#
+# make_bench_corpus.sh
+# Copyright 2012-2013 AVbin Team
+#
+# This file is part of AVbin.
+#
+# AVbin is free software; you can redistribute it and/or modify it
+# under the terms of the GNU Lesser General Public License as
+# published by the Free Software Foundation; either version 3 of
+# the License, or (at your option) any later version.
+#
+# AVbin is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# Lesser Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this program.  If not, see
+# <http://www.gnu.org/licenses/>.
+
+# Generate a small corpus of synthetic test media for avbin_bench, entirely
+# offline.  The same inputs (test pattern video and a sine tone) and
+# bit-exact encoding are used every time, so results from different AVbin
+# or backend builds can be compared.
+#
+# Usage: make_bench_corpus.sh [output directory]
+#
+# Needs avconv (which the libav backend builds, if enabled) or ffmpeg, with
+# the lavfi input device.  Files whose encoders are not available are
+# skipped.  Set DURATION (seconds) or SIZE (WxH) to change the defaults.
+
+OUTDIR=${1:-corpus}
+DURATION=${DURATION:-20}
+SIZE=${SIZE:-640x360}
+RATE=25
+
+if [ -n "$ENCODER" ]; then
+    true
+elif [ -x ../libav/avconv ]; then
+    ENCODER=../libav/avconv
+elif which avconv >/dev/null 2>&1; then
+    ENCODER=avconv
+elif which ffmpeg >/dev/null 2>&1; then
+    ENCODER=ffmpeg
+else
+    echo "Neither avconv nor ffmpeg found.  Set ENCODER to one of them."
+    exit 1
+fi
+
+# has_source <lavfi source>: whether the encoder has a lavfi source
+has_source() {
+    $ENCODER -loglevel quiet -f lavfi -i "$1" -t 0.1 -f null - </dev/null
+}
+
+VIDEO="-f lavfi -i testsrc=duration=$DURATION:size=$SIZE:rate=$RATE"
+if has_source "sine=frequency=440"; then
+    AUDIO="-f lavfi -i sine=frequency=440:sample_rate=44100:duration=$DURATION"
+elif has_source "aevalsrc=0"; then
+    AUDIO="-f lavfi -i aevalsrc=sin(440*2*PI*t):s=44100:d=$DURATION"
+else
+    # Silence compresses unrealistically well; prefer a build with a tone
+    echo "No tone generator in $ENCODER; audio will be silent."
+    AUDIO="-f lavfi -i anullsrc=sample_rate=44100 -t $DURATION"
+fi
+STEREO="-ac 2"
+COMMON="-y -loglevel error -bitexact -flags +bitexact"
+
+# encode <name> <arguments...>: encode $OUTDIR/<name>, reporting failure
+encode() {
+    name=$1
+    shift
+    if $ENCODER $COMMON "$@" "$OUTDIR/$name" </dev/null; then
+        echo "Made $OUTDIR/$name"
+    else
+        echo "Skipped $OUTDIR/$name (encoder not available?)"
+        rm -f "$OUTDIR/$name"
+    fi
+}
+
+mkdir -p "$OUTDIR"
+
+# Video with audio, in the common containers and codecs
+encode h264_aac.mp4      $VIDEO $AUDIO $STEREO -c:v libx264 -g 50 -c:a aac -strict experimental
+encode mpeg4_mp2.avi     $VIDEO $AUDIO $STEREO -c:v mpeg4 -g 50 -q:v 4 -c:a mp2
+encode vp8_vorbis.webm   $VIDEO $AUDIO $STEREO -c:v libvpx -g 50 -b:v 1M -c:a libvorbis
+encode theora_vorbis.ogv $VIDEO $AUDIO $STEREO -c:v libtheora -g 50 -q:v 6 -c:a libvorbis
+encode mjpeg_pcm.mov     $VIDEO $AUDIO $STEREO -c:v mjpeg -q:v 4 -c:a pcm_s16le
+
+# Video only, at a resolution where conversion cost dominates
+encode mpeg2_1080p.mpg   -f lavfi -i testsrc=duration=$DURATION:size=1920x1080:rate=$RATE -c:v mpeg2video -g 15 -q:v 4
+
+# Audio only
+encode sine.wav          $AUDIO $STEREO -c:a pcm_s16le
+encode sine.flac         $AUDIO $STEREO -c:a flac
+encode sine.mp3          $AUDIO $STEREO -c:a libmp3lame -b:a 192k
+encode sine.ogg          $AUDIO $STEREO -c:a libvorbis
@@ -66,6 +66,24 @@
  *
  * When decoding is complete, call avbin_close_stream() on each stream and
  * avbin_close_file() on the open file.
+ *
+ * @section threads Threads
+ *
+ * If avbin_have_feature("thread_safe") is true, AVbin may be used from many
+ * threads at once:
+ *   - Each AVbinFile, together with its streams, is independent of every
+ *     other.  Different files may be opened, read, decoded, seeked and closed
+ *     on different threads at the same time without any locking by the
+ *     application.
+ *   - A single file and its streams must only be used by one thread at a
+ *     time.  The exceptions are the functions documented as safe to call from
+ *     another thread, such as avbin_pipeline_pop() and the statistics
+ *     functions.
+ *   - avbin_init() and avbin_init_options() may be called any number of
+ *     times from any thread.
+ *   - The log callback and level, log options and thread limit are
+ *     process-wide.  They may be changed at any time, but the log callback
+ *     may then be called from any thread that uses AVbin.
  */
 
 /**
@@ -86,7 +104,10 @@ extern "C" {
  */
 typedef enum _AVbinResult {
     AVBIN_RESULT_ERROR = -1,
-    AVBIN_RESULT_OK = 0
+    AVBIN_RESULT_OK = 0,
+    /** Nothing is ready yet; try again later.  Only returned by functions
+     *  that never block, such as avbin_pipeline_pop(). */
+    AVBIN_RESULT_AGAIN = 1
 } AVbinResult;
 
 /**
@@ -116,6 +137,46 @@ typedef enum _AVbinSampleFormat {
     AVBIN_SAMPLE_FORMAT_FLOAT = 4
 } AVbinSampleFormat;
 
+/**
+ * The pixel format of decoded video images.
+ */
+typedef enum _AVbinPixelFormat {
+    /** Packed 8-bit RGB, 3 bytes per pixel.  This is the default. */
+    AVBIN_PIXEL_FORMAT_RGB24 = 0,
+    /** Packed 8-bit RGBA, 4 bytes per pixel */
+    AVBIN_PIXEL_FORMAT_RGBA = 1,
+    /** Packed 8-bit BGRA, 4 bytes per pixel */
+    AVBIN_PIXEL_FORMAT_BGRA = 2,
+    /** Planar YUV 4:2:0.  The Y plane is followed by the U and V planes, each
+     *  at half width and half height. */
+    AVBIN_PIXEL_FORMAT_YUV420P = 3,
+    /** Planar YUV 4:2:2.  Only reported by avbin_decode_video_frame(). */
+    AVBIN_PIXEL_FORMAT_YUV422P = 4,
+    /** Planar YUV 4:4:4.  Only reported by avbin_decode_video_frame(). */
+    AVBIN_PIXEL_FORMAT_YUV444P = 5,
+    /** Y plane followed by an interleaved UV plane.  Only reported by
+     *  avbin_decode_video_frame(). */
+    AVBIN_PIXEL_FORMAT_NV12 = 6,
+    /** Any other format; see _AVbinFrame::backend_pixel_format */
+    AVBIN_PIXEL_FORMAT_UNKNOWN = -1
+} AVbinPixelFormat;
+
+/**
+ * Scaling algorithm used when converting video images to a different size.
+ */
+typedef enum _AVbinScaleQuality {
+    /** Fast, lower quality bilinear scaling.  This is the default. */
+    AVBIN_SCALE_FAST_BILINEAR = 0,
+    AVBIN_SCALE_BILINEAR = 1,
+    AVBIN_SCALE_BICUBIC = 2,
+    /** Nearest neighbour */
+    AVBIN_SCALE_POINT = 3,
+    /** Averaging; good for large reductions in size */
+    AVBIN_SCALE_AREA = 4,
+    /** Slow, high quality */
+    AVBIN_SCALE_LANCZOS = 5
+} AVbinScaleQuality;
+
 /**
  * Threshold of logging verbosity.
  */
@@ -140,6 +201,11 @@ typedef struct _AVbinFile AVbinFile;
  */
 typedef struct _AVbinStream AVbinStream;
 
+/**
+ * Opaque reference-counted packet handle.  See avbin_read_ref()
+ */
+typedef struct _AVbinPacketRef AVbinPacketRef;
+
 /**
  * Point in time, or a time range; given in microseconds.
  */
@@ -217,7 +283,10 @@ typedef struct _AVbinStreamInfo {
             /**
              * Width of the video image, in pixels.  This is the width
              * of actual video data, and is not necessarily the size the
-             * video is to be displayed at (see sample_aspect_num).
+             * video is to be displayed at (see sample_aspect_num).  For an
+             * open stream, since version 11, it is the width of the images
+             * avbin_decode_video() writes (see avbin_set_video_output()
+             * and avbin_set_lowres()).
              */
             uint32_t width;
 
@@ -356,6 +425,10 @@ typedef struct _AVbinStreamInfo8 {
  * data will point to a block of memory allocated by AVbin -- you must not
  * free it.  The data will be valid until the next time you call avbin_read,
  * or until the file is closed.
+ *
+ * The data is always followed by zeroed padding, so it can be passed to
+ * avbin_decode_audio_packet() or avbin_decode_video_packet() without being
+ * copied.
  */
 typedef struct _AVbinPacket {
     /**
@@ -367,6 +440,11 @@ typedef struct _AVbinPacket {
     /**
      * The time at which this packet is to be played.  This can be used
      * to synchronise audio and video data.
+     *
+     * This is the packet's decode time.  Where frames are reordered (video
+     * with B-frames), decoded frames come out in a different order and
+     * later than their packets; use avbin_get_frame_time() for the
+     * presentation time of what was decoded.
      */
     AVbinTimestamp timestamp;
 
@@ -381,72 +459,90 @@ typedef struct _AVbinPacket {
 
 
 /**
- * Information about the AVbin library.  See avbin_get_info()
+ * Output configuration for a video stream.  See avbin_set_video_output()
  */
-typedef struct _AVbinInfo {
+typedef struct _AVbinVideoOutput {
     /**
-     * Size of this structure, in bytes.  This will be filled in for you by
-     * avbin_get_info() so that you can determine which version of this struct
-     * you have received.  For example:
-     *   AVbinInfo * info = avbin_get_info()
-     *   if (info->structure_size == sizeof(AVbinInfo)
-     *       // You are safe to access the members of an AVbinInfo typedef...
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
      */
     size_t structure_size;
 
     /**
-     * AVbin version as an integer.  This value is the same as returned by
-     * the avbin_get_version() function.  Consider using version_string instead.
+     * Pixel format of the images written by avbin_decode_video().
      */
-    int32_t version;
+    AVbinPixelFormat pixel_format;
 
     /**
-     * AVbin version string, including pre-release information, i.e. "10-beta1".
+     * Size of the images written by avbin_decode_video(), in pixels.  Zero
+     * means the size of the video itself, reduced as set by
+     * avbin_set_lowres().
      */
-    char *version_string;
+    int32_t width;
+    int32_t height;
 
     /**
-     * When the library was built, in strftime format "%Y-%m-%d %H:%M:%S %z"
+     * Algorithm used if the image needs to be scaled.
      */
-    char *build_date;
+    AVbinScaleQuality scale_quality;
+} AVbinVideoOutput;
 
+/**
+ * Whether packets of a stream are read.  See avbin_select_stream()
+ */
+typedef enum _AVbinStreamSelection {
     /**
-     * URL to the AVbin repository used.
+     * Read the stream if it is open, or if no stream is open.
      */
-    char *repo;
+    AVBIN_STREAM_AUTO = 0,
 
     /**
-     * The commit of the AVbin repository used.
+     * Always read the stream.
      */
-    char *commit;
+    AVBIN_STREAM_ENABLED = 1,
 
     /**
-     * Which backend we are using: "libav" or "ffmpeg"
+     * Never read the stream.
      */
-    char *backend;
+    AVBIN_STREAM_DISABLED = 2
+} AVbinStreamSelection;
 
+/**
+ * Thumbnail mode settings for a video stream.  See
+ * avbin_set_thumbnail_mode()
+ */
+typedef struct _AVbinThumbnailOptions {
     /**
-     * The version string of the most recent tag of the backend.  Note: There
-     * may be custom patches *on top* of the backend version.
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
      */
-    char *backend_version_string;
+    size_t structure_size;
 
     /**
-     * URL to the backend repository used for this release.
+     * Size of the thumbnails, in pixels.  If either is 0 it is worked out
+     * from the other, keeping the picture's display aspect ratio; if both
+     * are 0 the thumbnails are full size.
      */
-    char *backend_repo;
+    int32_t width;
+    int32_t height;
 
     /**
-     * The commit hash of the backend repo used for the backend.
+     * Have the decoder itself decode at 1/2, 1/4 or 1/8 size (1, 2 or 3),
+     * or 0 for full size.  This is much faster where the decoder supports
+     * it, and ignored where it does not.
      */
-    char *backend_commit;
-} AVbinInfo;
+    int32_t lowres;
+} AVbinThumbnailOptions;
 
 
 /**
- * Initialization Options
+ * A decoded block of audio, exactly as the decoder produced it.  See
+ * avbin_decode_audio_frame().
+ *
+ * The sample data is owned by AVbin -- you must not free it.  It remains valid
+ * until the next decode call on the same stream.
  */
-typedef struct _AVbinOptions {
+typedef struct _AVbinAudioFrame {
     /**
      * Size of this structure, in bytes.  This must be filled in by the
      * application before passing to AVbin.
@@ -454,207 +550,1579 @@ typedef struct _AVbinOptions {
     size_t structure_size;
 
     /**
-     * Number of threads to attempt to use.  Using the recommended thread_count of
-     * 0 means try to detect the number of CPU cores and set threads to
-     * (num cores + 1).  A thread_count of 1 or a negative number means single
-     * threaded.  Any other number will result in an attempt to set that many threads.
+     * Presentation time of the first sample, or AV_NOPTS_VALUE (INT64_MIN)
+     * if it is not known.
      */
-    int32_t thread_count;
-} AVbinOptions;
+    AVbinTimestamp timestamp;
 
+    /**
+     * Data type of each sample, or -1 if it has no AVbin equivalent (for
+     * example double precision floating-point).
+     */
+    AVbinSampleFormat sample_format;
 
-/**
- * Callback for log information.
- *
- * @param module  The name of the module where this message originated
- * @param level   The log verbosity level of this message
- * @param message The formatted message.  The message may or may not contain
- *                newline characters.
- */
-typedef void (*AVbinLogCallback)(const char *module,
-                                 AVbinLogLevel level,
-                                 const char *message);
+    /**
+     * The backend's own identifier for the sample format (a Libav
+     * AVSampleFormat value).
+     */
+    int32_t backend_sample_format;
 
-/**
- * @name Information about AVbin
- */
+    /**
+     * Non-zero if each channel is in its own plane; zero if all channels are
+     * interleaved in data[0].
+     */
+    int32_t planar;
 
-/**
- * Get the linked version of AVbin.
- *
- * Version numbers are always integer, there are no "minor" or "patch"
- * revisions.  All AVbin versions are backward and forward compatible, modulo
- * the required feature set.
- */
-int32_t avbin_get_version();
+    /**
+     * Number of channels and samples per second, in Hz.
+     */
+    int32_t channels;
+    int32_t sample_rate;
 
+    /**
+     * Number of samples per channel.  Zero if the decoder did not produce
+     * any audio for this call.
+     */
+    int32_t nb_samples;
 
-/**
- * Get information about the linked version of AVbin.
- *
- * See the AVbinInfo definition.
- */
-AVbinInfo *avbin_get_info();
+    /**
+     * One pointer per channel for planar audio, or a single pointer for
+     * interleaved audio.
+     */
+    uint8_t **data;
 
+    /**
+     * Number of valid bytes in each plane.
+     */
+    int32_t linesize;
 
-/**
- * Get the SVN revision of FFmpeg.
- *
- * This is built into AVbin as it is built.
- *
- * DEPRECATED: Use avbin_get_libav_commit or avbin_get_libav_version instead.
- *             This always returns 0 now that we use Libav from Git.  This
- *             function will be removed in AVbin 12.
- */
-#ifndef _MSC_VER
-int32_t avbin_get_ffmpeg_revision() __attribute__((deprecated));
-#else
-int32_t avbin_get_ffmpeg_revision();
-#pragma deprecated(avbin_get_ffmpeg_revision)
-#endif
+    /**
+     * Duration of the samples, in microseconds.  Zero if the decoder did not
+     * produce any audio for this call.
+     *
+     * @version Version 11.  Requires frame_time feature.
+     */
+    AVbinTimestamp duration;
+} AVbinAudioFrame;
 
 /**
- * DEPRECATED.  Get the minimum audio buffer size, in bytes.
- * Why is this even here?  It just returns the number 192000.  It has been
- * removed upstream, so we'll remove it as well some time soon.
+ * Output configuration for an audio stream.  See avbin_set_audio_output()
  */
-#ifndef _MSC_VER
-size_t avbin_get_audio_buffer_size() __attribute__((deprecated));;
-#else
-size_t avbin_get_audio_buffer_size();
-#pragma deprecated(avbin_get_audio_buffer_size)
-#endif
+typedef struct _AVbinAudioOutput {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
 
-/**
- * Determine if AVbin includes a requested feature.
- *
- * When future versions of AVbin include more functionality, that
- * functionality can be tested for by calling this function.  The following
- * features can be tested for:
- *  - "frame_rate" // AVbinStreamInfo8, frame_rate variables.
- *  - "options"    // avbin_init_options(), AVbinOptions (multi-threading)
- *  - "info"       // avbin_get_info(), AVbinInfo
- *
- *
- * NOTE: The "frame_rate" feature was available in versions 9 and 10, but
- * removed in version 11.  Populating r_frame_rate was considered an unreliable
- * hack upstream and removed.  If you try to access it in the upstream library,
- * it is always {0, 0}.  Perhaps we can find a different source of frame rate
- * and re-enable this feature in the future.
- *
- * @retval 1 The feature is present
- * @retval 0 The feature is not present
- */
-int32_t avbin_have_feature(const char *feature);
-/*@}*/
+    /**
+     * Data type of the interleaved samples written by avbin_decode_audio().
+     */
+    AVbinSampleFormat sample_format;
 
-/**
- * @name Global AVbin functions
- */
+    /**
+     * Samples per second to write, in Hz, or 0 for the stream's own rate.
+     * Requires resample feature.
+     */
+    int32_t sample_rate;
 
-/**
- * One of the avbin_init* functions must be called before opening a file to
- * initialize AVbin.  Check the return value for success before continuing.
- */
+    /**
+     * Number of channels to write, from 1 to 8, or 0 for the stream's own.
+     * Unless channel_layout says otherwise, audio is remixed to the
+     * standard channel layout for this number of channels.  Requires
+     * resample feature.
+     */
+    int32_t channels;
 
-/**
- * Initialize AVbin with basic features.  Consider instead avbin_init_options()
- */
-AVbinResult avbin_init();
+    /**
+     * Speakers to write, as a WAVE_FORMAT_EXTENSIBLE channel mask (1 front
+     * left, 2 front right, 4 front center, 8 low frequency, 0x10 back left,
+     * 0x20 back right, and so on), with the channels interleaved in bit
+     * order.  0 for the standard layout for channels.  When set, channels
+     * must be 0 or match the number of bits set, which is from 1 to 8.
+     * Requires resample feature.
+     */
+    uint64_t channel_layout;
+} AVbinAudioOutput;
 
 /**
- * Initialize AVbin with options.
- *
- * @param options  If NULL, use defaults.  Otherwise create and populate an
- *                 instance of AVbinOptions to supply.
+ * Callbacks for reading media from somewhere other than a file.  See
+ * avbin_open_io()
  */
-AVbinResult avbin_init_options(AVbinOptions * options);
+typedef struct _AVbinIOCallbacks {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
 
-/**
- * Set the log level verbosity.
- */
-AVbinResult avbin_set_log_level(AVbinLogLevel level);
+    /**
+     * Passed as the first argument to each callback.
+     */
+    void *opaque;
 
-/**
- * Set a custom log callback.  By default, log messages are printed to
- * standard error.  Providing a NULL callback restores this default handler.
- */
-AVbinResult avbin_set_log_callback(AVbinLogCallback callback);
-/*@}*/
+    /**
+     * Read up to size bytes into buffer.  Required.
+     *
+     * @return the number of bytes read, 0 at the end of the data, or a
+     *         negative number on error.
+     */
+    int32_t (*read)(void *opaque, uint8_t *buffer, int32_t size);
 
-/**
- * @name File handling functions
- */
+    /**
+     * Move the read position, as with fseek().  whence is one of SEEK_SET,
+     * SEEK_CUR or SEEK_END.  May be NULL if the data is not seekable, in
+     * which case avbin_seek_file() will fail.
+     *
+     * @return the new position, or a negative number on error.
+     */
+    int64_t (*seek)(void *opaque, int64_t offset, int32_t whence);
+
+    /**
+     * Total size of the data in bytes.  May be NULL, or return a negative
+     * number, if it is not known.
+     */
+    int64_t (*size)(void *opaque);
+} AVbinIOCallbacks;
 
 /**
- * Open a media file given its filename.
- *
- * @retval NULL if the file could not be opened, or is not of a recognised
- *              file format.
+ * How much of the media to examine when opening it.  See AVbinOpenOptions
  */
-AVbinFile *avbin_open_filename(const char *filename);
-AVbinFile *avbin_open_filename_with_format(const char *filename, char* format);
+typedef enum _AVbinStreamInfoMode {
+    /**
+     * Read and decode the start of every stream while opening, so that
+     * stream information is complete.  This is what avbin_open_filename()
+     * does.
+     */
+    AVBIN_STREAM_INFO_FULL = 0,
+
+    /**
+     * Only read the container header while opening.  The streams are
+     * examined on the first call to avbin_file_info(), avbin_stream_info(),
+     * avbin_open_stream() or avbin_start_pipeline().
+     */
+    AVBIN_STREAM_INFO_LAZY = 1,
+
+    /**
+     * Only read the container header, ever.  avbin_stream_info() reports
+     * whatever the header describes, which for some containers is very
+     * little.
+     */
+    AVBIN_STREAM_INFO_HEADER = 2
+} AVbinStreamInfoMode;
 
 /**
- * Close a media file.
+ * Options for opening a file.  See avbin_open_filename_with_options()
  */
-void avbin_close_file(AVbinFile *file);
+typedef struct _AVbinOpenOptions {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Maximum number of bytes to read while examining the streams, or 0 for
+     * the Libav default.
+     */
+    int32_t probesize;
+
+    /**
+     * Maximum duration of media to decode while examining the streams, in
+     * microseconds, or 0 for the Libav default.
+     */
+    AVbinTimestamp analyzeduration;
+
+    /**
+     * One of AVbinStreamInfoMode.
+     */
+    int32_t stream_info;
+
+    /**
+     * Sidecar keyframe index to load once the file is open (see
+     * avbin_load_index()), or NULL.  A missing or stale index is ignored.
+     */
+    const char *index_path;
+} AVbinOpenOptions;
 
 /**
- * Seek to a timestamp within a file.
- *
- * For video files, the first keyframe before the requested timestamp will be
- * seeked to.  For audio files, the first audio packet before the requested
- * timestamp is used.
+ * Number of planes in an _AVbinFrame.
  */
-AVbinResult avbin_seek_file(AVbinFile *file, AVbinTimestamp timestamp);
+#define AVBIN_FRAME_PLANES 4
 
 /**
- * Get information about the opened file.
+ * A decoded video image, exactly as the decoder produced it.  See
+ * avbin_decode_video_frame().
  *
- * The info struct must be allocated by the application and have its
- * structure_size member filled in correctly.  On return, the structure
- * will be filled with file details.
+ * The plane pointers refer to memory owned by AVbin -- you must not free
+ * it.  They remain valid until avbin_release_frame() is called or the file
+ * is seeked, and until then every other decode call on the stream fails.
  */
-AVbinResult avbin_file_info(AVbinFile *file,
+typedef struct _AVbinFrame {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Presentation time of the image, or AV_NOPTS_VALUE (INT64_MIN) if it
+     * is not known.
+     */
+    AVbinTimestamp timestamp;
+
+    /**
+     * Size of the image, in pixels.
+     */
+    int32_t width;
+    int32_t height;
+
+    /**
+     * Layout of the planes.  AVBIN_PIXEL_FORMAT_UNKNOWN if the decoder
+     * produced a format without an AVbin equivalent.
+     */
+    AVbinPixelFormat pixel_format;
+
+    /**
+     * The backend's own identifier for the pixel format (a Libav
+     * PixelFormat value), for formats AVbin has no name for.
+     */
+    int32_t backend_pixel_format;
+
+    /**
+     * Non-zero if YUV samples use the full 0-255 range (JPEG) rather than
+     * the usual 16-235 video range.
+     */
+    int32_t full_range;
+
+    /**
+     * Non-zero if this is a keyframe.
+     */
+    int32_t key_frame;
+
+    /**
+     * Pointers to the start of each plane, and the number of bytes between
+     * the start of each row of that plane.  Unused planes are NULL.
+     */
+    uint8_t *data[AVBIN_FRAME_PLANES];
+    int32_t linesize[AVBIN_FRAME_PLANES];
+
+    /**
+     * The _AVbinBuffer::opaque pointer of the application buffer holding
+     * the image, or NULL if AVbin allocated it.  See _AVbinBufferProvider.
+     */
+    void *opaque;
+
+    /**
+     * How long the image is shown for, in microseconds, or 0 if it is not
+     * known.
+     *
+     * @version Version 11.  Requires frame_time feature.
+     */
+    AVbinTimestamp duration;
+} AVbinFrame;
+
+/**
+ * An image buffer supplied by the application.  See _AVbinBufferProvider.
+ *
+ * AVbin fills in everything but opaque before asking for a buffer, with
+ * linesize and size describing a suggested layout of all the planes in one
+ * block.  The application either sets data[0] to a block of at least size
+ * bytes laid out that way, or sets every plane in data and linesize itself.
+ */
+typedef struct _AVbinBuffer {
+    /**
+     * Size of this structure, in bytes.  Filled in by AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Size of the image the buffer must hold, in pixels.  For decoder
+     * buffers this includes the decoder's padding, so may be a little
+     * larger than the video.
+     */
+    int32_t width;
+    int32_t height;
+
+    /**
+     * Pixel format of the image, as in _AVbinFrame.
+     */
+    AVbinPixelFormat pixel_format;
+    int32_t backend_pixel_format;
+
+    /**
+     * Every plane and every linesize must be a multiple of this many bytes.
+     * Decoder buffers that are not are replaced with one of AVbin's own;
+     * for output buffers it is only a recommendation.
+     */
+    int32_t alignment;
+
+    /**
+     * Size, in bytes, of a single block holding every plane in the suggested
+     * layout, including padding the decoder may read past the end.
+     */
+    size_t size;
+
+    /**
+     * Pointers to the start of each plane, and the number of bytes between
+     * the start of each row of that plane.
+     */
+    uint8_t *data[AVBIN_FRAME_PLANES];
+    int32_t linesize[AVBIN_FRAME_PLANES];
+
+    /**
+     * For the application's own use, for example to identify the buffer when
+     * it is released.
+     */
+    void *opaque;
+} AVbinBuffer;
+
+/**
+ * Supply a buffer.  Fill in buffer->data (and optionally linesize and
+ * opaque) and return AVBIN_RESULT_OK, or return AVBIN_RESULT_ERROR to have
+ * AVbin use its own memory.
+ */
+typedef AVbinResult (*AVbinGetBufferCallback)(void *user_data,
+                                              AVbinBuffer *buffer);
+
+/**
+ * Called when the decoder no longer needs a buffer from get_buffer, with
+ * the same contents get_buffer left in it.
+ */
+typedef void (*AVbinReleaseBufferCallback)(void *user_data,
+                                           AVbinBuffer *buffer);
+
+/**
+ * Application memory for a video stream's pictures.  See
+ * avbin_set_buffer_provider()
+ */
+typedef struct _AVbinBufferProvider {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Passed unchanged to every callback.
+     */
+    void *user_data;
+
+    /**
+     * Supplies the buffers the decoder decodes into, or NULL to let it
+     * allocate its own.  The decoder keeps each buffer, possibly across many
+     * decode calls as a reference picture, until it calls release_buffer.
+     */
+    AVbinGetBufferCallback get_buffer;
+    AVbinReleaseBufferCallback release_buffer;
+
+    /**
+     * Supplies the destination of each image avbin_decode_video() converts,
+     * in place of its data_out argument, or NULL to use data_out.  The
+     * buffer is the application's again as soon as the decode call returns.
+     */
+    AVbinGetBufferCallback get_output_buffer;
+} AVbinBufferProvider;
+
+
+/**
+ * Information about the AVbin library.  See avbin_get_info()
+ */
+typedef struct _AVbinInfo {
+    /**
+     * Size of this structure, in bytes.  This will be filled in for you by
+     * avbin_get_info() so that you can determine which version of this struct
+     * you have received.  For example:
+     *   AVbinInfo * info = avbin_get_info()
+     *   if (info->structure_size == sizeof(AVbinInfo)
+     *       // You are safe to access the members of an AVbinInfo typedef...
+     */
+    size_t structure_size;
+
+    /**
+     * AVbin version as an integer.  This value is the same as returned by
+     * the avbin_get_version() function.  Consider using version_string instead.
+     */
+    int32_t version;
+
+    /**
+     * AVbin version string, including pre-release information, i.e. "10-beta1".
+     */
+    char *version_string;
+
+    /**
+     * When the library was built, in strftime format "%Y-%m-%d %H:%M:%S %z"
+     */
+    char *build_date;
+
+    /**
+     * URL to the AVbin repository used.
+     */
+    char *repo;
+
+    /**
+     * The commit of the AVbin repository used.
+     */
+    char *commit;
+
+    /**
+     * Which backend we are using: "libav" or "ffmpeg"
+     */
+    char *backend;
+
+    /**
+     * The version string of the most recent tag of the backend.  Note: There
+     * may be custom patches *on top* of the backend version.
+     */
+    char *backend_version_string;
+
+    /**
+     * URL to the backend repository used for this release.
+     */
+    char *backend_repo;
+
+    /**
+     * The commit hash of the backend repo used for the backend.
+     */
+    char *backend_commit;
+} AVbinInfo;
+
+
+/**
+ * Initialization Options
+ */
+typedef struct _AVbinOptions {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Number of threads to attempt to use.  Using the recommended thread_count of
+     * 0 means try to detect the number of CPU cores and set threads to
+     * (num cores + 1).  A thread_count of 1 or a negative number means single
+     * threaded.  Any other number will result in an attempt to set that many threads.
+     */
+    int32_t thread_count;
+} AVbinOptions;
+
+
+/**
+ * How a decoder may split work between threads.  See _AVbinStreamOptions.
+ */
+typedef enum _AVbinThreadType {
+    /** Let the decoder choose.  This is the default. */
+    AVBIN_THREAD_TYPE_DEFAULT = 0,
+    /** Decode several frames at once.  Best throughput, but adds one frame
+     *  of latency per thread. */
+    AVBIN_THREAD_TYPE_FRAME = 1,
+    /** Decode parts of a single frame at once.  No added latency, but not
+     *  all codecs or files support it. */
+    AVBIN_THREAD_TYPE_SLICE = 2
+} AVbinThreadType;
+
+/**
+ * Options for a single stream.  See avbin_open_stream_with_options()
+ */
+typedef struct _AVbinStreamOptions {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Number of decoder threads for this stream, with the same meaning as
+     * _AVbinOptions::thread_count.  A negative number means use the
+     * thread_count given to avbin_init_options().
+     */
+    int32_t thread_count;
+
+    /**
+     * How the decoder may use its threads.
+     */
+    AVbinThreadType thread_type;
+
+    /**
+     * Output configuration applied as if by avbin_set_audio_output() when
+     * an audio stream is opened, or NULL for the defaults.  Ignored for
+     * other stream types.  Requires resample feature.
+     */
+    AVbinAudioOutput *audio_output;
+
+    /**
+     * Buffer provider set as if by avbin_set_buffer_provider() when a video
+     * stream is opened, or NULL for none.  Setting it here avoids reopening
+     * the decoder.  Ignored for other stream types.  Requires
+     * buffer_provider feature.
+     */
+    AVbinBufferProvider *buffer_provider;
+
+    /**
+     * Reduction in size set as if by avbin_set_lowres() when a video stream
+     * is opened.  Setting it here avoids reopening the decoder.  Ignored
+     * for other stream types.  Requires lowres feature.
+     */
+    int32_t lowres;
+} AVbinStreamOptions;
+
+
+/**
+ * Queue limits for the background pipeline.  See avbin_start_pipeline()
+ *
+ * Each limit applies to each stream separately.  Zero means use the default.
+ */
+typedef struct _AVbinPipelineOptions {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Maximum number of packets read ahead but not yet decoded.  The default
+     * is 64.
+     */
+    int32_t max_packets;
+
+    /**
+     * Maximum number of bytes of packet data read ahead but not yet decoded.
+     * The default is 8 MiB.
+     */
+    int64_t max_bytes;
+
+    /**
+     * Number of decoded frames that can be waiting to be popped, including
+     * the one most recently returned by avbin_pipeline_pop().  The default is
+     * 4.  Each holds one converted video image, or the audio decoded from one
+     * frame of compressed audio.
+     */
+    int32_t max_frames;
+} AVbinPipelineOptions;
+
+/**
+ * A decoded frame taken from the pipeline.  See avbin_pipeline_pop()
+ */
+typedef struct _AVbinQueuedFrame {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Presentation time of the frame, or AV_NOPTS_VALUE (INT64_MIN) if it is
+     * not known.
+     */
+    AVbinTimestamp timestamp;
+
+    /**
+     * For video, an image in the stream's output format (see
+     * avbin_set_video_output()).  For audio, interleaved samples in the
+     * stream's output format (see avbin_set_audio_output()).  Owned by AVbin.
+     */
+    uint8_t *data;
+    size_t size;
+
+    /**
+     * Duration of the frame in microseconds, or 0 if it is not known.
+     *
+     * @version Version 11.  Requires frame_time feature.
+     */
+    AVbinTimestamp duration;
+} AVbinQueuedFrame;
+
+/**
+ * One decoded frame within an AVbinBatch.
+ */
+typedef struct _AVbinBatchFrame {
+    /**
+     * Presentation time of the frame, or AV_NOPTS_VALUE (INT64_MIN) if it is
+     * not known.
+     */
+    AVbinTimestamp timestamp;
+
+    /**
+     * Position and size of the frame's data within the batch buffer.  The
+     * data is in the same format avbin_decode_video() or
+     * avbin_decode_audio() would produce.
+     */
+    size_t offset;
+    size_t size;
+
+    /**
+     * Number of samples per channel, for audio; 0 for video.
+     */
+    int32_t nb_samples;
+
+    /**
+     * Duration of the frame in microseconds, or 0 if it is not known.
+     *
+     * @version Version 11.  Requires frame_time feature.
+     */
+    AVbinTimestamp duration;
+} AVbinBatchFrame;
+
+/**
+ * Limits and results of a call to avbin_decode_batch().  The application
+ * fills in the limits and provides the storage; AVbin fills in the results.
+ */
+typedef struct _AVbinBatch {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Buffer receiving the frames' data, one after another.
+     */
+    uint8_t *buffer;
+    size_t buffer_size;
+
+    /**
+     * Array of max_frames entries receiving the details of each frame.
+     */
+    AVbinBatchFrame *frames;
+    int32_t max_frames;
+
+    /**
+     * Stop before exceeding this many audio samples per channel, or 0 for
+     * no limit.  At least one frame is always returned.
+     */
+    int32_t max_samples;
+
+    /**
+     * Stop before the first frame whose timestamp is at or after this time,
+     * or 0 for no limit.
+     */
+    AVbinTimestamp horizon;
+
+    /**
+     * Set by AVbin: the number of frames returned, their total number of
+     * samples per channel, and the number of bytes of buffer used.
+     */
+    int32_t n_frames;
+    int32_t n_samples;
+    size_t buffer_used;
+} AVbinBatch;
+
+/**
+ * A circular buffer of interleaved audio owned by the application, which
+ * avbin_decode_audio_ring() writes into.
+ *
+ * Positions are kept as running totals of samples per channel, so that a
+ * full buffer can be told from an empty one: the samples waiting to be
+ * consumed are those from read_count up to write_count, and sample n is
+ * stored at position n % capacity.
+ */
+typedef struct _AVbinAudioRing {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Room for capacity samples per channel in the stream's output format.
+     */
+    uint8_t *buffer;
+    int32_t capacity;
+
+    /**
+     * Total samples per channel written.  Only AVbin changes this; start it
+     * at 0, or at read_count.
+     */
+    volatile int64_t write_count;
+
+    /**
+     * Total samples per channel consumed.  Only the application changes
+     * this, and may do so from another thread while AVbin writes.
+     */
+    volatile int64_t read_count;
+} AVbinAudioRing;
+
+/**
+ * How much work a video decoder may skip to go faster.  Each level adds a
+ * shortcut to those of the level before, trading picture quality for speed.
+ * Decoders that do not support a shortcut ignore it.  See
+ * avbin_set_decode_quality()
+ */
+typedef enum _AVbinDecodeQuality {
+    /** Decode everything.  This is the default. */
+    AVBIN_QUALITY_FULL = 0,
+    /** Skip the loop (deblocking) filter for pictures that no other picture
+     *  is predicted from.  Errors cannot spread from these. */
+    AVBIN_QUALITY_FAST_LOOP_FILTER = 1,
+    /** Skip the loop filter for every picture.  Blocking may show and build
+     *  up until the next keyframe. */
+    AVBIN_QUALITY_NO_LOOP_FILTER = 2,
+    /** Also skip the inverse transform (IDCT) for pictures that no other
+     *  picture is predicted from.  Their residual is dropped, so they show
+     *  only their prediction and lose detail, but errors do not spread. */
+    AVBIN_QUALITY_SKIP_IDCT = 3,
+    /** Also skip non-reference pictures altogether, lowering the frame
+     *  rate. */
+    AVBIN_QUALITY_SKIP_NONREF = 4
+} AVbinDecodeQuality;
+
+/**
+ * What became of a picture in avbin_decode_video_deadline().
+ */
+typedef enum _AVbinFrameStatus {
+    /** The packet produced no picture. */
+    AVBIN_FRAME_NONE = 0,
+    /** A picture was written to the output. */
+    AVBIN_FRAME_READY = 1,
+    /** A picture was decoded, but it was already too late to show, so it was
+     *  dropped without being converted. */
+    AVBIN_FRAME_LATE = 2
+} AVbinFrameStatus;
+
+/**
+ * Playback clock and results for avbin_decode_video_deadline().
+ */
+typedef struct _AVbinDeadline {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * The current playback time, on the same scale as the stream's
+     * timestamps.
+     */
+    AVbinTimestamp clock;
+
+    /**
+     * How far behind clock a picture may be and still be shown, in
+     * microseconds.
+     */
+    AVbinTimestamp tolerance;
+
+    /**
+     * Non-zero to have AVbin lower the stream's quality level while pictures
+     * come out late, and raise it again, no higher than the level set with
+     * avbin_set_decode_quality(), once they are consistently early.
+     */
+    int32_t adaptive;
+
+    /**
+     * Set by AVbin: what became of the picture, its presentation time (or
+     * AV_NOPTS_VALUE (INT64_MIN) if there was none or it is not known), and
+     * the quality level now in effect.
+     */
+    AVbinFrameStatus status;
+    AVbinTimestamp timestamp;
+    AVbinDecodeQuality quality;
+
+    /**
+     * Set by AVbin: how long the picture is shown for, in microseconds, or
+     * 0 if there was none or it is not known.
+     *
+     * @version Version 11.  Requires frame_time feature.
+     */
+    AVbinTimestamp duration;
+} AVbinDeadline;
+
+
+/**
+ * Callback for log information.
+ *
+ * @param module  The name of the module where this message originated
+ * @param level   The log verbosity level of this message
+ * @param message The formatted message.  The message may or may not contain
+ *                newline characters.
+ */
+typedef void (*AVbinLogCallback)(const char *module,
+                                 AVbinLogLevel level,
+                                 const char *message);
+
+/**
+ * When the log callback is called.  See _AVbinLogOptions.
+ */
+typedef enum _AVbinLogDelivery {
+    /** From the thread that logged the message, as it is logged.  This is
+     *  the default. */
+    AVBIN_LOG_DELIVERY_IMMEDIATE = 0,
+    /** From a background thread started by AVbin. */
+    AVBIN_LOG_DELIVERY_THREAD = 1,
+    /** Only from avbin_drain_logs(). */
+    AVBIN_LOG_DELIVERY_MANUAL = 2
+} AVbinLogDelivery;
+
+/**
+ * How log messages are delivered.  See avbin_set_log_options()
+ */
+typedef struct _AVbinLogOptions {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Which thread calls the log callback, and when.
+     */
+    AVbinLogDelivery delivery;
+
+    /**
+     * Most messages delivered in any one second; the rest are dropped and
+     * counted.  0 means the default of 100, and a negative number means no
+     * limit.
+     */
+    int32_t rate_limit;
+} AVbinLogOptions;
+
+/**
+ * Number of buckets in _AVbinStageStats::histogram.
+ */
+#define AVBIN_STATS_BUCKETS 20
+
+/**
+ * Time spent in one stage of work.  See _AVbinStats.
+ *
+ * All times are wall-clock time from a monotonic clock, in microseconds.
+ */
+typedef struct _AVbinStageStats {
+    /**
+     * Number of times the stage was run.
+     */
+    int64_t calls;
+
+    /**
+     * Total and longest time taken by a single run.
+     */
+    int64_t total_time;
+    int64_t max_time;
+
+    /**
+     * Number of runs by time taken.  histogram[0] counts runs that took
+     * under a microsecond, and histogram[i] those that took from 2^(i-1) up
+     * to 2^i microseconds.  The last bucket (from about a quarter of a
+     * second) also counts anything longer.
+     */
+    int64_t histogram[AVBIN_STATS_BUCKETS];
+} AVbinStageStats;
+
+/**
+ * Performance counters of a file or stream.  See avbin_get_file_stats()
+ * and avbin_get_stream_stats().
+ *
+ * Counters start at zero when the file or stream is opened and only ever
+ * increase.
+ */
+typedef struct _AVbinStats {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Packets demuxed, and the bytes in them.
+     */
+    int64_t packets;
+    int64_t bytes;
+
+    /**
+     * Calls made to the decoder.
+     */
+    int64_t decode_calls;
+
+    /**
+     * Frames the decoder produced, and how many of those were dropped (for
+     * example before the target of an accurate seek) rather than returned.
+     */
+    int64_t frames;
+    int64_t frames_dropped;
+
+    /**
+     * Time spent reading packets from the file.  Only counted for files.
+     */
+    AVbinStageStats demux;
+
+    /**
+     * Time spent in the decoder.
+     */
+    AVbinStageStats decode;
+
+    /**
+     * Time spent converting, scaling or resampling decoded frames into the
+     * output format.
+     */
+    AVbinStageStats convert;
+} AVbinStats;
+
+/**
+ * Handle to a gapless audio playlist.  See avbin_open_playlist()
+ */
+typedef struct _AVbinPlaylist AVbinPlaylist;
+
+/**
+ * Options for a playlist.  See avbin_open_playlist()
+ */
+typedef struct _AVbinPlaylistOptions {
+    /**
+     * Size of this structure, in bytes.  This must be filled in by the
+     * application before passing to AVbin.
+     */
+    size_t structure_size;
+
+    /**
+     * Format of the audio returned by avbin_playlist_read(); every file is
+     * converted to it.  NULL means 16-bit stereo at 44100 Hz, as does a
+     * sample_rate or channels of 0.
+     */
+    AVbinAudioOutput *audio_output;
+
+    /**
+     * Samples per channel decoded ahead of the application, or 0 for one
+     * second's worth.  The next file is opened and starts decoding while
+     * this much of the previous one is still waiting to be read, so it
+     * should cover the slowest open expected.
+     */
+    int32_t buffer_samples;
+
+    /**
+     * Non-zero to keep the encoder delay and padding at the start and end of
+     * each file instead of trimming it.
+     */
+    int32_t keep_padding;
+} AVbinPlaylistOptions;
+
+/**
+ * @name Information about AVbin
+ */
+
+/**
+ * Get the linked version of AVbin.
+ *
+ * Version numbers are always integer, there are no "minor" or "patch"
+ * revisions.  All AVbin versions are backward and forward compatible, modulo
+ * the required feature set.
+ */
+int32_t avbin_get_version();
+
+
+/**
+ * Get information about the linked version of AVbin.
+ *
+ * See the AVbinInfo definition.
+ */
+AVbinInfo *avbin_get_info();
+
+
+/**
+ * Get the SVN revision of FFmpeg.
+ *
+ * This is built into AVbin as it is built.
+ *
+ * DEPRECATED: Use avbin_get_libav_commit or avbin_get_libav_version instead.
+ *             This always returns 0 now that we use Libav from Git.  This
+ *             function will be removed in AVbin 12.
+ */
+#ifndef _MSC_VER
+int32_t avbin_get_ffmpeg_revision() __attribute__((deprecated));
+#else
+int32_t avbin_get_ffmpeg_revision();
+#pragma deprecated(avbin_get_ffmpeg_revision)
+#endif
+
+/**
+ * DEPRECATED.  Get the minimum audio buffer size, in bytes.
+ * Why is this even here?  It just returns the number 192000.  It has been
+ * removed upstream, so we'll remove it as well some time soon.
+ */
+#ifndef _MSC_VER
+size_t avbin_get_audio_buffer_size() __attribute__((deprecated));;
+#else
+size_t avbin_get_audio_buffer_size();
+#pragma deprecated(avbin_get_audio_buffer_size)
+#endif
+
+/**
+ * Determine if AVbin includes a requested feature.
+ *
+ * When future versions of AVbin include more functionality, that
+ * functionality can be tested for by calling this function.  The following
+ * features can be tested for:
+ *  - "frame_rate" // AVbinStreamInfo8, frame_rate variables.
+ *  - "options"    // avbin_init_options(), AVbinOptions (multi-threading)
+ *  - "info"       // avbin_get_info(), AVbinInfo
+ *  - "packet_decode" // avbin_decode_audio_packet(), avbin_decode_video_packet()
+ *  - "video_output" // avbin_set_video_output(), AVbinVideoOutput
+ *  - "frame"      // avbin_decode_video_frame(), AVbinFrame
+ *  - "planar_audio" // avbin_decode_audio_frame(), avbin_set_audio_output()
+ *  - "io"         // avbin_open_io(), avbin_open_memory(), AVbinIOCallbacks
+ *  - "stream_options" // avbin_open_stream_with_options(), avbin_set_thread_limit()
+ *  - "pipeline"   // avbin_start_pipeline(), avbin_pipeline_pop()
+ *  - "packet_ref" // avbin_read_ref(), avbin_retain_packet(), avbin_release_packet()
+ *  - "batch"      // avbin_decode_batch()
+ *  - "open_options" // avbin_open_filename_with_options(), avbin_open_io_with_options()
+ *  - "accurate_seek" // avbin_seek_file_accurate()
+ *  - "index"      // avbin_build_index(), avbin_save_index(), avbin_load_index()
+ *  - "thumbnail"  // avbin_set_thumbnail_mode(), avbin_extract_thumbnails()
+ *  - "select_stream" // avbin_select_stream(); unopened streams are discarded
+ *  - "resample"   // AVbinAudioOutput sample_rate and channels, _AVbinStreamOptions::audio_output
+ *  - "buffer_provider" // avbin_set_buffer_provider(), _AVbinStreamOptions::buffer_provider
+ *  - "log_queue"  // avbin_set_log_options(), avbin_drain_logs()
+ *  - "stats"      // avbin_get_file_stats(), avbin_get_stream_stats()
+ *  - "thread_safe" // Files may be used concurrently; see the main page
+ *  - "playlist"   // avbin_open_playlist() and the other playlist functions
+ *  - "audio_samples" // avbin_decode_audio_samples(), avbin_decode_audio_ring()
+ *  - "lowres"     // avbin_set_lowres(), _AVbinStreamOptions::lowres
+ *  - "decode_quality" // avbin_set_decode_quality(), avbin_decode_video_deadline()
+ *  - "frame_time" // avbin_get_frame_time(), avbin_drain_video(),
+ *                    avbin_drain_audio() and frame durations
+ *
+ *
+ * NOTE: The "frame_rate" feature was available in versions 9 and 10, but
+ * removed in version 11.  Populating r_frame_rate was considered an unreliable
+ * hack upstream and removed.  If you try to access it in the upstream library,
+ * it is always {0, 0}.  Perhaps we can find a different source of frame rate
+ * and re-enable this feature in the future.
+ *
+ * @retval 1 The feature is present
+ * @retval 0 The feature is not present
+ */
+int32_t avbin_have_feature(const char *feature);
+/*@}*/
+
+/**
+ * @name Global AVbin functions
+ */
+
+/**
+ * One of the avbin_init* functions must be called before opening a file to
+ * initialize AVbin.  Check the return value for success before continuing.
+ */
+
+/**
+ * Initialize AVbin with basic features.  Consider instead avbin_init_options()
+ */
+AVbinResult avbin_init();
+
+/**
+ * Initialize AVbin with options.
+ *
+ * Only the first successful call initializes the backend; it is safe to call
+ * this more than once, from any thread, and later calls only update the
+ * thread_count used for streams opened afterwards.  Since version 11 the
+ * backend is set up with a lock manager, so files may be opened and decoded
+ * concurrently (see the main page).
+ *
+ * @param options  If NULL, use defaults.  Otherwise create and populate an
+ *                 instance of AVbinOptions to supply.
+ */
+AVbinResult avbin_init_options(AVbinOptions * options);
+
+/**
+ * Limit the total number of decoder threads used by all open streams in the
+ * process.
+ *
+ * Each stream is given as many of the threads it asks for as are still
+ * available when it is opened, and at least one.  Threads are returned
+ * when the stream is closed.  This lets many open files share the cores
+ * without oversubscribing them.
+ *
+ * @version Version 11.  Requires stream_options feature.
+ *
+ * @param limit  Maximum number of threads, or 0 for no limit (the default).
+ */
+AVbinResult avbin_set_thread_limit(int32_t limit);
+
+/**
+ * Set the log level verbosity.
+ */
+AVbinResult avbin_set_log_level(AVbinLogLevel level);
+
+/**
+ * Set a custom log callback.  By default, log messages are printed to
+ * standard error.  Providing a NULL callback restores this default handler.
+ */
+AVbinResult avbin_set_log_callback(AVbinLogCallback callback);
+
+/**
+ * Choose how messages reach the log callback.
+ *
+ * Messages are always formatted in per-thread buffers, so decoder threads
+ * can log at once without corrupting each other's messages.  A message
+ * repeated by the same thread is delivered once, followed by a count of
+ * the repeats once a different message is logged, the thread exits, or the
+ * logs are drained or reconfigured.  Messages beyond the rate limit are
+ * dropped; a count of dropped messages is delivered later.
+ *
+ * With AVBIN_LOG_DELIVERY_THREAD or AVBIN_LOG_DELIVERY_MANUAL, logging
+ * threads only copy messages into a fixed-size lock-free queue and never
+ * wait for the callback, so a slow callback (for example one that must
+ * take an interpreter lock) cannot stall decoding.  If the queue fills,
+ * further messages are dropped until it is drained.  Switching back to
+ * immediate delivery stops the delivery thread and delivers whatever is
+ * queued first.  Do not call this from the log callback.
+ *
+ * @version Version 11.  Requires log_queue feature.
+ *
+ * @retval AVBIN_RESULT_ERROR if the options are invalid or the delivery
+ *         thread could not be started.
+ */
+AVbinResult avbin_set_log_options(AVbinLogOptions *options);
+
+/**
+ * Deliver every queued log message to the log callback, from the calling
+ * thread, along with pending counts of repeated messages.  Call this
+ * regularly with AVBIN_LOG_DELIVERY_MANUAL, for example once per frame from
+ * the application's main loop.
+ *
+ * @version Version 11.  Requires log_queue feature.
+ *
+ * @return the number of messages delivered.
+ */
+int32_t avbin_drain_logs(void);
+/*@}*/
+
+/**
+ * @name File handling functions
+ */
+
+/**
+ * Open a media file given its filename.
+ *
+ * @retval NULL if the file could not be opened, or is not of a recognised
+ *              file format.
+ */
+AVbinFile *avbin_open_filename(const char *filename);
+AVbinFile *avbin_open_filename_with_format(const char *filename, char* format);
+
+/**
+ * Open media through application-supplied I/O callbacks.
+ *
+ * The callbacks are copied; io itself need not outlive this call, but
+ * io->opaque must remain valid until the file is closed.
+ *
+ * @version Version 11.  Requires io feature.
+ *
+ * @param io      Read, seek and size callbacks.  structure_size must be
+ *                filled in.
+ * @param format  Short name of the container format, or NULL to detect it.
+ *
+ * @retval NULL if the media could not be opened, or is not of a recognised
+ *              format.
+ */
+AVbinFile *avbin_open_io(AVbinIOCallbacks *io, char *format);
+
+/**
+ * Open media that is already in memory.
+ *
+ * The data is not copied up front.  Like any other source, it is copied
+ * into AVbin's I/O buffer a piece at a time as the demuxer reads it, so it
+ * must remain valid and unchanged until the file is closed.
+ *
+ * @version Version 11.  Requires io feature.
+ *
+ * @retval NULL if the media could not be opened, or is not of a recognised
+ *              format.
+ */
+AVbinFile *avbin_open_memory(const uint8_t *data, size_t size, char *format);
+
+/**
+ * Open a media file, controlling how much of it is examined up front.
+ *
+ * By default opening a file decodes the start of every stream to fill in
+ * complete stream information, which for some containers means several
+ * seconds of media.  Applications that only want the container metadata,
+ * such as library scanners, can limit or defer that work.
+ *
+ * Note that some containers (MPEG-TS, for instance) only reveal their
+ * streams when examined.  With AVBIN_STREAM_INFO_LAZY they are examined by
+ * the first avbin_file_info() or avbin_stream_info() call, so make that
+ * call before reading packets, since the examination starts wherever the
+ * file has been read to.
+ *
+ * @version Version 11.  Requires open_options feature.
+ *
+ * @param filename  The file to open.
+ * @param format    Short name of the container format, or NULL to detect
+ *                  it.
+ * @param options   Options, or NULL to behave like
+ *                  avbin_open_filename_with_format().
+ *
+ * @retval NULL if the file could not be opened, or is not of a recognised
+ *              file format.
+ */
+AVbinFile *avbin_open_filename_with_options(const char *filename,
+                                            char *format,
+                                            AVbinOpenOptions *options);
+
+/**
+ * Open media through application-supplied I/O callbacks, controlling how
+ * much of it is examined up front.  See avbin_open_io() and
+ * avbin_open_filename_with_options().
+ *
+ * @version Version 11.  Requires io and open_options features.
+ */
+AVbinFile *avbin_open_io_with_options(AVbinIOCallbacks *io, char *format,
+                                      AVbinOpenOptions *options);
+
+/**
+ * Close a media file.
+ */
+void avbin_close_file(AVbinFile *file);
+
+/**
+ * Seek to a timestamp within a file.
+ *
+ * For video files, the first keyframe before the requested timestamp will be
+ * seeked to.  For audio files, the first audio packet before the requested
+ * timestamp is used.
+ */
+AVbinResult avbin_seek_file(AVbinFile *file, AVbinTimestamp timestamp);
+
+/**
+ * Seek to exactly a timestamp within a file.
+ *
+ * This seeks to the keyframe before timestamp as avbin_seek_file() does,
+ * then has every open stream drop what it decodes before timestamp: the
+ * first video frame decoded is the one showing at timestamp, and the first
+ * audio decoded starts with the sample at timestamp.  Frames that are only
+ * being skipped are decoded as cheaply as possible and are not converted.
+ * Where it is safe to do so, avbin_read() decodes and discards the packets
+ * before timestamp itself rather than returning them.
+ *
+ * Open the streams to be decoded before seeking; streams opened afterwards
+ * are not affected.  Frames without timestamps cannot be placed, so the
+ * first of those is returned as is.
+ *
+ * @version Version 11.  Requires accurate_seek feature.
+ */
+AVbinResult avbin_seek_file_accurate(AVbinFile *file,
+                                     AVbinTimestamp timestamp);
+
+/**
+ * Index the keyframes of the whole file.
+ *
+ * Once this or avbin_load_index() has been called, AVbin records the
+ * keyframes of the file's first video stream (or first audio stream, if
+ * there is no video) as packets are read, and seeks within the part of the
+ * file indexed so far by jumping straight to the byte offset of the right
+ * keyframe.  This is much faster than the demuxer's own search for
+ * containers without a good index, such as MPEG-TS or MPEG-PS.  Building
+ * the index reads the whole file up front, so that every seek benefits.
+ *
+ * Only use an index for such containers: demuxers that keep per-stream
+ * state, such as AVI, Matroska, Ogg and MP4, can resync badly or report
+ * wrong timestamps after a byte seek.  Without an index, seeks always go
+ * through the demuxer's own timestamp search.
+ *
+ * The file is left positioned at its start.  The index is built only once
+ * per file; keep it for later with avbin_save_index().
+ *
+ * @version Version 11.  Requires index feature.
+ *
+ * @retval AVBIN_RESULT_ERROR if the file has no audio or video, while a
+ *         pipeline is running, or if a read error stopped the scan before
+ *         the end of the file.  The keyframes found before the error are
+ *         still used.
+ */
+AVbinResult avbin_build_index(AVbinFile *file);
+
+/**
+ * Write the file's keyframe index to a sidecar file.
+ *
+ * The sidecar records the size and modification time of the media (just
+ * the size, for custom I/O), so that avbin_load_index() can tell when it
+ * no longer applies.  A partial index, from reading part of the file, may
+ * be saved too.
+ *
+ * @version Version 11.  Requires index feature.
+ *
+ * @param file  The file whose index to save.
+ * @param path  Filename of the sidecar to write.
+ */
+AVbinResult avbin_save_index(AVbinFile *file, const char *path);
+
+/**
+ * Replace the file's keyframe index with one saved by avbin_save_index(),
+ * and keep indexing as the file is read, as avbin_build_index() does.
+ *
+ * @version Version 11.  Requires index feature.
+ *
+ * @retval AVBIN_RESULT_ERROR if the sidecar cannot be read, or was saved
+ *         for different media.
+ */
+AVbinResult avbin_load_index(AVbinFile *file, const char *path);
+
+/**
+ * Get information about the opened file.
+ *
+ * The info struct must be allocated by the application and have its
+ * structure_size member filled in correctly.  On return, the structure
+ * will be filled with file details.
+ */
+AVbinResult avbin_file_info(AVbinFile *file,
                             AVbinFileInfo *info);
 /*@}*/
 
 /**
- * @name Stream functions
+ * @name Stream functions
+ */
+
+/**
+ * Get information about a stream within the file.
+ *
+ * The info struct must be allocated by the application and have its
+ * structure_size member filled in correctly.  On return, the structure
+ * will be filled with stream details.
+ *
+ * Ensure that stream_index is less than n_streams given in the file info.
+ *
+ * @param[in]  file          The file to examine
+ * @param[in]  stream_index  The number of the stream within the file
+ * @param[out] info          Returned stream information
+ */
+AVbinResult avbin_stream_info(AVbinFile *file, int32_t stream_index,
+                              AVbinStreamInfo *info);
+
+/**
+ * Open a stream for decoding.
+ *
+ * If you intend to decode audio or video from a file, you must open the
+ * stream first.  The returned opaque handle should be passed to the relevant
+ * decode function when a packet for that stream is read.
+ *
+ * @retval NULL if there are any problems, pointer to the AVbinStream otherwise.
+ */
+AVbinStream *avbin_open_stream(AVbinFile *file, int32_t stream_index);
+
+/**
+ * Open a stream for decoding, with per-stream options.
+ *
+ * This is the same as avbin_open_stream(), but lets the number and type of
+ * decoder threads be chosen for each stream; for example many threads for a
+ * large video stream and a single thread for each audio stream.
+ *
+ * @version Version 11.  Requires stream_options feature.
+ *
+ * @param options  Stream options, or NULL for the defaults.
+ *
+ * @retval NULL if there are any problems, pointer to the AVbinStream otherwise.
+ */
+AVbinStream *avbin_open_stream_with_options(AVbinFile *file,
+                                            int32_t stream_index,
+                                            AVbinStreamOptions *options);
+
+/**
+ * Choose whether the packets of a stream are read.
+ *
+ * By default, as soon as any stream of a file has been opened with
+ * avbin_open_stream(), the streams that are not open are discarded by the
+ * demuxer: their packets are not parsed, and avbin_read() never returns
+ * them.  Files with many audio or subtitle tracks read much faster as a
+ * result.  Until a stream is opened, every packet is returned.
+ *
+ * Use this to keep reading the raw packets of a stream that is not open,
+ * or to stop reading an open stream.
+ *
+ * @version Version 11.  Requires select_stream feature.
+ *
+ * @retval AVBIN_RESULT_ERROR if the stream index or selection is invalid, or
+ *         while a pipeline is running.
+ */
+AVbinResult avbin_select_stream(AVbinFile *file, int32_t stream_index,
+                                AVbinStreamSelection selection);
+
+/**
+ * Close a file stream.
+ */
+void avbin_close_stream(AVbinStream *stream);
+
+/**
+ * Choose the format and size of the images avbin_decode_video() writes for
+ * a video stream.  By default images are RGB24 at the size of the video.
+ *
+ * Each stream keeps its own conversion state, so different streams can use
+ * different settings and can be decoded from different threads.
+ *
+ * @version Version 11.  Requires video_output feature.
+ *
+ * @retval AVBIN_RESULT_ERROR if the stream is not a video stream or the
+ *         output configuration is invalid.  The stream's configuration is
+ *         then left unchanged.
+ */
+AVbinResult avbin_set_video_output(AVbinStream *stream,
+                                   AVbinVideoOutput *output);
+
+/**
+ * Choose the sample format, rate and channel layout avbin_decode_audio()
+ * writes for an audio stream.
+ *
+ * Audio is always written interleaved.  By default it is written in the
+ * decoder's own sample type (double precision is narrowed to float), rate
+ * and channel count.  Interleaving and conversion from the common planar
+ * formats use SIMD code where available.
+ *
+ * When the rate or channel layout differs from the decoder's, audio is
+ * resampled and remixed with libavresample.  The output then no longer
+ * corresponds one-to-one with decoded frames: a call may write fewer
+ * samples than were decoded (possibly none) while the resampler fills, and
+ * avbin_decode_audio() needs room for slightly more than one frame's worth.
+ * Output timestamps allow for the samples the resampler holds back, so
+ * they are those of the first sample actually written.  Seeking discards
+ * any samples held by the resampler.  Changes in the
+ * decoder's own format mid-stream are handled transparently.
+ *
+ * Once set, avbin_stream_info() reports the output format, rate and
+ * channels for the open stream.
+ *
+ * @version Version 11.  Requires planar_audio feature.
+ *
+ * @retval AVBIN_RESULT_ERROR if the stream is not an audio stream or the
+ *         output configuration is invalid.
  */
+AVbinResult avbin_set_audio_output(AVbinStream *stream,
+                                   AVbinAudioOutput *output);
 
 /**
- * Get information about a stream within the file.
+ * Have a video stream decode and convert pictures into application memory,
+ * such as mapped GPU upload buffers, instead of AVbin's own.
  *
- * The info struct must be allocated by the application and have its
- * structure_size member filled in correctly.  On return, the structure
- * will be filled with stream details.
+ * With get_buffer, decoders that support it decode straight into the
+ * application's buffers, so avbin_decode_video_frame() returns pictures
+ * that are already in place, with no copy at all; other decoders ignore
+ * it.  With get_output_buffer, avbin_decode_video() and
+ * avbin_decode_video_packet() convert into the application's buffer with
+ * the application's row stride.  avbin_decode_batch(), the pipeline and
+ * thumbnail extraction keep using their own buffers.
  *
- * Ensure that stream_index is less than n_streams given in the file info.
+ * The callbacks are called from whichever thread is decoding the stream.
+ * Buffers already handed out are still released through the provider
+ * they came from after the provider is changed or removed.  Set a decoder
+ * buffer provider before the stream is decoded (or in
+ * _AVbinStreamOptions::buffer_provider), since it may reopen the decoder.
  *
- * @param[in]  file          The file to examine
- * @param[in]  stream_index  The number of the stream within the file
- * @param[out] info          Returned stream information
+ * @version Version 11.  Requires buffer_provider feature.
+ *
+ * @param stream    The video stream.
+ * @param provider  The callbacks, or NULL to go back to AVbin's own memory.
+ *
+ * @retval AVBIN_RESULT_ERROR if the stream is not a video stream, is taking
+ *         part in a pipeline, provider is invalid, or the decoder could not
+ *         be reopened.  In that last case the decoder is reopened as it was
+ *         and the previous provider stays in effect; should even that fail,
+ *         the stream can no longer be decoded and should be closed.
  */
-AVbinResult avbin_stream_info(AVbinFile *file, int32_t stream_index,
-                              AVbinStreamInfo *info);
+AVbinResult avbin_set_buffer_provider(AVbinStream *stream,
+                                      AVbinBufferProvider *provider);
 
 /**
- * Open a stream for decoding.
+ * Get the number of bytes avbin_decode_video() will write for each image of
+ * a video stream, given its current output configuration.
  *
- * If you intend to decode audio or video from a file, you must open the
- * stream first.  The returned opaque handle should be passed to the relevant
- * decode function when a packet for that stream is read.
+ * @version Version 11.  Requires video_output feature.
  *
- * @retval NULL if there are any problems, pointer to the AVbinStream otherwise.
+ * @retval 0 if the stream is not a video stream.
  */
-AVbinStream *avbin_open_stream(AVbinFile *file, int32_t stream_index);
+size_t avbin_get_video_output_size(AVbinStream *stream);
 
 /**
- * Close a file stream.
+ * Put a video stream in thumbnail mode, or take it out again.
+ *
+ * In thumbnail mode only keyframes are decoded, optionally at reduced
+ * resolution, and pictures are scaled straight to the thumbnail size.
+ * avbin_read() does not return the stream's other packets at all.  The
+ * pixel format and scale quality are those set by avbin_set_video_output();
+ * an output size set while in thumbnail mode takes effect when it ends.
+ *
+ * Set thumbnail mode before the stream is decoded, since changing the
+ * lowres setting reopens the decoder.
+ *
+ * @version Version 11.  Requires thumbnail feature.
+ *
+ * @param stream   The video stream.
+ * @param options  Thumbnail settings, or NULL to return to decoding every
+ *                 frame, at the output size last set with
+ *                 avbin_set_video_output().
+ *
+ * @retval AVBIN_RESULT_ERROR if the stream is not a video stream, is taking
+ *         part in a pipeline, the options are invalid, or the decoder could
+ *         not be reopened.  In that last case the decoder keeps the
+ *         reduction it had; should even that fail, the stream can no longer
+ *         be decoded and should be closed.
  */
-void avbin_close_stream(AVbinStream *stream);
+AVbinResult avbin_set_thumbnail_mode(AVbinStream *stream,
+                                     AVbinThumbnailOptions *options);
+
+/**
+ * Extract thumbnails from evenly spaced points across the file.
+ *
+ * The file's duration is divided into count equal parts, and the keyframe
+ * before the middle of each part is decoded and converted, all in one call.
+ * Usually the stream is in thumbnail mode first.  The file is left at an
+ * arbitrary position; seek before reading from it again.
+ *
+ * @version Version 11.  Requires thumbnail feature.
+ *
+ * @param[in]  stream      The video stream.
+ * @param[in]  count       Number of thumbnails to extract.
+ * @param[out] data_out    Buffer of count times avbin_get_video_output_size()
+ *                         bytes, receiving the thumbnails one after another.
+ * @param[out] timestamps  Array of count entries receiving the time of each
+ *                         thumbnail, or AV_NOPTS_VALUE (INT64_MIN) for points
+ *                         where none could be decoded.  May be NULL.
+ *
+ * @retval AVBIN_RESULT_ERROR if no thumbnail could be extracted, or the
+ *         file's duration is unknown.
+ */
+AVbinResult avbin_extract_thumbnails(AVbinStream *stream, int32_t count,
+                                     uint8_t *data_out,
+                                     AVbinTimestamp *timestamps);
+
+/**
+ * Decode a video stream at 1/2, 1/4 or 1/8 of its full size, for previews
+ * and the like.
+ *
+ * Decoders that support it are reopened to decode at the reduced size
+ * themselves, which cuts the cost of decoding roughly in proportion to the
+ * area.  For the others, and for any reduction beyond what the decoder can
+ * do, the picture is scaled down as part of the usual conversion.  Either
+ * way, the images written by avbin_decode_video() are reduced, unless
+ * avbin_set_video_output() sets an explicit size, and avbin_stream_info()
+ * and avbin_get_video_output_size() report the reduced size.
+ *
+ * Call this before decoding, or just after a seek, since reopening the
+ * decoder discards any pictures it is holding.
+ *
+ * @version Version 11.  Requires lowres feature.
+ *
+ * @param stream  The video stream.
+ * @param lowres  1, 2 or 3 to divide the width and height by 2, 4 or 8, or
+ *                0 for full size.
+ *
+ * @retval AVBIN_RESULT_ERROR if the stream is not a video stream, lowres is
+ *         out of range, the stream is taking part in a pipeline, or the
+ *         decoder could not be reopened.  In that last case the previous
+ *         setting stays in effect; should even that fail, the stream can no
+ *         longer be decoded and should be closed.
+ */
+AVbinResult avbin_set_lowres(AVbinStream *stream, int32_t lowres);
+
+/**
+ * Set how much work a video stream's decoder may skip to go faster.  Takes
+ * effect from the next picture decoded.
+ *
+ * @version Version 11.  Requires decode_quality feature.
+ *
+ * @param stream   The video stream.
+ * @param quality  The quality level.  With avbin_decode_video_deadline(),
+ *                 this is the best level adaptive decoding returns to.
+ *
+ * @retval AVBIN_RESULT_ERROR if the stream is not a video stream, quality
+ *         is out of range, or the stream is taking part in a pipeline.
+ */
+AVbinResult avbin_set_decode_quality(AVbinStream *stream,
+                                     AVbinDecodeQuality quality);
 /*@}*/
 
 /**
@@ -676,6 +2144,47 @@ void avbin_close_stream(AVbinStream *stream);
  */
 AVbinResult avbin_read(AVbinFile *file, AVbinPacket *packet);
 
+/**
+ * Read a packet from the file into a reference-counted handle.
+ *
+ * This is like avbin_read(), except that the packet data stays valid for as
+ * long as the returned handle is held, however many more packets are read.
+ * Packets can therefore be queued, or passed between threads, without being
+ * copied.  The handle starts with one reference; release it with
+ * avbin_release_packet() when done.  Handles are recycled from a pool, so
+ * reading does not allocate a new one for every packet.
+ *
+ * Handles may be retained and released from any thread, and may outlive the
+ * file they were read from.  The packet may be decoded with any of the
+ * *_packet or *_frame decode functions.
+ *
+ * @version Version 11.  Requires packet_ref feature.
+ *
+ * @param[in]  file    The file to read from.
+ * @param[out] packet  Filled in with the packet's details, as with
+ *                     avbin_read().
+ *
+ * @retval NULL at the end of the file or on error.
+ */
+AVbinPacketRef *avbin_read_ref(AVbinFile *file, AVbinPacket *packet);
+
+/**
+ * Add a reference to a packet handle.
+ *
+ * @version Version 11.  Requires packet_ref feature.
+ *
+ * @return ref, for convenience.
+ */
+AVbinPacketRef *avbin_retain_packet(AVbinPacketRef *ref);
+
+/**
+ * Drop a reference to a packet handle.  When the last reference is dropped
+ * the packet data is freed and the handle returned to its pool.
+ *
+ * @version Version 11.  Requires packet_ref feature.
+ */
+void avbin_release_packet(AVbinPacketRef *ref);
+
 /**
  * Decode some audio data.
  *
@@ -702,7 +2211,9 @@ int32_t avbin_decode_audio(AVbinStream *stream,
  * Decode a video frame image.
  *
  * The size of data_out must be large enough to hold the entire image.
- * This is width * height * 3 (images are always in 8-bit RGB format).
+ * By default this is width * height * 3 (8-bit RGB format); if the output
+ * has been changed with avbin_set_video_output(), use
+ * avbin_get_video_output_size().
  *
  * @param[in]  stream   The stream to decode.
  * @param[in]  data_in  Incoming data, as read from a packet
@@ -718,6 +2229,491 @@ int32_t avbin_decode_video(AVbinStream *stream,
                        uint8_t *data_in, size_t size_in,
                        uint8_t *data_out);
 
+/**
+ * Decode some audio data directly from a packet returned by avbin_read().
+ *
+ * This behaves exactly like avbin_decode_audio(), but decodes straight from
+ * the demuxer's buffer without copying it first.  As with
+ * avbin_decode_audio(), advance packet->data and reduce packet->size by the
+ * returned number of bytes and call again until nothing is left.
+ *
+ * @version Version 11.  Requires packet_decode feature.
+ *
+ * @param[in]  stream    The stream to decode.
+ * @param[in]  packet    Packet filled in by avbin_read()
+ * @param[out] data_out  Decoded audio data buffer, provided by application
+ * @param[out] size_out  Number of bytes of data_out used.
+ *
+ * @return the number of bytes of packet data actually used.
+ *
+ * @retval -1 if there was an error
+ */
+int32_t avbin_decode_audio_packet(AVbinStream *stream, AVbinPacket *packet,
+                                  uint8_t *data_out, int *size_out);
+
+/**
+ * Decode a video frame image directly from a packet returned by avbin_read().
+ *
+ * This behaves exactly like avbin_decode_video(), but decodes straight from
+ * the demuxer's buffer without copying it first.
+ *
+ * @version Version 11.  Requires packet_decode feature.
+ *
+ * @param[in]  stream   The stream to decode.
+ * @param[in]  packet   Packet filled in by avbin_read()
+ * @param[out] data_out Decoded image data.
+ *
+ * @return the number of bytes of packet data actually used.
+ *
+ * @retval -1 if there was an error
+ */
+int32_t avbin_decode_video_packet(AVbinStream *stream, AVbinPacket *packet,
+                                  uint8_t *data_out);
+
+/**
+ * Get the presentation time and duration of the image or audio most recently
+ * written by avbin_decode_video(), avbin_decode_audio(), their packet
+ * variants, avbin_drain_video() or avbin_drain_audio().
+ *
+ * These are AVbin's best guess.  The decoder's reordered timestamps are
+ * used where the file has them, and a frame without one is placed
+ * straight after the frame before it.  Video durations come from the
+ * stream's frame rate, and audio durations from the number of samples
+ * written.
+ *
+ * @version Version 11.  Requires frame_time feature.
+ *
+ * @param[in]  stream     The stream that was decoded.
+ * @param[out] timestamp  Presentation time in microseconds, or
+ *                        AV_NOPTS_VALUE (INT64_MIN) if it is not known.
+ * @param[out] duration   Duration in microseconds, or 0 if it is not known.
+ */
+AVbinResult avbin_get_frame_time(AVbinStream *stream,
+                                 AVbinTimestamp *timestamp,
+                                 AVbinTimestamp *duration);
+
+/**
+ * Get an image the decoder is still holding back, at the end of the stream.
+ *
+ * Video decoders that reorder frames output each image a few packets after
+ * the packet that began it.  Once avbin_read() reports the end of the file,
+ * call this until it returns 0 to collect the remaining images.  The
+ * stream is then reset as if seeked, so it can be decoded again after a
+ * seek.
+ *
+ * @version Version 11.  Requires frame_time feature.
+ *
+ * @param[in]  stream   The stream to drain.
+ * @param[out] data_out Decoded image data, as for avbin_decode_video().
+ *
+ * @return 1 if an image was written to data_out, 0 if there are no more.
+ *
+ * @retval -1 if there was an error, the stream is taking part in a
+ *         pipeline, or a frame from avbin_decode_video_frame() is still
+ *         held.
+ */
+int32_t avbin_drain_video(AVbinStream *stream, uint8_t *data_out);
+
+/**
+ * Get audio the decoder or resampler is still holding back, at the end of
+ * the stream.
+ *
+ * Call this until it returns 0 once avbin_read() reports the end of the
+ * file.  The stream is then reset as if seeked, so it can be decoded again
+ * after a seek.
+ *
+ * @version Version 11.  Requires frame_time feature.
+ *
+ * @param[in]  stream    The stream to drain.
+ * @param[out] data_out  Decoded audio data buffer, as for
+ *                       avbin_decode_audio().
+ * @param[in,out] size_out  Size of data_out on input; number of bytes of
+ *                          data_out used on output, which may be 0.
+ *
+ * @return 1 if audio may have been written to data_out, 0 if there is no
+ *         more.
+ *
+ * @retval -1 if there was an error, or the stream is taking part in a
+ *         pipeline.
+ */
+int32_t avbin_drain_audio(AVbinStream *stream, uint8_t *data_out,
+                          int *size_out);
+
+/**
+ * Decode a video frame without converting or copying it.
+ *
+ * Instead of writing an RGB image, this fills in frame with pointers to the
+ * decoder's own planes, along with their layout and timestamp.  This is the
+ * cheapest way to get at the image, for example to upload YUV planes to
+ * textures and convert them on the GPU.
+ *
+ * The frame data is valid until avbin_release_frame() is called or the file
+ * is seeked.  The decoder would overwrite it, so until then every decode
+ * call on this stream (including this one) fails, as do calls that reopen
+ * the decoder such as avbin_set_lowres().
+ *
+ * @version Version 11.  Requires frame feature.
+ *
+ * @param[in]  stream  The stream to decode.
+ * @param[in]  packet  Packet filled in by avbin_read()
+ * @param[out] frame   Decoded frame.  The structure_size member must be
+ *                     filled in by the application.
+ *
+ * @return the number of bytes of packet data actually used.
+ *
+ * @retval -1 if there was an error, or no frame was produced
+ */
+int32_t avbin_decode_video_frame(AVbinStream *stream, AVbinPacket *packet,
+                                 AVbinFrame *frame);
+
+/**
+ * Decode a video packet for playback against a clock, as
+ * avbin_decode_video_packet() does, but without spending time on pictures
+ * that are already late.
+ *
+ * Every packet is still decoded, since later pictures depend on it, but a
+ * picture that comes out more than deadline->tolerance behind
+ * deadline->clock is not converted, and is counted as dropped.  If
+ * deadline->adaptive is set, the stream's quality level (see
+ * avbin_set_decode_quality()) is lowered after a couple of late pictures in
+ * a row, and raised again after a couple of seconds of early ones, so that a
+ * slow machine keeps up without stuttering.
+ *
+ * @version Version 11.  Requires decode_quality feature.
+ *
+ * @param[in]     stream    The video stream.
+ * @param[in]     packet    Packet filled in by avbin_read()
+ * @param[out]    data_out  Buffer of avbin_get_video_output_size() bytes,
+ *                          as for avbin_decode_video_packet().
+ * @param[in,out] deadline  Clock, tolerance, and results.  The
+ *                          structure_size member must be filled in by the
+ *                          application.
+ *
+ * @return the number of bytes of packet data used; check deadline->status
+ *         for whether data_out was written.
+ *
+ * @retval -1 if there was an error
+ */
+int32_t avbin_decode_video_deadline(AVbinStream *stream, AVbinPacket *packet,
+                                    uint8_t *data_out,
+                                    AVbinDeadline *deadline);
+
+/**
+ * Decode some audio data without interleaving, converting or copying it.
+ *
+ * Fills in frame with pointers to the decoder's own sample buffers, which
+ * may be planar.  Call repeatedly as with avbin_decode_audio_packet().
+ *
+ * @version Version 11.  Requires planar_audio feature.
+ *
+ * @param[in]  stream  The stream to decode.
+ * @param[in]  packet  Packet filled in by avbin_read()
+ * @param[out] frame   Decoded audio.  The structure_size member must be
+ *                     filled in by the application.
+ *
+ * @return the number of bytes of packet data actually used.
+ *
+ * @retval -1 if there was an error
+ */
+int32_t avbin_decode_audio_frame(AVbinStream *stream, AVbinPacket *packet,
+                                 AVbinAudioFrame *frame);
+
+/*@}*/
+
+/**
+ * @name Batched decoding functions
+ */
+/*@{*/
+
+/**
+ * Read and decode frames of one stream until a limit is reached.
+ *
+ * This replaces a loop of avbin_read() and avbin_decode_audio() or
+ * avbin_decode_video() calls with a single call, which matters when each
+ * call into AVbin is expensive, as it is from many language bindings.
+ * Decoding stops when batch->max_frames frames have been returned, when
+ * the next frame would not fit in the buffer or would exceed
+ * batch->max_samples, or at batch->horizon.  A frame that does not fit is
+ * kept and returned first by the next call.
+ *
+ * Packets read past for other open streams are kept and returned, in order,
+ * by the next avbin_read(), avbin_read_ref() or batch of that stream.
+ * Packets for streams that are not open, or turned off with
+ * avbin_select_stream(), are discarded.  At most a couple of thousand
+ * packets (32 MB) are kept; past that the oldest are dropped with a
+ * warning, so close streams that are not being read.  Once a stream has
+ * been batch decoded, do not decode it with the other decode functions
+ * until after the next seek.
+ *
+ * @version Version 11.  Requires batch feature.
+ *
+ * @param[in]     stream  The stream to decode.
+ * @param[in,out] batch   Limits, storage, and results.
+ *
+ * @retval AVBIN_RESULT_OK     if zero or more frames were returned.
+ * @retval AVBIN_RESULT_ERROR  at the end of the stream, while a pipeline is
+ *                             running, or if a single frame is larger than
+ *                             the whole buffer.
+ */
+AVbinResult avbin_decode_batch(AVbinStream *stream, AVbinBatch *batch);
+
+/*@}*/
+
+/**
+ * @name Sample-exact audio functions
+ *
+ * These read and decode an audio stream's packets themselves, as
+ * avbin_decode_batch() does, and return exactly as many samples as asked
+ * for, however the stream's packets and frames are sized.  Samples decoded
+ * beyond that are kept and returned first by the next call.  Samples are in
+ * the stream's output format (see avbin_set_audio_output()).
+ *
+ * Packets read past for other open streams are kept for avbin_read() as
+ * with avbin_decode_batch(), and the same restrictions apply: once a stream
+ * has been decoded this way, only decode it this way or by batch until the
+ * next seek, which discards the samples kept back.
+ */
+/*@{*/
+
+/**
+ * Decode exactly nb_samples samples per channel of interleaved audio.
+ *
+ * @version Version 11.  Requires audio_samples feature.
+ *
+ * @param[in]  stream      The audio stream to decode.
+ * @param[out] data_out    Room for nb_samples samples per channel.
+ * @param[in]  nb_samples  Samples per channel to decode.
+ *
+ * @return the number of samples per channel written, which is nb_samples
+ *         except at the end of the stream, where the samples still held by
+ *         the resampler are included, or when an error interrupts decoding.
+ *
+ * @retval -1 at the end of the stream, while a pipeline is running, or on
+ *         error.
+ */
+int32_t avbin_decode_audio_samples(AVbinStream *stream, uint8_t *data_out,
+                                   int32_t nb_samples);
+
+/**
+ * Decode audio straight into an application's circular buffer, wrapping
+ * around its end as needed, and advance ring->write_count past it.
+ *
+ * @version Version 11.  Requires audio_samples feature.
+ *
+ * @param[in]     stream      The audio stream to decode.
+ * @param[in,out] ring        The buffer.  The structure_size member must be
+ *                            filled in by the application.
+ * @param[in]     nb_samples  Samples per channel to write, or 0 to fill the
+ *                            buffer.  Only as many as there is room for are
+ *                            written.
+ *
+ * @return the number of samples per channel written, which is 0 if the
+ *         buffer is full, and otherwise fewer than asked only at the end of
+ *         the stream, if the buffer was short of room, or when an error
+ *         interrupts decoding.
+ *
+ * @retval -1 at the end of the stream, while a pipeline is running, or on
+ *         error.
+ */
+int32_t avbin_decode_audio_ring(AVbinStream *stream, AVbinAudioRing *ring,
+                                int32_t nb_samples);
+
+/*@}*/
+
+/**
+ * @name Pipelined decoding functions
+ *
+ * Instead of calling avbin_read() and the decode functions on its own
+ * thread, an application can have AVbin read ahead and decode in the
+ * background.  A demuxer thread fills a packet queue for each open stream,
+ * and a decoder thread per stream fills a ring of decoded, converted frames
+ * which the application takes with avbin_pipeline_pop().  This hides disk
+ * latency and slow frames behind the application's own work.
+ *
+ * While the pipeline runs, avbin_read() fails, and the decode functions must
+ * not be called on the streams taking part.  The application must keep
+ * popping frames from every stream taking part: the single demuxer thread
+ * waits whenever any stream's packet queue is full, so a neglected stream
+ * stalls all the others.  Close a stream that is no longer wanted; it then
+ * leaves the pipeline and its packets are dropped.
+ */
+/*@{*/
+
+/**
+ * Start reading ahead and decoding in the background.
+ *
+ * Every stream that is open when this is called takes part; set each
+ * stream's output format first.  avbin_seek_file() may be used while the
+ * pipeline runs; it discards everything queued and starts again from the new
+ * position.
+ *
+ * @version Version 11.  Requires pipeline feature.
+ *
+ * @param options  Queue limits, or NULL for the defaults.
+ *
+ * @retval AVBIN_RESULT_ERROR if the pipeline is already running or could not
+ *         be started.
+ */
+AVbinResult avbin_start_pipeline(AVbinFile *file,
+                                 AVbinPipelineOptions *options);
+
+/**
+ * Stop the background pipeline and discard everything queued.
+ *
+ * The file's read position is wherever the pipeline had read ahead to, so
+ * seek before going back to avbin_read().  Closing a file stops its
+ * pipeline automatically.  Closing a stream taking part only takes that
+ * stream out; the other streams carry on.
+ *
+ * @version Version 11.  Requires pipeline feature.
+ */
+void avbin_stop_pipeline(AVbinFile *file);
+
+/**
+ * Take the next decoded frame of a stream from the pipeline, without
+ * blocking.
+ *
+ * The frame's data is valid until the next call to avbin_pipeline_pop() for
+ * the same stream, or until the pipeline stops.
+ *
+ * @version Version 11.  Requires pipeline feature.
+ *
+ * @param[in]  stream  A stream taking part in the pipeline.
+ * @param[out] frame   The frame.  The structure_size member must be filled in
+ *                     by the application.
+ *
+ * @retval AVBIN_RESULT_OK     if frame was filled in.
+ * @retval AVBIN_RESULT_AGAIN  if no frame is ready yet.
+ * @retval AVBIN_RESULT_ERROR  at the end of the stream, or if the stream is
+ *                             not taking part in a pipeline.
+ */
+AVbinResult avbin_pipeline_pop(AVbinStream *stream, AVbinQueuedFrame *frame);
+
+/**
+ * Release the frame returned by avbin_decode_video_frame().  The frame's
+ * pointers must not be used after this call, and the stream can be decoded
+ * again.
+ *
+ * @version Version 11.  Requires frame feature.
+ */
+void avbin_release_frame(AVbinStream *stream);
+
+/*@}*/
+
+/**
+ * @name Statistics functions
+ */
+/*@{*/
+
+/**
+ * Get the performance counters of a file.
+ *
+ * The file's counters cover every stream of the file, including streams
+ * that have since been closed.  Counting uses atomic operations and a
+ * monotonic clock, and is always on; this may be called at any time, from
+ * any thread, including while a pipeline is running.
+ *
+ * @version Version 11.  Requires stats feature.
+ *
+ * @param[in]  file   The file.
+ * @param[out] stats  The counters.  The structure_size member must be filled
+ *                    in by the application.
+ */
+AVbinResult avbin_get_file_stats(AVbinFile *file, AVbinStats *stats);
+
+/**
+ * Get the performance counters of a stream.  Packets and bytes count those
+ * of the stream's packets read while it was open; demux time is not
+ * counted for streams.
+ *
+ * @version Version 11.  Requires stats feature.
+ *
+ * @param[in]  stream The stream.
+ * @param[out] stats  The counters.  The structure_size member must be filled
+ *                    in by the application.
+ */
+AVbinResult avbin_get_stream_stats(AVbinStream *stream, AVbinStats *stats);
+
+/*@}*/
+
+/**
+ * @name Playlist functions
+ *
+ * A playlist plays the first audio stream of a series of files as one
+ * continuous stream of samples, with no gap between files.  A background
+ * thread opens and probes each file while the one before it is still
+ * playing and decodes ahead into a buffer of samples, so the application's
+ * audio thread only ever copies samples out.  Encoder delay and padding are
+ * trimmed from each file where the file records them (in the iTunSMPB tag
+ * written by iTunes and most AAC and MP3 encoders).
+ */
+/*@{*/
+
+/**
+ * Create a playlist and start its background thread.  Add files with
+ * avbin_playlist_append().
+ *
+ * @version Version 11.  Requires playlist feature.
+ *
+ * @param options  Output format and buffering, or NULL for the defaults.
+ *
+ * @retval NULL if the options are invalid or the thread could not be
+ *         started.
+ */
+AVbinPlaylist *avbin_open_playlist(AVbinPlaylistOptions *options);
+
+/**
+ * Stop the playlist's background thread and close it and all its files.
+ *
+ * @version Version 11.  Requires playlist feature.
+ */
+void avbin_close_playlist(AVbinPlaylist *playlist);
+
+/**
+ * Add a file to the end of the playlist.  Files may be added at any time,
+ * from any thread.  Files that cannot be opened, or have no audio stream,
+ * are skipped.
+ *
+ * @version Version 11.  Requires playlist feature.
+ *
+ * @return the file's track number, counting from 0 in the order files were
+ *         added, or -1 on error.
+ */
+int32_t avbin_playlist_append(AVbinPlaylist *playlist, const char *filename);
+
+/**
+ * Take up to nb_samples samples per channel of interleaved audio from the
+ * playlist, without blocking.  Samples continue straight from the end of one
+ * file into the start of the next.  Only one thread may read from a playlist
+ * at a time.
+ *
+ * @version Version 11.  Requires playlist feature.
+ *
+ * @param[in]  playlist    The playlist.
+ * @param[out] buffer      Receives the samples, in the playlist's output
+ *                         format.  Must have room for nb_samples samples per
+ *                         channel.
+ * @param[in]  nb_samples  Most samples per channel to take.
+ *
+ * @return the number of samples per channel written, which is less than
+ *         nb_samples if decoding has fallen behind.
+ *
+ * @retval -1 if every file added so far has been played to the end.
+ */
+int32_t avbin_playlist_read(AVbinPlaylist *playlist, uint8_t *buffer,
+                            int32_t nb_samples);
+
+/**
+ * Find out which file is playing.
+ *
+ * @version Version 11.  Requires playlist feature.
+ *
+ * @return the track number (see avbin_playlist_append()) of the file the
+ *         last sample taken by avbin_playlist_read() came from, or -1 if no
+ *         samples have been taken yet.
+ */
+int32_t avbin_playlist_track(AVbinPlaylist *playlist);
+
 /*@}*/
 
 #endif
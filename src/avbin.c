@@ -18,520 +18,6634 @@
  * <http://www.gnu.org/licenses/>.
  */
 
+#include <math.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(__APPLE__)
+#include <mach/mach_time.h>
+#endif
 
 #include <avbin.h>
 
 /* libav */
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
+#include <libavresample/avresample.h>
 #include <libavutil/avutil.h>
+#include <libavutil/channel_layout.h>
 #include <libavutil/dict.h>
+#include <libavutil/imgutils.h>
 #include <libavutil/mathematics.h>
+#include <libavutil/opt.h>
 #include <libswscale/swscale.h>
 
-static int32_t avbin_thread_count = 1;
+/* Global state.  Everything here is either set once by avbin_init_backend()
+ * under avbin_init_once, or is a process-wide setting that is only read and
+ * written whole; nothing else in AVbin is shared between files. */
+static pthread_once_t avbin_init_once = PTHREAD_ONCE_INIT;
+static AVbinResult avbin_init_result = AVBIN_RESULT_ERROR;
+
+static volatile int32_t avbin_thread_count = 1;
+
+/* Process-wide cap on decoder threads (0 for no cap), and the number of
+ * threads currently handed out to open streams.  Only ever updated with
+ * atomic operations. */
+static volatile int32_t avbin_thread_limit = 0;
+static volatile int32_t avbin_threads_in_use = 0;
+
+/* Size of the buffer between custom I/O callbacks and the demuxer. */
+#define AVBIN_IO_BUFFER_SIZE 32768
+
+/* Most packets, and packet bytes, held for other streams while one stream
+ * is decoded in batches; beyond this the oldest are dropped. */
+#define AVBIN_BACKLOG_MAX_PACKETS 2048
+#define AVBIN_BACKLOG_MAX_BYTES (32 * 1024 * 1024)
+
+/* Sidecar index file layout; see avbin_save_index() */
+#define AVBIN_INDEX_MAGIC "AVbI"
+#define AVBIN_INDEX_VERSION 1
+#define AVBIN_INDEX_HEADER_SIZE 40
+#define AVBIN_INDEX_ENTRY_SIZE 16
+
+typedef struct _AVbinIndexEntry {
+    AVbinTimestamp timestamp;
+    int64_t pos;
+} AVbinIndexEntry;
+
+typedef struct _AVbinMemoryReader {
+    const uint8_t *data;
+    size_t size;
+    size_t position;
+} AVbinMemoryReader;
+
+typedef struct _AVbinPipeline AVbinPipeline;
+typedef struct _AVbinStreamQueue AVbinStreamQueue;
+
+/**
+ * Recycled AVbinPacketRef structures.  The pool is shared by a file and all
+ * of its outstanding packets, so that packets may outlive the file; refs
+ * counts the file plus every packet not on the free list.  lent lists the
+ * packets handed out by avbin_read_ref(), so that their timestamps can be
+ * found again from the data pointer the application decodes.
+ */
+typedef struct _AVbinPacketPool {
+    pthread_mutex_t mutex;
+    AVbinPacketRef *free_list;
+    AVbinPacketRef *lent;
+    int32_t refs;
+} AVbinPacketPool;
+
+struct _AVbinPacketRef {
+    AVPacket packet;
+    volatile int32_t refs;
+    AVbinPacketPool *pool;
+
+    /* Next packet in the pool's free list, or in a pipeline queue */
+    AVbinPacketRef *next;
+
+    /* Neighbours in the pool's lent list, while lent */
+    int lent;
+    AVbinPacketRef *lent_prev;
+    AVbinPacketRef *lent_next;
+};
+
+static AVbinPipelineOptions *avbin_pipeline_options(AVbinPipeline *pipeline);
+static void avbin_flush_backlog(AVbinFile *file);
+static int avbin_discarded(AVbinFile *file, AVPacket *packet);
+static void avbin_reset_batch(AVbinStream *stream);
+static int avbin_accept_frame(AVbinStream *stream);
+static int avbin_decode_to_target(AVbinFile *file, AVPacket *packet);
+static void avbin_set_skip_frame(AVbinStream *stream, AVPacket *packet);
+static void avbin_index_packet(AVbinFile *file, AVPacket *packet);
+static void avbin_ensure_stream_info(AVbinFile *file);
+static void avbin_update_discard(AVbinFile *file);
+static AVbinStream *avbin_file_stream(AVbinFile *file, int32_t index);
+static void avbin_pipeline_remove_stream(AVbinStream *stream);
+static enum AVSampleFormat avbin_output_sample_fmt(AVbinStream *stream);
+static int avbin_output_sample_rate(AVbinStream *stream);
+static int avbin_output_channels(AVbinStream *stream);
+static void avbin_get_output_dimensions(AVbinStream *stream,
+                                        int *width, int *height);
+static AVbinPixelFormat avbin_pixel_format(enum PixelFormat pix_fmt,
+                                           int32_t *full_range);
+static AVbinTimestamp avbin_frame_timestamp(AVbinStream *stream);
+
+/* Time spent in one stage of work, in microseconds.  Histogram bucket i
+ * counts calls that took from 2^(i-1) up to 2^i microseconds; the last
+ * bucket also counts anything longer. */
+typedef struct _AVbinStageCounters {
+    volatile int64_t calls;
+    volatile int64_t total_time;
+    volatile int64_t max_time;
+    volatile int64_t histogram[AVBIN_STATS_BUCKETS];
+} AVbinStageCounters;
+
+/* Counters behind AVbinStats, updated with atomic operations since the
+ * pipeline's threads update them too. */
+typedef struct _AVbinCounters {
+    volatile int64_t packets;
+    volatile int64_t bytes;
+    volatile int64_t decode_calls;
+    volatile int64_t frames;
+    volatile int64_t frames_dropped;
+    AVbinStageCounters demux;
+    AVbinStageCounters decode;
+    AVbinStageCounters convert;
+} AVbinCounters;
 
 struct _AVbinFile {
     AVFormatContext *context;
     AVPacket *packet;
+
+    /* Totals for the file, including streams since closed */
+    AVbinCounters stats;
+
+    /* Open AVbinStream for each stream index, or NULL */
+    AVbinStream **streams;
+    int32_t n_streams;
+
+    /* AVbinStreamSelection for each stream index; missing entries are
+     * AVBIN_STREAM_AUTO */
+    int8_t *selection;
+    int32_t n_selection;
+
+    /* Background read-ahead and decode, when started */
+    AVbinPipeline *pipeline;
+
+    AVbinPacketPool *packet_pool;
+
+    /* Packets read past by avbin_decode_batch() for other open streams,
+     * returned by the next reads before anything new is demuxed, and how
+     * many and how big they are. */
+    AVbinPacketRef *backlog_first;
+    AVbinPacketRef *backlog_last;
+    int32_t backlog_packets;
+    int64_t backlog_bytes;
+
+    /* Non-zero until avformat_find_stream_info() has been run for a file
+     * opened with AVBIN_STREAM_INFO_LAZY. */
+    int stream_info_pending;
+
+    /* Keyframes of index_stream, sorted by timestamp, with their byte
+     * positions.  Every keyframe up to index_covered is present (INT64_MAX
+     * once the whole file has been scanned); index_contiguous is set while
+     * reading carries on from a covered position.  Nothing is recorded
+     * until index_enabled is set by avbin_build_index() or
+     * avbin_load_index(). */
+    int index_enabled;
+    AVbinIndexEntry *index;
+    int32_t index_count;
+    int32_t index_capacity;
+    int32_t index_stream;
+    AVbinTimestamp index_covered;
+    int index_contiguous;
+
+    /* Copy of the filename, for validating sidecar indexes; NULL for
+     * custom I/O */
+    char *filename;
+
+    /* Custom I/O, when not opened from a filename */
+    AVIOContext *io_context;
+    AVbinIOCallbacks io;
+    AVbinMemoryReader memory;
 };
 
 struct _AVbinStream {
     int32_t type;
+    int32_t index;
+    AVbinFile *file;
     AVFormatContext *format_context;
     AVCodecContext *codec_context;
     AVFrame *frame;
+
+    AVbinCounters stats;
+
+    /* Padded copy of the input data, only used when the caller hands us
+     * data that did not come straight out of avbin_read(). */
+    uint8_t *input_buffer;
+    unsigned int input_buffer_size;
+
+    /* Video conversion state.  Each stream owns its own scaler so that
+     * streams of different sizes do not thrash a shared context, and so that
+     * streams can be decoded from different threads. */
+    struct SwsContext *sws_context;
+    enum PixelFormat output_pix_fmt;
+    int output_width;
+    int output_height;
+    int sws_flags;
+
+    /* Number of decoder threads reserved against avbin_thread_limit */
+    int32_t thread_count;
+
+    /* Non-zero while the decoded frame in frame is handed out through
+     * avbin_decode_video_frame() and has not been released.  The decoder
+     * may recycle the frame's buffers on any later decode or reopen, so
+     * those are refused until avbin_release_frame() or a seek. */
+    int frame_held;
+
+    /* Best guess at the presentation time and duration of the frame in
+     * frame, in microseconds, and where the frame after it should start.
+     * last_pts and last_dts are the most recent raw packet timestamps the
+     * decoder passed through, and pts_faults and dts_faults count how often
+     * each went backwards. */
+    AVbinTimestamp frame_timestamp;
+    AVbinTimestamp frame_duration;
+    AVbinTimestamp next_timestamp;
+    int64_t last_pts;
+    int64_t last_dts;
+    int pts_faults;
+    int dts_faults;
+
+    /* Timing of what the last avbin_decode_video(), avbin_decode_audio(),
+     * their packet variants, or a drain call wrote; see
+     * avbin_get_frame_time(). */
+    AVbinTimestamp output_timestamp;
+    AVbinTimestamp output_duration;
+
+    /* Packed sample format written by avbin_decode_audio(), or
+     * AV_SAMPLE_FMT_NONE for the packed equivalent of the decoder's. */
+    enum AVSampleFormat output_sample_fmt;
+
+    /* Output sample rate, channel count and channel layout, or 0 for the
+     * decoder's (or, for the layout, the standard one for the count).  When
+     * the rate or layout differs from the decoder's, output goes through
+     * resample_context, which is set up for the decoder's format, layout
+     * and rate as they were when it was opened. */
+    int output_sample_rate;
+    int output_channels;
+    uint64_t output_channel_layout;
+    AVAudioResampleContext *resample_context;
+    enum AVSampleFormat resample_in_fmt;
+    uint64_t resample_in_layout;
+    int resample_in_rate;
+
+    /* Packet and decoded frame queues while the file's pipeline runs */
+    AVbinStreamQueue *queue;
+
+    /* avbin_decode_batch() state carried between calls: the part of the
+     * current packet not yet decoded, and whether frame holds a decoded
+     * frame that did not fit in the last batch. */
+    AVbinPacketRef *batch_packet;
+    AVPacket batch_remaining;
+    int batch_frame_pending;
+    int batch_draining;
+    int batch_finished;
+
+    /* Output samples decoded by avbin_decode_audio_samples() or
+     * avbin_decode_audio_ring() that did not fit, starting leftover_first
+     * samples into leftover. */
+    uint8_t *leftover;
+    unsigned int leftover_size;
+    int32_t leftover_first;
+    int32_t leftover_samples;
+
+    /* Target of the last accurate seek, or AV_NOPTS_VALUE once a frame at
+     * or after it has been decoded.  frame_offset is the number of leading
+     * samples of the decoded audio frame that lie before the target, and
+     * trimmed_planes the plane pointers past them. */
+    AVbinTimestamp seek_target;
+    int frame_offset;
+    uint8_t **trimmed_planes;
+    unsigned int trimmed_planes_size;
+
+    /* Frames the decoder skips while not seeking */
+    enum AVDiscard skip_frame;
+
+    /* Decoding shortcuts: quality is the level set by
+     * avbin_set_decode_quality(), and current_quality the level in effect,
+     * which avbin_decode_video_deadline() may lower to keep up.
+     * late_frames and early_frames count consecutive pictures behind and
+     * ahead of the playback clock. */
+    AVbinDecodeQuality quality;
+    AVbinDecodeQuality current_quality;
+    int late_frames;
+    int early_frames;
+
+    /* Keyframe-only decoding for thumbnails, the lowres level the decoder
+     * was opened with, and the level asked for by avbin_set_lowres().  The
+     * scaler makes up whatever reduction the decoder cannot do itself. */
+    int thumbnail;
+    int lowres;
+    int output_lowres;
+
+    /* Output size asked for by avbin_set_video_output(), which thumbnail
+     * mode replaces in output_width and output_height until it ends. */
+    int video_output_width;
+    int video_output_height;
+
+    /* Application buffers for decoded and converted pictures.  All members
+     * are NULL when there is none. */
+    AVbinBufferProvider provider;
 };
 
+/* A picture buffer obtained from an AVbinBufferProvider, kept as the
+ * AVFrame's opaque pointer until the decoder releases it.  The release
+ * callback is copied so that it outlives changes of provider. */
+typedef struct _AVbinProvidedBuffer {
+    AVbinBuffer buffer;
+    AVbinReleaseBufferCallback release_buffer;
+    void *user_data;
+} AVbinProvidedBuffer;
+
 static AVbinLogCallback user_log_callback = NULL;
 
 /**
- * Format log messages and call the user log callback.  Essentially a
- * reimplementation of libavutil/log.c:av_log_default_callback.
+ * @name Logging
+ *
+ * Messages are formatted into per-thread buffers, so decoder threads can log
+ * at the same time.  Consecutive repeats from a thread are collapsed into a
+ * count, reported with the next different message or when the logs are
+ * drained or reconfigured, and beyond avbin_log_rate messages a second the
+ * rest are dropped and counted.  Depending on avbin_log_delivery the result
+ * is passed to the user callback straight away, or pushed onto a fixed
+ * lock-free ring that avbin_drain_logs() or the delivery thread empties.  A
+ * full ring drops the message rather than make the decoder wait.
+ *
+ * The ring is a bounded queue of sequenced slots: a slot at position pos is
+ * free for a producer while its sequence is pos, and ready for the consumer
+ * once the producer sets it to pos + 1.
  */
-static void avbin_log_callback(void *ptr,
-                               int level,
-                               const char *fmt,
-                               va_list vl)
-{
-    static char message[8192];
-    const char *module = NULL;
+/*@{*/
 
-//    if (level > av_log_level || !user_log_callback)
-    if (level > av_log_get_level() || !user_log_callback)
-        return;
+#define AVBIN_LOG_RING_SIZE 256     // Must be a power of two
+#define AVBIN_LOG_MESSAGE_SIZE 1024
+#define AVBIN_LOG_MODULE_SIZE 32
+#define AVBIN_LOG_REPEATED_SIZE 64
+#define AVBIN_LOG_DEFAULT_RATE 100
 
-    if (ptr)
+typedef struct _AVbinLogEntry {
+    volatile uint32_t sequence;
+    int level;
+    char module[AVBIN_LOG_MODULE_SIZE];
+    char message[AVBIN_LOG_MESSAGE_SIZE];
+} AVbinLogEntry;
+
+static AVbinLogEntry avbin_log_ring[AVBIN_LOG_RING_SIZE];
+static int avbin_log_ring_ready = 0;
+static volatile uint32_t avbin_log_head = 0;
+static uint32_t avbin_log_tail = 0;
+
+static volatile AVbinLogDelivery avbin_log_delivery =
+    AVBIN_LOG_DELIVERY_IMMEDIATE;
+static volatile int32_t avbin_log_rate = AVBIN_LOG_DEFAULT_RATE;
+static volatile int32_t avbin_log_window = 0;
+static volatile int32_t avbin_log_window_count = 0;
+static volatile int32_t avbin_log_dropped = 0;
+
+/* Serializes consumers of the ring, and guards the delivery thread */
+static pthread_mutex_t avbin_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t avbin_log_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t avbin_log_thread;
+static int avbin_log_thread_running = 0;
+static volatile int avbin_log_thread_stop = 0;
+
+/* Formatting buffer, and the last message and how often it has been
+ * repeated since, of one thread.  Found through avbin_log_key rather than
+ * compiler TLS, which the OS X toolchain lacks.  Every thread's state is
+ * also on a list, so that any thread can report pending repeats; mutex
+ * guards everything but message. */
+typedef struct _AVbinLogThread {
+    pthread_mutex_t mutex;
+    char message[AVBIN_LOG_MESSAGE_SIZE];
+    char last[AVBIN_LOG_MESSAGE_SIZE];
+    char last_module[AVBIN_LOG_MODULE_SIZE];
+    int last_level;
+    int repeats;
+    struct _AVbinLogThread *next;
+} AVbinLogThread;
+
+static pthread_key_t avbin_log_key;
+static pthread_once_t avbin_log_key_once = PTHREAD_ONCE_INIT;
+static int avbin_log_key_ready = 0;
+static AVbinLogThread *avbin_log_threads = NULL;
+static pthread_mutex_t avbin_log_threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Queue a message for the consumer.  Never blocks.
+ */
+static void avbin_log_push(const char *module, int level, const char *message)
+{
+    AVbinLogEntry *entry;
+    uint32_t pos = avbin_log_head;
+    int32_t diff;
+
+    for (;;)
     {
-        AVClass *avc = *(AVClass**) ptr;
-        module = avc->item_name(ptr);
+        entry = &avbin_log_ring[pos & (AVBIN_LOG_RING_SIZE - 1)];
+        diff = (int32_t) (entry->sequence - pos);
+        if (diff == 0 &&
+            __sync_bool_compare_and_swap(&avbin_log_head, pos, pos + 1))
+            break;
+        if (diff < 0)
+        {
+            __sync_fetch_and_add(&avbin_log_dropped, 1);
+            return;
+        }
+        pos = avbin_log_head;
     }
 
-    vsnprintf(message, sizeof message, fmt, vl);
-    user_log_callback(module, (AVbinLogLevel) level, message);
-}
+    entry->level = level;
+    snprintf(entry->module, sizeof entry->module, "%s", module ? module : "");
+    snprintf(entry->message, sizeof entry->message, "%s", message);
+    __sync_synchronize();
+    entry->sequence = pos + 1;
 
-int32_t avbin_get_version()
-{
-    return AVBIN_VERSION;
+    if (avbin_log_delivery == AVBIN_LOG_DELIVERY_THREAD)
+        pthread_cond_signal(&avbin_log_cond);
 }
 
-AVbinInfo *avbin_get_info()
+/**
+ * Deliver a message now, or queue it, depending on the delivery mode.
+ */
+static void avbin_log_deliver(const char *module, int level,
+                              const char *message)
 {
-    AVbinInfo *info = malloc(sizeof(*info));
+    AVbinLogCallback callback = user_log_callback;
 
-    info->structure_size         = sizeof(*info);
-    info->version                = avbin_get_version();
-    info->version_string         = AVBIN_VERSION_STRING;
-    info->build_date             = AVBIN_BUILD_DATE;
-    info->repo                   = AVBIN_REPO;
-    info->commit                 = AVBIN_COMMIT;
-    info->backend                = AVBIN_BACKEND;
-    info->backend_version_string = AVBIN_BACKEND_VERSION_STRING;
-    info->backend_repo           = AVBIN_BACKEND_REPO;
-    info->backend_commit         = AVBIN_BACKEND_COMMIT;
-    return info;
+    if (avbin_log_delivery != AVBIN_LOG_DELIVERY_IMMEDIATE)
+        avbin_log_push(module, level, message);
+    else if (callback)
+        callback(module, (AVbinLogLevel) level, message);
 }
 
-// Deprecated - use avbin_get_info() instead.  Will be removed in version 12.
-int32_t avbin_get_ffmpeg_revision()
+/**
+ * Report, and reset, the number of messages dropped so far.  Called by
+ * whichever thread delivers messages.
+ */
+static void avbin_log_report_dropped(void)
 {
-    return 0;
-}
+    char message[64];
+    int32_t dropped;
 
-// Deprecated - useless.  Will be removed in version 13.
-size_t avbin_get_audio_buffer_size()
-{
-    return 192000;
+    if (!avbin_log_dropped)
+        return;
+
+    dropped = __sync_lock_test_and_set(&avbin_log_dropped, 0);
+    if (dropped <= 0)
+        return;
+
+    snprintf(message, sizeof message,
+             "%d log messages were dropped\n", dropped);
+    if (user_log_callback)
+        user_log_callback("avbin", AVBIN_LOG_WARNING, message);
 }
 
-int32_t avbin_have_feature(const char *feature)
+/**
+ * Count a message against this second's rate limit.
+ *
+ * @return 0 if the message must be dropped.
+ */
+static int avbin_log_admit(void)
 {
-    if (strcmp(feature, "frame_rate") == 0)
+    int32_t rate = avbin_log_rate;
+    int32_t window;
+    int32_t now;
+
+    if (rate < 0)
+        return 1;
+
+    /* Only the thread that moves the window on resets the count.  Messages
+     * counted between the two are forgiven, which only lets through a few
+     * extra at the turn of a second. */
+    now = (int32_t) time(NULL);
+    window = avbin_log_window;
+    if (window != now &&
+        __sync_bool_compare_and_swap(&avbin_log_window, window, now))
+        __sync_lock_test_and_set(&avbin_log_window_count, 0);
+
+    if (__sync_add_and_fetch(&avbin_log_window_count, 1) > rate)
     {
-        // See note on avbin_have_feature() in avbin.h
+        __sync_fetch_and_add(&avbin_log_dropped, 1);
         return 0;
     }
-    if (strcmp(feature, "options") == 0)
-        return 1;
-    if (strcmp(feature, "info") == 0)
-        return 1;
-    return 0;
+    return 1;
 }
 
-AVbinResult avbin_init()
+/**
+ * Take the count of repeats of thread's last message not reported yet, and
+ * format the report into repeated, of AVBIN_LOG_REPEATED_SIZE bytes.
+ *
+ * @return 0 if there is nothing to report.
+ */
+static int avbin_log_take_repeats(AVbinLogThread *thread, char *module,
+                                  int *level, char *repeated)
 {
-    return avbin_init_options(NULL);
+    int repeats;
+
+    pthread_mutex_lock(&thread->mutex);
+    repeats = thread->repeats;
+    if (repeats)
+    {
+        snprintf(repeated, AVBIN_LOG_REPEATED_SIZE,
+                 "    Last message repeated %d times\n", repeats);
+        memcpy(module, thread->last_module, AVBIN_LOG_MODULE_SIZE);
+        *level = thread->last_level;
+        thread->repeats = 0;
+    }
+    pthread_mutex_unlock(&thread->mutex);
+    return repeats;
 }
 
-AVbinResult avbin_init_options(AVbinOptions * options_ptr)
+static void avbin_log_report_repeats(AVbinLogThread *thread)
 {
-    if (options_ptr == NULL)
-    {
-        options_ptr = malloc(sizeof(options_ptr));
-        if (options_ptr == NULL)
-            return AVBIN_RESULT_ERROR;
+    char module[AVBIN_LOG_MODULE_SIZE];
+    char repeated[AVBIN_LOG_REPEATED_SIZE];
+    int level;
 
-        // Set defaults...
-        options_ptr->structure_size = sizeof(AVbinOptions);
-        options_ptr->thread_count = 1;
-    }
+    if (avbin_log_take_repeats(thread, module, &level, repeated))
+        avbin_log_deliver(module[0] ? module : NULL, level, repeated);
+}
 
-    // What version did we get?
-    AVbinOptions * options = NULL;
-    if (options_ptr->structure_size == sizeof(AVbinOptions))
+/**
+ * Report pending repeats of every thread.  The list lock, which keeps
+ * exiting threads from freeing their state, is not held while delivering,
+ * so that the callback may log.
+ */
+static void avbin_log_flush_repeats(void)
+{
+    AVbinLogThread *thread;
+    char module[AVBIN_LOG_MODULE_SIZE];
+    char repeated[AVBIN_LOG_REPEATED_SIZE];
+    int level;
+    int found;
+
+    do
     {
-        options = options_ptr;
-    } else {
-        return AVBIN_RESULT_ERROR;
-    }
+        found = 0;
+        pthread_mutex_lock(&avbin_log_threads_mutex);
+        for (thread = avbin_log_threads; thread && !found;
+             thread = thread->next)
+            found = avbin_log_take_repeats(thread, module, &level, repeated);
+        pthread_mutex_unlock(&avbin_log_threads_mutex);
 
-    // Stupid choices deserve single-threading
-    if (options->thread_count < 0)
-        options->thread_count = 1;
+        if (found)
+            avbin_log_deliver(module[0] ? module : NULL, level, repeated);
+    } while (found);
+}
 
-    avbin_thread_count = options->thread_count;
+/**
+ * Key destructor: report the exiting thread's repeats and free its state.
+ */
+static void avbin_log_thread_exit(void *arg)
+{
+    AVbinLogThread *thread = arg;
+    AVbinLogThread **link;
 
-    av_register_all();
-    avcodec_register_all();
+    avbin_log_report_repeats(thread);
 
-    return AVBIN_RESULT_OK;
+    pthread_mutex_lock(&avbin_log_threads_mutex);
+    for (link = &avbin_log_threads; *link; link = &(*link)->next)
+    {
+        if (*link == thread)
+        {
+            *link = thread->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&avbin_log_threads_mutex);
+
+    pthread_mutex_destroy(&thread->mutex);
+    free(thread);
 }
 
-AVbinResult avbin_set_log_level(AVbinLogLevel level)
+static void avbin_log_create_key(void)
 {
-    av_log_set_level(level);
-    return AVBIN_RESULT_OK;
+    avbin_log_key_ready =
+        pthread_key_create(&avbin_log_key, avbin_log_thread_exit) == 0;
 }
 
-AVbinResult avbin_set_log_callback(AVbinLogCallback callback)
+/**
+ * The calling thread's log state, created on first use, or NULL.
+ */
+static AVbinLogThread *avbin_log_get_thread(void)
 {
-    user_log_callback = callback;
+    AVbinLogThread *thread;
 
-    /* Note av_log_set_callback looks set to disappear at
-     * LIBAVUTIL_VERSION >= 50; at which point av_vlog must be
-     * set directly.
-     */
-    if (callback)
-        av_log_set_callback(avbin_log_callback);
-    else
-        av_log_set_callback(av_log_default_callback);
-    return AVBIN_RESULT_OK;
-}
+    pthread_once(&avbin_log_key_once, avbin_log_create_key);
+    if (!avbin_log_key_ready)
+        return NULL;
 
-AVbinFile *avbin_open_filename(const char *filename) { return avbin_open_filename_with_format(filename, NULL); }
+    thread = pthread_getspecific(avbin_log_key);
+    if (thread)
+        return thread;
 
-AVbinFile *avbin_open_filename_with_format(const char *filename, char* format)
+    thread = calloc(1, sizeof *thread);
+    if (!thread)
+        return NULL;
+    pthread_mutex_init(&thread->mutex, NULL);
+    thread->last_level = -1;
+    if (pthread_setspecific(avbin_log_key, thread) != 0)
+    {
+        pthread_mutex_destroy(&thread->mutex);
+        free(thread);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&avbin_log_threads_mutex);
+    thread->next = avbin_log_threads;
+    avbin_log_threads = thread;
+    pthread_mutex_unlock(&avbin_log_threads_mutex);
+    return thread;
+}
+
+/**
+ * Format log messages and pass them on for delivery.  Essentially a
+ * reimplementation of libavutil/log.c:av_log_default_callback.
+ */
+static void avbin_log_callback(void *ptr,
+                               int level,
+                               const char *fmt,
+                               va_list vl)
 {
-    AVbinFile *file = malloc(sizeof *file);
-    AVInputFormat *avformat = NULL;
-    if (format) avformat = av_find_input_format(format);
+    const char *module = NULL;
+    AVbinLogThread *thread;
 
-    file->context = NULL;    // Zero-initialize
-    if (avformat_open_input(&file->context, filename, avformat, NULL) != 0)
-        goto error;
+//    if (level > av_log_level || !user_log_callback)
+    if (level > av_log_get_level() || !user_log_callback)
+        return;
 
-    if (avformat_find_stream_info(file->context, NULL) < 0)
-      goto error;
+    thread = avbin_log_get_thread();
+    if (!thread)
+        return;
 
-    file->packet = NULL;
-    return file;
+    if (ptr)
+    {
+        AVClass *avc = *(AVClass**) ptr;
+        module = avc->item_name(ptr);
+    }
 
-error:
-    free(file);
-    return NULL;
+    vsnprintf(thread->message, sizeof thread->message, fmt, vl);
+
+    pthread_mutex_lock(&thread->mutex);
+    if (level == thread->last_level &&
+        strcmp(thread->message, thread->last) == 0 &&
+        strncmp(module ? module : "", thread->last_module,
+                sizeof thread->last_module - 1) == 0)
+    {
+        thread->repeats++;
+        pthread_mutex_unlock(&thread->mutex);
+        return;
+    }
+    pthread_mutex_unlock(&thread->mutex);
+
+    if (!avbin_log_admit())
+        return;
+
+    if (avbin_log_delivery == AVBIN_LOG_DELIVERY_IMMEDIATE)
+        avbin_log_report_dropped();
+    avbin_log_report_repeats(thread);
+
+    pthread_mutex_lock(&thread->mutex);
+    memcpy(thread->last, thread->message, sizeof thread->last);
+    snprintf(thread->last_module, sizeof thread->last_module, "%s",
+             module ? module : "");
+    thread->last_level = level;
+    pthread_mutex_unlock(&thread->mutex);
+
+    avbin_log_deliver(module, level, thread->message);
 }
 
-void avbin_close_file(AVbinFile *file)
+/**
+ * Deliver every queued message.  Caller holds avbin_log_mutex.
+ */
+static int32_t avbin_log_drain_locked(void)
 {
-    if (file->packet)
+    AVbinLogCallback callback = user_log_callback;
+    AVbinLogEntry *entry;
+    int32_t delivered = 0;
+
+    if (!avbin_log_ring_ready)
+        return 0;
+
+    for (;;)
     {
-        av_free_packet(file->packet);
-        free(file->packet);
+        entry = &avbin_log_ring[avbin_log_tail & (AVBIN_LOG_RING_SIZE - 1)];
+        if ((int32_t) (entry->sequence - (avbin_log_tail + 1)) < 0)
+            break;
+        __sync_synchronize();
+
+        if (callback)
+            callback(entry->module[0] ? entry->module : NULL,
+                     (AVbinLogLevel) entry->level, entry->message);
+        delivered++;
+
+        __sync_synchronize();
+        entry->sequence = avbin_log_tail + AVBIN_LOG_RING_SIZE;
+        avbin_log_tail++;
     }
 
-    avformat_close_input(&file->context);
-    free(file);
+    avbin_log_report_dropped();
+    return delivered;
 }
 
-AVbinResult avbin_seek_file(AVbinFile *file, AVbinTimestamp timestamp)
+static void *avbin_log_thread_main(void *arg)
 {
-    int i;
-    AVCodecContext *codec_context;
-    int flags = 0;
+    struct timespec deadline;
+    struct timeval now;
 
-    if (!timestamp)
+    pthread_mutex_lock(&avbin_log_mutex);
+    while (!avbin_log_thread_stop)
     {
-        flags = AVSEEK_FLAG_ANY | AVSEEK_FLAG_BYTE;
-        if (av_seek_frame(file->context, -1, 0, flags) < 0)
-            return AVBIN_RESULT_ERROR;
+        avbin_log_drain_locked();
+
+        // Producers signal without the lock, so don't rely on being woken
+        gettimeofday(&now, NULL);
+        deadline.tv_sec = now.tv_sec;
+        deadline.tv_nsec = (now.tv_usec + 100000) * 1000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&avbin_log_cond, &avbin_log_mutex, &deadline);
     }
-    else
-    {
-        flags = AVSEEK_FLAG_BACKWARD;
-        if (av_seek_frame(file->context, -1, timestamp, flags) < 0)
+    avbin_log_drain_locked();
+    pthread_mutex_unlock(&avbin_log_mutex);
+    return NULL;
+}
+
+static void avbin_log_stop_thread(void)
+{
+    if (!avbin_log_thread_running)
+        return;
+
+    pthread_mutex_lock(&avbin_log_mutex);
+    avbin_log_thread_stop = 1;
+    pthread_cond_signal(&avbin_log_cond);
+    pthread_mutex_unlock(&avbin_log_mutex);
+
+    pthread_join(avbin_log_thread, NULL);
+    avbin_log_thread_running = 0;
+    avbin_log_thread_stop = 0;
+}
+
+AVbinResult avbin_set_log_options(AVbinLogOptions *options)
+{
+    uint32_t i;
+
+    if (options->structure_size < sizeof *options)
+        return AVBIN_RESULT_ERROR;
+
+    switch (options->delivery)
+    {
+        case AVBIN_LOG_DELIVERY_IMMEDIATE:
+        case AVBIN_LOG_DELIVERY_THREAD:
+        case AVBIN_LOG_DELIVERY_MANUAL:
+            break;
+        default:
+            return AVBIN_RESULT_ERROR;
+    }
+
+    avbin_log_flush_repeats();
+    avbin_log_stop_thread();
+
+    pthread_mutex_lock(&avbin_log_mutex);
+    if (!avbin_log_ring_ready)
+    {
+        for (i = 0; i < AVBIN_LOG_RING_SIZE; i++)
+            avbin_log_ring[i].sequence = i;
+        avbin_log_ring_ready = 1;
+    }
+
+    avbin_log_rate = options->rate_limit ? options->rate_limit
+                                         : AVBIN_LOG_DEFAULT_RATE;
+    avbin_log_delivery = options->delivery;
+
+    // Nothing queued may be left behind by a switch to immediate delivery
+    avbin_log_drain_locked();
+    pthread_mutex_unlock(&avbin_log_mutex);
+
+    if (options->delivery == AVBIN_LOG_DELIVERY_THREAD)
+    {
+        if (pthread_create(&avbin_log_thread, NULL, avbin_log_thread_main,
+                           NULL) != 0)
+        {
+            avbin_log_delivery = AVBIN_LOG_DELIVERY_MANUAL;
             return AVBIN_RESULT_ERROR;
+        }
+        avbin_log_thread_running = 1;
+    }
+
+    return AVBIN_RESULT_OK;
+}
+
+int32_t avbin_drain_logs(void)
+{
+    int32_t delivered;
+
+    avbin_log_flush_repeats();
+    pthread_mutex_lock(&avbin_log_mutex);
+    delivered = avbin_log_drain_locked();
+    pthread_mutex_unlock(&avbin_log_mutex);
+    return delivered;
+}
+/*@}*/
+
+/**
+ * @name Statistics
+ *
+ * Every file and stream keeps AVbinCounters.  Stages are timed with the
+ * monotonic clock, and counters are only ever changed with atomic
+ * operations, so the counts stay cheap enough to leave on and are safe to
+ * read while the pipeline is running.  Stream counts are added to the
+ * file's as well, so the file keeps them after the stream is closed.
+ */
+/*@{*/
+
+/**
+ * Microseconds from an arbitrary fixed point, never going backwards.
+ */
+#if defined(_WIN32)
+static LARGE_INTEGER avbin_clock_frequency;
+#elif defined(__APPLE__)
+static mach_timebase_info_data_t avbin_clock_timebase;
+#endif
+
+/**
+ * Look up the monotonic clock's rate.  Called once, from avbin_init().
+ */
+static void avbin_init_clock(void)
+{
+#if defined(_WIN32)
+    QueryPerformanceFrequency(&avbin_clock_frequency);
+#elif defined(__APPLE__)
+    mach_timebase_info(&avbin_clock_timebase);
+#endif
+}
+
+static int64_t avbin_monotonic_time(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER now;
+
+    QueryPerformanceCounter(&now);
+    return av_rescale(now.QuadPart, 1000000, avbin_clock_frequency.QuadPart);
+#elif defined(__APPLE__)
+    return av_rescale(mach_absolute_time(), avbin_clock_timebase.numer,
+                      avbin_clock_timebase.denom * (int64_t) 1000);
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+static void avbin_stage_add(AVbinStageCounters *stage, int64_t elapsed)
+{
+    int64_t max = stage->max_time;
+    int bucket = 0;
+
+    while (bucket < AVBIN_STATS_BUCKETS - 1 && elapsed >> bucket)
+        bucket++;
+
+    __sync_fetch_and_add(&stage->calls, 1);
+    __sync_fetch_and_add(&stage->total_time, elapsed);
+    __sync_fetch_and_add(&stage->histogram[bucket], 1);
+    while (elapsed > max)
+        max = __sync_val_compare_and_swap(&stage->max_time, max, elapsed);
+}
+
+/**
+ * Count time since start (from avbin_monotonic_time()) against a stage of
+ * the file and, if given, of the stream.
+ */
+static void avbin_stats_time(AVbinFile *file, AVbinStream *stream,
+                             size_t stage, int64_t start)
+{
+    int64_t elapsed = avbin_monotonic_time() - start;
+
+    if (elapsed < 0)
+        elapsed = 0;
+
+    avbin_stage_add((AVbinStageCounters *) ((char *) &file->stats + stage),
+                    elapsed);
+    if (stream)
+        avbin_stage_add(
+            (AVbinStageCounters *) ((char *) &stream->stats + stage),
+            elapsed);
+}
+
+/**
+ * Add to one of the plain counters of the stream and its file.
+ */
+static void avbin_stats_count(AVbinStream *stream, size_t counter,
+                              int64_t n)
+{
+    __sync_fetch_and_add((volatile int64_t *)
+                         ((char *) &stream->file->stats + counter), n);
+    __sync_fetch_and_add((volatile int64_t *)
+                         ((char *) &stream->stats + counter), n);
+}
+
+#define AVBIN_STAT(name) offsetof(AVbinCounters, name)
+
+/**
+ * Count a frame the decoder produced but that is never handed out.
+ */
+static void avbin_drop_frame(AVbinStream *stream)
+{
+    avbin_stats_count(stream, AVBIN_STAT(frames_dropped), 1);
+}
+
+/**
+ * Read a counter in one piece, even where 64-bit loads are not atomic.
+ */
+static int64_t avbin_stats_load(volatile int64_t *counter)
+{
+    return __sync_fetch_and_add(counter, 0);
+}
+
+static void avbin_stage_load(AVbinStageStats *stats,
+                             AVbinStageCounters *stage)
+{
+    int i;
+
+    stats->calls = avbin_stats_load(&stage->calls);
+    stats->total_time = avbin_stats_load(&stage->total_time);
+    stats->max_time = avbin_stats_load(&stage->max_time);
+    for (i = 0; i < AVBIN_STATS_BUCKETS; i++)
+        stats->histogram[i] = avbin_stats_load(&stage->histogram[i]);
+}
+
+static AVbinResult avbin_stats_load_all(AVbinStats *stats,
+                                        AVbinCounters *counters)
+{
+    if (stats->structure_size < sizeof *stats)
+        return AVBIN_RESULT_ERROR;
+
+    stats->packets = avbin_stats_load(&counters->packets);
+    stats->bytes = avbin_stats_load(&counters->bytes);
+    stats->decode_calls = avbin_stats_load(&counters->decode_calls);
+    stats->frames = avbin_stats_load(&counters->frames);
+    stats->frames_dropped = avbin_stats_load(&counters->frames_dropped);
+    avbin_stage_load(&stats->demux, &counters->demux);
+    avbin_stage_load(&stats->decode, &counters->decode);
+    avbin_stage_load(&stats->convert, &counters->convert);
+    return AVBIN_RESULT_OK;
+}
+
+AVbinResult avbin_get_file_stats(AVbinFile *file, AVbinStats *stats)
+{
+    return avbin_stats_load_all(stats, &file->stats);
+}
+
+AVbinResult avbin_get_stream_stats(AVbinStream *stream, AVbinStats *stats)
+{
+    return avbin_stats_load_all(stats, &stream->stats);
+}
+
+/**
+ * Work out the presentation time and duration of the frame just decoded.
+ *
+ * The timestamps of the packet that began the frame are used, preferring
+ * the pts unless it has gone backwards more often than the dts, as it does
+ * in some broken files.  The dts is not used for a video decoder that
+ * reorders frames, since it belongs to a different picture.  A frame with
+ * no usable timestamp, such as the second of two audio frames in one
+ * packet, is placed straight after the one before.
+ */
+static void avbin_time_frame(AVbinStream *stream)
+{
+    AVStream *av_stream = stream->format_context->streams[stream->index];
+    AVCodecContext *codec_context = stream->codec_context;
+    AVFrame *frame = stream->frame;
+    int64_t pts = frame->pkt_pts;
+    int64_t dts = frame->pkt_dts;
+    int64_t timestamp = AV_NOPTS_VALUE;
+    int64_t duration = 0;
+    AVRational rate;
+
+    // Every frame decoded from an audio packet carries the packet's times
+    if (stream->type == AVMEDIA_TYPE_AUDIO &&
+        pts == stream->last_pts && dts == stream->last_dts)
+        pts = dts = AV_NOPTS_VALUE;
+
+    if (pts != AV_NOPTS_VALUE)
+    {
+        if (stream->last_pts != AV_NOPTS_VALUE && pts <= stream->last_pts)
+            stream->pts_faults++;
+        stream->last_pts = pts;
+    }
+    if (dts != AV_NOPTS_VALUE)
+    {
+        if (stream->last_dts != AV_NOPTS_VALUE && dts <= stream->last_dts)
+            stream->dts_faults++;
+        stream->last_dts = dts;
+    }
+
+    if (pts != AV_NOPTS_VALUE &&
+        (stream->pts_faults <= stream->dts_faults || dts == AV_NOPTS_VALUE))
+        timestamp = pts;
+    else if (dts != AV_NOPTS_VALUE &&
+             (pts != AV_NOPTS_VALUE || stream->type != AVMEDIA_TYPE_VIDEO ||
+              !codec_context->has_b_frames))
+        timestamp = dts;
+
+    if (timestamp != AV_NOPTS_VALUE)
+        timestamp = av_rescale_q(timestamp, av_stream->time_base,
+                                 AV_TIME_BASE_Q);
+    else
+        timestamp = stream->next_timestamp;
+
+    if (stream->type == AVMEDIA_TYPE_AUDIO)
+    {
+        if (codec_context->sample_rate > 0)
+            duration = av_rescale(frame->nb_samples, AV_TIME_BASE,
+                                  codec_context->sample_rate);
+    }
+    else
+    {
+        rate = av_stream->avg_frame_rate;
+        if (rate.num <= 0 || rate.den <= 0)
+            rate = av_stream->r_frame_rate;
+        if (rate.num > 0 && rate.den > 0)
+            duration = av_rescale((int64_t) AV_TIME_BASE *
+                                      (2 + frame->repeat_pict),
+                                  rate.den, 2 * (int64_t) rate.num);
+        else if (timestamp != AV_NOPTS_VALUE &&
+                 stream->frame_timestamp != AV_NOPTS_VALUE &&
+                 timestamp > stream->frame_timestamp)
+            duration = timestamp - stream->frame_timestamp;
+    }
+
+    stream->frame_timestamp = timestamp;
+    stream->frame_duration = duration;
+    stream->next_timestamp = timestamp != AV_NOPTS_VALUE ?
+        timestamp + duration : AV_NOPTS_VALUE;
+}
+
+/**
+ * Whether the stream's decoder may still be holding frames back once its
+ * packets run out, and so must be fed empty packets to give them up.
+ * Besides decoders that reorder or look ahead, frame-threaded decoding
+ * holds up to one frame per thread.
+ */
+static int avbin_decoder_delayed(AVbinStream *stream)
+{
+    AVCodecContext *codec_context = stream->codec_context;
+
+    if (!codec_context->codec)
+        return 0;
+    return codec_context->codec->capabilities & CODEC_CAP_DELAY ||
+           codec_context->active_thread_type & FF_THREAD_FRAME;
+}
+
+/**
+ * Run the stream's decoder on packet, counting and timing the call.
+ *
+ * @return what avcodec_decode_video2() or avcodec_decode_audio4() returns,
+ *         or AVBIN_RESULT_ERROR if the last frame is still held or the
+ *         decoder could not be reopened.
+ */
+static int avbin_decode_frame(AVbinStream *stream, int *got_frame,
+                              AVPacket *packet)
+{
+    int64_t start = avbin_monotonic_time();
+    int bytes_used;
+
+    *got_frame = 0;
+    // Closed for good by a failed reopen
+    if (!stream->codec_context->codec)
+        return AVBIN_RESULT_ERROR;
+
+    if (stream->frame_held)
+    {
+        av_log(stream->codec_context, AV_LOG_ERROR,
+               "Frame not released before decoding again\n");
+        return AVBIN_RESULT_ERROR;
+    }
+
+    if (stream->type == AVMEDIA_TYPE_VIDEO)
+        bytes_used = avcodec_decode_video2(stream->codec_context,
+                                           stream->frame, got_frame, packet);
+    else
+        bytes_used = avcodec_decode_audio4(stream->codec_context,
+                                           stream->frame, got_frame, packet);
+
+    avbin_stats_time(stream->file, stream, AVBIN_STAT(decode), start);
+    avbin_stats_count(stream, AVBIN_STAT(decode_calls), 1);
+    if (bytes_used >= 0 && *got_frame)
+    {
+        avbin_stats_count(stream, AVBIN_STAT(frames), 1);
+        avbin_time_frame(stream);
+    }
+    return bytes_used;
+}
+/*@}*/
+
+int32_t avbin_get_version()
+{
+    return AVBIN_VERSION;
+}
+
+AVbinInfo *avbin_get_info()
+{
+    AVbinInfo *info = malloc(sizeof(*info));
+
+    info->structure_size         = sizeof(*info);
+    info->version                = avbin_get_version();
+    info->version_string         = AVBIN_VERSION_STRING;
+    info->build_date             = AVBIN_BUILD_DATE;
+    info->repo                   = AVBIN_REPO;
+    info->commit                 = AVBIN_COMMIT;
+    info->backend                = AVBIN_BACKEND;
+    info->backend_version_string = AVBIN_BACKEND_VERSION_STRING;
+    info->backend_repo           = AVBIN_BACKEND_REPO;
+    info->backend_commit         = AVBIN_BACKEND_COMMIT;
+    return info;
+}
+
+// Deprecated - use avbin_get_info() instead.  Will be removed in version 12.
+int32_t avbin_get_ffmpeg_revision()
+{
+    return 0;
+}
+
+// Deprecated - useless.  Will be removed in version 13.
+size_t avbin_get_audio_buffer_size()
+{
+    return 192000;
+}
+
+int32_t avbin_have_feature(const char *feature)
+{
+    if (strcmp(feature, "frame_rate") == 0)
+    {
+        // See note on avbin_have_feature() in avbin.h
+        return 0;
+    }
+    if (strcmp(feature, "options") == 0)
+        return 1;
+    if (strcmp(feature, "info") == 0)
+        return 1;
+    if (strcmp(feature, "packet_decode") == 0)
+        return 1;
+    if (strcmp(feature, "video_output") == 0)
+        return 1;
+    if (strcmp(feature, "frame") == 0)
+        return 1;
+    if (strcmp(feature, "planar_audio") == 0)
+        return 1;
+    if (strcmp(feature, "io") == 0)
+        return 1;
+    if (strcmp(feature, "stream_options") == 0)
+        return 1;
+    if (strcmp(feature, "pipeline") == 0)
+        return 1;
+    if (strcmp(feature, "packet_ref") == 0)
+        return 1;
+    if (strcmp(feature, "batch") == 0)
+        return 1;
+    if (strcmp(feature, "open_options") == 0)
+        return 1;
+    if (strcmp(feature, "accurate_seek") == 0)
+        return 1;
+    if (strcmp(feature, "index") == 0)
+        return 1;
+    if (strcmp(feature, "thumbnail") == 0)
+        return 1;
+    if (strcmp(feature, "select_stream") == 0)
+        return 1;
+    if (strcmp(feature, "resample") == 0)
+        return 1;
+    if (strcmp(feature, "buffer_provider") == 0)
+        return 1;
+    if (strcmp(feature, "log_queue") == 0)
+        return 1;
+    if (strcmp(feature, "stats") == 0)
+        return 1;
+    if (strcmp(feature, "thread_safe") == 0)
+        return 1;
+    if (strcmp(feature, "playlist") == 0)
+        return 1;
+    if (strcmp(feature, "audio_samples") == 0)
+        return 1;
+    if (strcmp(feature, "lowres") == 0)
+        return 1;
+    if (strcmp(feature, "decode_quality") == 0)
+        return 1;
+    if (strcmp(feature, "frame_time") == 0)
+        return 1;
+    return 0;
+}
+
+/**
+ * Lock manager for Libav, which uses it to serialize avcodec_open2() and
+ * avcodec_close() and its other process-wide initialization.
+ */
+static int avbin_lock_manager(void **mutex, enum AVLockOp op)
+{
+    switch (op)
+    {
+        case AV_LOCK_CREATE:
+            *mutex = malloc(sizeof(pthread_mutex_t));
+            if (!*mutex)
+                return 1;
+            if (pthread_mutex_init(*mutex, NULL) != 0)
+            {
+                free(*mutex);
+                *mutex = NULL;
+                return 1;
+            }
+            return 0;
+        case AV_LOCK_OBTAIN:
+            return pthread_mutex_lock(*mutex) != 0;
+        case AV_LOCK_RELEASE:
+            return pthread_mutex_unlock(*mutex) != 0;
+        case AV_LOCK_DESTROY:
+            pthread_mutex_destroy(*mutex);
+            free(*mutex);
+            *mutex = NULL;
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * One-time, process-wide initialization.  Run through avbin_init_once.
+ */
+static void avbin_init_backend(void)
+{
+    avbin_init_clock();
+
+    if (av_lockmgr_register(avbin_lock_manager) != 0)
+        return;
+
+    av_register_all();
+    avcodec_register_all();
+    avbin_init_result = AVBIN_RESULT_OK;
+}
+
+AVbinResult avbin_init()
+{
+    return avbin_init_options(NULL);
+}
+
+AVbinResult avbin_init_options(AVbinOptions * options_ptr)
+{
+    AVbinOptions defaults;
+
+    if (options_ptr == NULL)
+    {
+        // Set defaults...
+        defaults.structure_size = sizeof(AVbinOptions);
+        defaults.thread_count = 1;
+        options_ptr = &defaults;
+    }
+
+    // What version did we get?
+    AVbinOptions * options = NULL;
+    if (options_ptr->structure_size == sizeof(AVbinOptions))
+    {
+        options = options_ptr;
+    } else {
+        return AVBIN_RESULT_ERROR;
+    }
+
+    // Stupid choices deserve single-threading
+    if (options->thread_count < 0)
+        options->thread_count = 1;
+
+    avbin_thread_count = options->thread_count;
+
+    // Only the first call does any work, however many threads get here
+    pthread_once(&avbin_init_once, avbin_init_backend);
+    return avbin_init_result;
+}
+
+AVbinResult avbin_set_thread_limit(int32_t limit)
+{
+    if (limit < 0)
+        return AVBIN_RESULT_ERROR;
+
+    avbin_thread_limit = limit;
+    return AVBIN_RESULT_OK;
+}
+
+static int32_t avbin_cpu_count()
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+#else
+    return 1;
+#endif
+}
+
+/**
+ * Reserve up to requested decoder threads (0 meaning one per core plus one)
+ * against the process-wide limit.  At least one thread is always granted,
+ * since decoding has to happen somewhere.
+ *
+ * @return the number of threads reserved
+ */
+static int32_t avbin_reserve_threads(int32_t requested)
+{
+    int32_t in_use, granted;
+
+    if (requested == 0)
+        requested = avbin_cpu_count() + 1;
+    else if (requested < 0)
+        requested = 1;
+
+    do
+    {
+        in_use = avbin_threads_in_use;
+        granted = requested;
+        if (avbin_thread_limit > 0 && in_use + granted > avbin_thread_limit)
+            granted = FFMAX(avbin_thread_limit - in_use, 1);
+    } while (__sync_val_compare_and_swap(&avbin_threads_in_use,
+                                         in_use, in_use + granted) != in_use);
+
+    return granted;
+}
+
+static void avbin_release_threads(int32_t count)
+{
+    __sync_fetch_and_sub(&avbin_threads_in_use, count);
+}
+
+AVbinResult avbin_set_log_level(AVbinLogLevel level)
+{
+    avbin_log_flush_repeats();
+    av_log_set_level(level);
+    return AVBIN_RESULT_OK;
+}
+
+AVbinResult avbin_set_log_callback(AVbinLogCallback callback)
+{
+    // Repeats of the old callback's messages go to the old callback
+    avbin_log_flush_repeats();
+    user_log_callback = callback;
+
+    /* Note av_log_set_callback looks set to disappear at
+     * LIBAVUTIL_VERSION >= 50; at which point av_vlog must be
+     * set directly.
+     */
+    if (callback)
+        av_log_set_callback(avbin_log_callback);
+    else
+        av_log_set_callback(av_log_default_callback);
+    return AVBIN_RESULT_OK;
+}
+
+AVbinFile *avbin_open_filename(const char *filename) { return avbin_open_filename_with_format(filename, NULL); }
+
+static AVbinPacketPool *avbin_packet_pool_alloc()
+{
+    AVbinPacketPool *pool = malloc(sizeof *pool);
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_init(&pool->mutex, NULL);
+    pool->free_list = NULL;
+    pool->lent = NULL;
+    pool->refs = 1;
+    return pool;
+}
+
+/**
+ * Drop one reference to pool, freeing it along with its recycled packets
+ * when nothing refers to it any more.
+ */
+static void avbin_packet_pool_unref(AVbinPacketPool *pool)
+{
+    AVbinPacketRef *ref, *next;
+    int32_t refs;
+
+    pthread_mutex_lock(&pool->mutex);
+    refs = --pool->refs;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (refs > 0)
+        return;
+
+    for (ref = pool->free_list; ref; ref = next)
+    {
+        next = ref->next;
+        free(ref);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+/**
+ * Take an empty packet from the pool, with a reference count of one.
+ */
+static AVbinPacketRef *avbin_packet_alloc(AVbinPacketPool *pool)
+{
+    AVbinPacketRef *ref;
+
+    pthread_mutex_lock(&pool->mutex);
+    ref = pool->free_list;
+    if (ref)
+        pool->free_list = ref->next;
+    else
+        ref = malloc(sizeof *ref);
+    if (ref)
+        pool->refs++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (!ref)
+        return NULL;
+
+    av_init_packet(&ref->packet);
+    ref->packet.data = NULL;
+    ref->packet.size = 0;
+    ref->refs = 1;
+    ref->pool = pool;
+    ref->next = NULL;
+    ref->lent = 0;
+    return ref;
+}
+
+static void avbin_copy_packet_props(AVPacket *packet, const AVPacket *src)
+{
+    packet->pts = src->pts;
+    packet->dts = src->dts;
+    packet->duration = src->duration;
+    packet->flags = src->flags;
+}
+
+/**
+ * Record that ref is being handed to the application.
+ */
+static void avbin_lend_packet(AVbinPacketRef *ref)
+{
+    AVbinPacketPool *pool = ref->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    ref->lent = 1;
+    ref->lent_prev = NULL;
+    ref->lent_next = pool->lent;
+    if (pool->lent)
+        pool->lent->lent_prev = ref;
+    pool->lent = ref;
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * Copy the timestamps and flags of the lent packet whose data starts at
+ * data and holds at least size bytes into packet.
+ *
+ * @return non-zero if there is such a packet.
+ */
+static int avbin_find_lent_packet(AVbinPacketPool *pool, const uint8_t *data,
+                                  size_t size, AVPacket *packet)
+{
+    AVbinPacketRef *ref;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (ref = pool->lent; ref; ref = ref->lent_next)
+    {
+        if (ref->packet.data == data && (size_t) ref->packet.size >= size)
+        {
+            avbin_copy_packet_props(packet, &ref->packet);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return ref != NULL;
+}
+
+AVbinPacketRef *avbin_retain_packet(AVbinPacketRef *ref)
+{
+    __sync_fetch_and_add(&ref->refs, 1);
+    return ref;
+}
+
+void avbin_release_packet(AVbinPacketRef *ref)
+{
+    AVbinPacketPool *pool = ref->pool;
+
+    if (__sync_sub_and_fetch(&ref->refs, 1) > 0)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (ref->lent)
+    {
+        if (ref->lent_prev)
+            ref->lent_prev->lent_next = ref->lent_next;
+        else
+            pool->lent = ref->lent_next;
+        if (ref->lent_next)
+            ref->lent_next->lent_prev = ref->lent_prev;
+        ref->lent = 0;
+    }
+    av_free_packet(&ref->packet);
+    ref->next = pool->free_list;
+    pool->free_list = ref;
+    pthread_mutex_unlock(&pool->mutex);
+
+    avbin_packet_pool_unref(pool);
+}
+
+/**
+ * Open file->context (which may already have a custom pb attached) and
+ * finish initializing file.  On failure file is freed, along with any
+ * custom I/O context.
+ */
+static AVbinFile *avbin_open_context(AVbinFile *file, const char *filename,
+                                     char *format, AVbinOpenOptions *options)
+{
+    AVInputFormat *avformat = NULL;
+    AVDictionary *format_options = NULL;
+    int32_t stream_info = AVBIN_STREAM_INFO_FULL;
+    char value[32];
+
+    if (format) avformat = av_find_input_format(format);
+
+    if (options)
+    {
+        if (options->probesize > 0)
+        {
+            snprintf(value, sizeof value, "%d", options->probesize);
+            av_dict_set(&format_options, "probesize", value, 0);
+        }
+        if (options->analyzeduration > 0)
+        {
+            snprintf(value, sizeof value, "%lld",
+                     (long long) options->analyzeduration);
+            av_dict_set(&format_options, "analyzeduration", value, 0);
+        }
+        stream_info = options->stream_info;
+    }
+
+    file->packet = NULL;
+    file->streams = NULL;
+    file->n_streams = 0;
+    file->selection = NULL;
+    file->n_selection = 0;
+    file->pipeline = NULL;
+    file->backlog_first = NULL;
+    file->backlog_last = NULL;
+    file->backlog_packets = 0;
+    file->backlog_bytes = 0;
+    file->index_enabled = 0;
+    file->index = NULL;
+    file->index_count = 0;
+    file->index_capacity = 0;
+    file->index_stream = -1;
+    file->index_covered = AV_NOPTS_VALUE;
+    file->index_contiguous = 1;
+    file->filename = NULL;
+    memset(&file->stats, 0, sizeof file->stats);
+    file->packet_pool = avbin_packet_pool_alloc();
+    if (!file->packet_pool)
+        goto error;
+
+    // On failure this frees the context, but not a custom pb
+    if (avformat_open_input(&file->context, filename, avformat,
+                            &format_options) != 0)
+        goto error;
+    av_dict_free(&format_options);
+
+    file->stream_info_pending = stream_info == AVBIN_STREAM_INFO_LAZY;
+    if (stream_info == AVBIN_STREAM_INFO_FULL &&
+        avformat_find_stream_info(file->context, NULL) < 0)
+    {
+        avformat_close_input(&file->context);
+        goto error;
+    }
+
+    if (!file->io_context)
+        file->filename = strdup(filename);
+
+    // A missing or stale index is not an error; it is rebuilt as we go
+    if (options && options->index_path)
+        avbin_load_index(file, options->index_path);
+
+    return file;
+
+error:
+    av_dict_free(&format_options);
+    if (file->packet_pool)
+        avbin_packet_pool_unref(file->packet_pool);
+    if (file->io_context)
+    {
+        av_free(file->io_context->buffer);
+        av_free(file->io_context);
+    }
+    free(file);
+    return NULL;
+}
+
+AVbinFile *avbin_open_filename_with_format(const char *filename, char* format)
+{
+    return avbin_open_filename_with_options(filename, format, NULL);
+}
+
+/**
+ * Check that options, which may be NULL, are usable.
+ */
+static int avbin_valid_open_options(AVbinOpenOptions *options)
+{
+    if (!options)
+        return 1;
+
+    if (options->structure_size < sizeof *options)
+        return 0;
+
+    switch (options->stream_info)
+    {
+        case AVBIN_STREAM_INFO_FULL:
+        case AVBIN_STREAM_INFO_LAZY:
+        case AVBIN_STREAM_INFO_HEADER:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+AVbinFile *avbin_open_filename_with_options(const char *filename,
+                                            char *format,
+                                            AVbinOpenOptions *options)
+{
+    AVbinFile *file;
+
+    if (!avbin_valid_open_options(options))
+        return NULL;
+
+    file = malloc(sizeof *file);
+    if (!file)
+        return NULL;
+
+    file->context = NULL;    // Zero-initialize
+    file->io_context = NULL;
+
+    return avbin_open_context(file, filename, format, options);
+}
+
+static int avbin_io_read(void *opaque, uint8_t *buffer, int size)
+{
+    AVbinFile *file = opaque;
+    int32_t bytes_read = file->io.read(file->io.opaque, buffer, size);
+
+    if (bytes_read == 0)
+        return AVERROR_EOF;
+    return bytes_read;
+}
+
+static int64_t avbin_io_seek(void *opaque, int64_t offset, int whence)
+{
+    AVbinFile *file = opaque;
+
+    if (whence & AVSEEK_SIZE)
+        return file->io.size ? file->io.size(file->io.opaque) : -1;
+
+    if (!file->io.seek)
+        return -1;
+
+    return file->io.seek(file->io.opaque, offset, whence & ~AVSEEK_FORCE);
+}
+
+/**
+ * Open file, whose io member has been filled in, through the custom I/O
+ * callbacks.  On failure file is freed.
+ */
+static AVbinFile *avbin_open_custom_io(AVbinFile *file, char *format,
+                                       AVbinOpenOptions *options)
+{
+    AVbinIOCallbacks *io = &file->io;
+    uint8_t *buffer;
+
+    file->context = avformat_alloc_context();
+    buffer = av_malloc(AVBIN_IO_BUFFER_SIZE);
+    // The size is also asked for through the seek callback
+    if (buffer)
+        file->io_context = avio_alloc_context(buffer, AVBIN_IO_BUFFER_SIZE,
+                                              0, file, avbin_io_read, NULL,
+                                              io->seek || io->size ?
+                                                  avbin_io_seek : NULL);
+    else
+        file->io_context = NULL;
+
+    if (!file->context || !file->io_context)
+    {
+        if (file->io_context)
+            av_free(file->io_context);
+        av_free(buffer);
+        if (file->context)
+            avformat_free_context(file->context);
+        free(file);
+        return NULL;
+    }
+
+    file->io_context->seekable = io->seek != NULL;
+    file->context->pb = file->io_context;
+
+    return avbin_open_context(file, "", format, options);
+}
+
+AVbinFile *avbin_open_io(AVbinIOCallbacks *io, char *format)
+{
+    return avbin_open_io_with_options(io, format, NULL);
+}
+
+AVbinFile *avbin_open_io_with_options(AVbinIOCallbacks *io, char *format,
+                                      AVbinOpenOptions *options)
+{
+    AVbinFile *file;
+
+    if (io->structure_size < sizeof *io || !io->read)
+        return NULL;
+
+    if (!avbin_valid_open_options(options))
+        return NULL;
+
+    file = malloc(sizeof *file);
+    if (!file)
+        return NULL;
+
+    file->io = *io;
+    return avbin_open_custom_io(file, format, options);
+}
+
+static int32_t avbin_memory_read(void *opaque, uint8_t *buffer, int32_t size)
+{
+    AVbinMemoryReader *memory = opaque;
+    size_t remaining = memory->size - memory->position;
+
+    if ((size_t) size > remaining)
+        size = remaining;
+
+    memcpy(buffer, memory->data + memory->position, size);
+    memory->position += size;
+    return size;
+}
+
+static int64_t avbin_memory_seek(void *opaque, int64_t offset, int32_t whence)
+{
+    AVbinMemoryReader *memory = opaque;
+
+    switch (whence)
+    {
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += memory->position;
+            break;
+        case SEEK_END:
+            offset += memory->size;
+            break;
+        default:
+            return -1;
+    }
+
+    if (offset < 0 || offset > memory->size)
+        return -1;
+
+    memory->position = offset;
+    return offset;
+}
+
+static int64_t avbin_memory_size(void *opaque)
+{
+    AVbinMemoryReader *memory = opaque;
+    return memory->size;
+}
+
+AVbinFile *avbin_open_memory(const uint8_t *data, size_t size, char *format)
+{
+    AVbinFile *file = malloc(sizeof *file);
+    if (!file)
+        return NULL;
+
+    file->memory.data = data;
+    file->memory.size = size;
+    file->memory.position = 0;
+
+    file->io.structure_size = sizeof file->io;
+    file->io.opaque = &file->memory;
+    file->io.read = avbin_memory_read;
+    file->io.seek = avbin_memory_seek;
+    file->io.size = avbin_memory_size;
+
+    return avbin_open_custom_io(file, format, NULL);
+}
+
+void avbin_close_file(AVbinFile *file)
+{
+    avbin_stop_pipeline(file);
+    avbin_flush_backlog(file);
+
+    if (file->packet)
+    {
+        av_free_packet(file->packet);
+        free(file->packet);
+    }
+
+    avformat_close_input(&file->context);
+
+    // Custom I/O contexts are not freed by avformat_close_input
+    if (file->io_context)
+    {
+        av_free(file->io_context->buffer);
+        av_free(file->io_context);
+    }
+    free(file->streams);
+    free(file->selection);
+    free(file->index);
+    free(file->filename);
+    avbin_packet_pool_unref(file->packet_pool);
+    free(file);
+}
+
+/**
+ * @name Keyframe index
+ *
+ * Once asked for, keyframe positions of one stream are recorded as packets
+ * are demuxed, so that seeks within the part of the file already read can
+ * jump straight to a byte offset rather than have the demuxer search for
+ * the timestamp.  Byte seeking loses track of per-stream state in some
+ * demuxers, so this is left to applications that opt in for containers
+ * that need it.
+ */
+/*@{*/
+
+/**
+ * The stream to index: the first video stream, or failing that the first
+ * audio stream.
+ */
+static int32_t avbin_pick_index_stream(AVbinFile *file)
+{
+    int32_t audio = -1;
+    int i;
+
+    for (i = 0; i < file->context->nb_streams; i++)
+    {
+        switch (file->context->streams[i]->codec->codec_type)
+        {
+            case AVMEDIA_TYPE_VIDEO:
+                return i;
+            case AVMEDIA_TYPE_AUDIO:
+                if (audio < 0)
+                    audio = i;
+                break;
+            default:
+                break;
+        }
+    }
+    return audio;
+}
+
+/**
+ * Index of the last entry at or before timestamp, or -1.
+ */
+static int32_t avbin_index_find(AVbinFile *file, AVbinTimestamp timestamp)
+{
+    int32_t low = 0, high = file->index_count;
+
+    while (low < high)
+    {
+        int32_t middle = low + (high - low) / 2;
+        if (file->index[middle].timestamp <= timestamp)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low - 1;
+}
+
+static void avbin_index_add(AVbinFile *file, AVbinTimestamp timestamp,
+                            int64_t pos)
+{
+    AVbinIndexEntry *index;
+    int32_t i = avbin_index_find(file, timestamp);
+
+    if (i >= 0 && file->index[i].timestamp == timestamp)
+        return;
+    i++;
+
+    if (file->index_count == file->index_capacity)
+    {
+        int32_t capacity = file->index_capacity ? file->index_capacity * 2 : 256;
+        index = realloc(file->index, capacity * sizeof *index);
+        if (!index)
+            return;
+        file->index = index;
+        file->index_capacity = capacity;
+    }
+
+    memmove(file->index + i + 1, file->index + i,
+            (file->index_count - i) * sizeof *file->index);
+    file->index[i].timestamp = timestamp;
+    file->index[i].pos = pos;
+    file->index_count++;
+}
+
+/**
+ * Record packet in the index if it is a keyframe of the indexed stream.
+ */
+static void avbin_index_packet(AVbinFile *file, AVPacket *packet)
+{
+    AVStream *av_stream;
+    int64_t timestamp;
+
+    if (!file->index_enabled)
+        return;
+    if (file->index_stream < 0)
+        file->index_stream = avbin_pick_index_stream(file);
+    if (packet->stream_index != file->index_stream)
+        return;
+
+    timestamp = packet->pts;
+    if (timestamp == AV_NOPTS_VALUE)
+        timestamp = packet->dts;
+    if (timestamp == AV_NOPTS_VALUE)
+        return;
+
+    av_stream = file->context->streams[packet->stream_index];
+    timestamp = av_rescale_q(timestamp, av_stream->time_base, AV_TIME_BASE_Q);
+
+    if ((packet->flags & AV_PKT_FLAG_KEY) && packet->pos >= 0)
+        avbin_index_add(file, timestamp, packet->pos);
+
+    if (file->index_contiguous && timestamp > file->index_covered)
+        file->index_covered = timestamp;
+}
+
+/**
+ * Seek to the indexed keyframe at or before timestamp, if the index covers
+ * it.
+ *
+ * @return 0 on success, -1 if the index cannot be used.
+ */
+static int avbin_index_seek(AVbinFile *file, AVbinTimestamp timestamp)
+{
+    int32_t i;
+
+    if (!file->index_enabled || timestamp > file->index_covered ||
+        (file->context->iformat->flags & AVFMT_NO_BYTE_SEEK))
+        return -1;
+
+    i = avbin_index_find(file, timestamp);
+    if (i < 0)
+        return -1;
+
+    // Some demuxers (MP4, for one) cannot seek by byte
+    if (av_seek_frame(file->context, -1, file->index[i].pos,
+                      AVSEEK_FLAG_BYTE) < 0)
+        return -1;
+    return 0;
+}
+
+AVbinResult avbin_build_index(AVbinFile *file)
+{
+    AVPacket packet;
+    enum AVDiscard *discard;
+    int result;
+    int i;
+
+    if (file->pipeline)
+        return AVBIN_RESULT_ERROR;
+
+    if (file->index_covered == INT64_MAX)
+        return AVBIN_RESULT_OK;
+
+    avbin_ensure_stream_info(file);
+    if (file->index_stream < 0)
+        file->index_stream = avbin_pick_index_stream(file);
+    if (file->index_stream < 0)
+        return AVBIN_RESULT_ERROR;
+
+    if (av_seek_frame(file->context, -1, 0,
+                      AVSEEK_FLAG_ANY | AVSEEK_FLAG_BYTE) < 0)
+        return AVBIN_RESULT_ERROR;
+
+    // Let the demuxer skip the payload of every other stream while scanning
+    discard = malloc(file->context->nb_streams * sizeof *discard);
+    if (!discard)
+        return AVBIN_RESULT_ERROR;
+    for (i = 0; i < file->context->nb_streams; i++)
+    {
+        discard[i] = file->context->streams[i]->discard;
+        if (i != file->index_stream)
+            file->context->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    file->index_enabled = 1;
+    file->index_contiguous = 1;
+    av_init_packet(&packet);
+    while ((result = av_read_frame(file->context, &packet)) >= 0)
+    {
+        avbin_index_packet(file, &packet);
+        av_free_packet(&packet);
+    }
+
+    /* Only a scan that reached the end covers the whole file; after a read
+     * error index_covered stays at the last keyframe indexed. */
+    if (result == AVERROR_EOF || url_feof(file->context->pb))
+        file->index_covered = INT64_MAX;
+
+    for (i = 0; i < file->context->nb_streams; i++)
+        file->context->streams[i]->discard = discard[i];
+    free(discard);
+
+    if (avbin_seek_file(file, 0) != AVBIN_RESULT_OK ||
+        file->index_covered != INT64_MAX)
+        return AVBIN_RESULT_ERROR;
+    return AVBIN_RESULT_OK;
+}
+
+/**
+ * Size and modification time of the media, to tell whether a sidecar index
+ * still describes it.  Custom I/O has no modification time.
+ */
+static int avbin_index_source(AVbinFile *file, int64_t *size, int64_t *mtime)
+{
+    struct stat info;
+
+    if (file->filename)
+    {
+        if (stat(file->filename, &info) != 0)
+            return -1;
+        *size = info.st_size;
+        *mtime = info.st_mtime;
+        return 0;
+    }
+
+    *size = avio_size(file->context->pb);
+    *mtime = 0;
+    return *size < 0 ? -1 : 0;
+}
+
+static void avbin_put_le32(uint8_t *p, uint32_t value)
+{
+    int i;
+    for (i = 0; i < 4; i++)
+        p[i] = value >> (8 * i);
+}
+
+static void avbin_put_le64(uint8_t *p, uint64_t value)
+{
+    int i;
+    for (i = 0; i < 8; i++)
+        p[i] = value >> (8 * i);
+}
+
+static uint32_t avbin_get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint64_t avbin_get_le64(const uint8_t *p)
+{
+    return avbin_get_le32(p) | (uint64_t) avbin_get_le32(p + 4) << 32;
+}
+
+AVbinResult avbin_save_index(AVbinFile *file, const char *path)
+{
+    uint8_t header[AVBIN_INDEX_HEADER_SIZE];
+    uint8_t entry[AVBIN_INDEX_ENTRY_SIZE];
+    int64_t size, mtime;
+    FILE *out;
+    int32_t i;
+
+    if (file->pipeline || file->index_stream < 0)
+        return AVBIN_RESULT_ERROR;
+
+    if (avbin_index_source(file, &size, &mtime) < 0)
+        return AVBIN_RESULT_ERROR;
+
+    memcpy(header, AVBIN_INDEX_MAGIC, 4);
+    avbin_put_le32(header + 4, AVBIN_INDEX_VERSION);
+    avbin_put_le64(header + 8, size);
+    avbin_put_le64(header + 16, mtime);
+    avbin_put_le32(header + 24, file->index_stream);
+    avbin_put_le32(header + 28, file->index_count);
+    avbin_put_le64(header + 32, file->index_covered);
+
+    out = fopen(path, "wb");
+    if (!out)
+        return AVBIN_RESULT_ERROR;
+
+    if (fwrite(header, sizeof header, 1, out) != 1)
+        goto error;
+
+    for (i = 0; i < file->index_count; i++)
+    {
+        avbin_put_le64(entry, file->index[i].timestamp);
+        avbin_put_le64(entry + 8, file->index[i].pos);
+        if (fwrite(entry, sizeof entry, 1, out) != 1)
+            goto error;
+    }
+
+    if (fclose(out) != 0)
+        return AVBIN_RESULT_ERROR;
+    return AVBIN_RESULT_OK;
+
+error:
+    fclose(out);
+    return AVBIN_RESULT_ERROR;
+}
+
+AVbinResult avbin_load_index(AVbinFile *file, const char *path)
+{
+    uint8_t header[AVBIN_INDEX_HEADER_SIZE];
+    uint8_t entry[AVBIN_INDEX_ENTRY_SIZE];
+    int64_t size, mtime;
+    AVbinIndexEntry *index = NULL;
+    uint32_t count, i;
+    int32_t stream_index;
+    FILE *in;
+
+    if (file->pipeline)
+        return AVBIN_RESULT_ERROR;
+
+    if (avbin_index_source(file, &size, &mtime) < 0)
+        return AVBIN_RESULT_ERROR;
+
+    in = fopen(path, "rb");
+    if (!in)
+        return AVBIN_RESULT_ERROR;
+
+    if (fread(header, sizeof header, 1, in) != 1 ||
+        memcmp(header, AVBIN_INDEX_MAGIC, 4) != 0 ||
+        avbin_get_le32(header + 4) != AVBIN_INDEX_VERSION ||
+        (int64_t) avbin_get_le64(header + 8) != size ||
+        (int64_t) avbin_get_le64(header + 16) != mtime)
+        goto error;
+
+    stream_index = avbin_get_le32(header + 24);
+    count = avbin_get_le32(header + 28);
+    if (stream_index < 0 || stream_index >= file->context->nb_streams ||
+        count > INT32_MAX / sizeof *index)
+        goto error;
+
+    index = malloc((count ? count : 1) * sizeof *index);
+    if (!index)
+        goto error;
+
+    for (i = 0; i < count; i++)
+    {
+        if (fread(entry, sizeof entry, 1, in) != 1)
+            goto error;
+        index[i].timestamp = avbin_get_le64(entry);
+        index[i].pos = avbin_get_le64(entry + 8);
+        if (i > 0 && index[i].timestamp <= index[i - 1].timestamp)
+            goto error;
+    }
+    fclose(in);
+
+    free(file->index);
+    file->index = index;
+    file->index_count = count;
+    file->index_capacity = count ? count : 1;
+    file->index_stream = stream_index;
+    file->index_covered = avbin_get_le64(header + 32);
+    file->index_enabled = 1;
+    return AVBIN_RESULT_OK;
+
+error:
+    free(index);
+    fclose(in);
+    return AVBIN_RESULT_ERROR;
+}
+
+/*@}*/
+
+/**
+ * Seek to the keyframe at or before timestamp.  With accurate set, every
+ * open stream then drops what it decodes before timestamp.
+ */
+static AVbinResult avbin_seek(AVbinFile *file, AVbinTimestamp timestamp,
+                              int accurate)
+{
+    int i;
+    AVCodecContext *codec_context;
+    int flags = 0;
+    AVbinPipelineOptions pipeline_options;
+    int restart_pipeline = 0;
+
+    // Read-ahead is useless after a seek; start it again from the new position
+    if (file->pipeline)
+    {
+        pipeline_options = *avbin_pipeline_options(file->pipeline);
+        avbin_stop_pipeline(file);
+        restart_pipeline = 1;
+    }
+
+    if (!timestamp)
+    {
+        flags = AVSEEK_FLAG_ANY | AVSEEK_FLAG_BYTE;
+        if (av_seek_frame(file->context, -1, 0, flags) < 0)
+            goto error;
+        file->index_contiguous = 1;
+    }
+    else if (avbin_index_seek(file, timestamp) == 0)
+        file->index_contiguous = 1;
+    else
+    {
+        flags = AVSEEK_FLAG_BACKWARD;
+        if (av_seek_frame(file->context, -1, timestamp, flags) < 0)
+            goto error;
+        file->index_contiguous = 0;
+    }
+
+    for (i = 0; i < file->context->nb_streams; i++)
+    {
+        codec_context = file->context->streams[i]->codec;
+        if (codec_context && codec_context->codec)
+            avcodec_flush_buffers(codec_context);
+    }
+
+    avbin_flush_backlog(file);
+    for (i = 0; i < file->n_streams; i++)
+    {
+        if (!file->streams[i])
+            continue;
+        avbin_reset_batch(file->streams[i]);
+        file->streams[i]->seek_target = accurate ? timestamp : AV_NOPTS_VALUE;
+        // Don't place the first frame after the seek by the old position
+        file->streams[i]->next_timestamp = AV_NOPTS_VALUE;
+        file->streams[i]->last_pts = AV_NOPTS_VALUE;
+        file->streams[i]->last_dts = AV_NOPTS_VALUE;
+        // The flush above has already taken back any held frame
+        file->streams[i]->frame_held = 0;
+        // Samples buffered in the resampler belong to the old position
+        avresample_free(&file->streams[i]->resample_context);
+    }
+
+    if (restart_pipeline)
+        return avbin_start_pipeline(file, &pipeline_options);
+    return AVBIN_RESULT_OK;
+
+error:
+    if (restart_pipeline)
+        avbin_start_pipeline(file, &pipeline_options);
+    return AVBIN_RESULT_ERROR;
+}
+
+AVbinResult avbin_seek_file(AVbinFile *file, AVbinTimestamp timestamp)
+{
+    return avbin_seek(file, timestamp, 0);
+}
+
+AVbinResult avbin_seek_file_accurate(AVbinFile *file,
+                                     AVbinTimestamp timestamp)
+{
+    return avbin_seek(file, timestamp, 1);
+}
+
+AVbinResult avbin_file_info(AVbinFile *file, AVbinFileInfo *info)
+{
+    if (info->structure_size < sizeof *info)
+        return AVBIN_RESULT_ERROR;
+
+    // The probe may find more streams, and a duration the header lacked
+    avbin_ensure_stream_info(file);
+
+    info->n_streams = file->context->nb_streams;
+    info->start_time = file->context->start_time;
+    info->duration = file->context->duration;
+
+    // Zero-initialize fields first
+    memset(info->title, 0, sizeof(info->title));
+    memset(info->author, 0, sizeof(info->author));
+    memset(info->copyright, 0, sizeof(info->copyright));
+    memset(info->comment, 0, sizeof(info->comment));
+    memset(info->album, 0, sizeof(info->album));
+    memset(info->genre, 0, sizeof(info->genre));
+    info->year = 0;
+    info->track = 0;
+
+    AVDictionaryEntry* entry;
+    if ((entry = av_dict_get(file->context->metadata, "title", NULL, 0)) != NULL)  {
+      strncpy(info->title, entry->value, sizeof(info->title));
+    }
+
+    if (((entry = av_dict_get(file->context->metadata, "artist", NULL, 0)) != NULL) ||
+       (entry = av_dict_get(file->context->metadata, "album_artist", NULL, 0)) != NULL) {
+      strncpy(info->author, entry->value, sizeof(info->author));
+    }
+    if ((entry = av_dict_get(file->context->metadata, "copyright", NULL, 0)) != NULL)  {
+      strncpy(info->copyright, entry->value, sizeof(info->copyright));
+    }
+    if ((entry = av_dict_get(file->context->metadata, "comment", NULL, 0)) != NULL)  {
+      strncpy(info->comment, entry->value, sizeof(info->comment));
+    }
+    if ((entry = av_dict_get(file->context->metadata, "album", NULL, 0)) != NULL)  {
+      strncpy(info->album, entry->value, sizeof(info->album));
+    }
+    if ((entry = av_dict_get(file->context->metadata, "date", NULL, 0)) != NULL)  {
+      info->year = atoi(entry->value);
+    }
+    if ((entry = av_dict_get(file->context->metadata, "track", NULL, 0)) != NULL)  {
+      info->track = atoi(entry->value);
+    }
+    if ((entry = av_dict_get(file->context->metadata, "genre", NULL, 0)) != NULL)  {
+      strncpy(info->genre, entry->value, sizeof(info->genre));
+    }
+
+    return AVBIN_RESULT_OK;
+}
+
+/**
+ * The interleaved format avbin_decode_audio() produces by default for a given
+ * decoder format.  Doubles are narrowed to floats, since AVbin has no double
+ * sample format.
+ */
+static enum AVSampleFormat avbin_packed_sample_fmt(enum AVSampleFormat fmt)
+{
+    fmt = av_get_packed_sample_fmt(fmt);
+    if (fmt == AV_SAMPLE_FMT_DBL)
+        fmt = AV_SAMPLE_FMT_FLT;
+    return fmt;
+}
+
+static AVbinSampleFormat avbin_sample_format(enum AVSampleFormat fmt)
+{
+    switch (av_get_packed_sample_fmt(fmt))
+    {
+        case AV_SAMPLE_FMT_U8:
+            return AVBIN_SAMPLE_FORMAT_U8;
+        case AV_SAMPLE_FMT_S16:
+            return AVBIN_SAMPLE_FORMAT_S16;
+        case AV_SAMPLE_FMT_S32:
+            return AVBIN_SAMPLE_FORMAT_S32;
+        case AV_SAMPLE_FMT_FLT:
+            return AVBIN_SAMPLE_FORMAT_FLOAT;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Run the stream probe deferred by AVBIN_STREAM_INFO_LAZY, if it has not
+ * been run yet.  A failed probe is not fatal here; the streams keep what
+ * the container header said about them.
+ */
+static void avbin_ensure_stream_info(AVbinFile *file)
+{
+    if (!file->stream_info_pending)
+        return;
+
+    file->stream_info_pending = 0;
+    if (avformat_find_stream_info(file->context, NULL) < 0)
+        av_log(file->context, AV_LOG_WARNING,
+               "Could not find stream information\n");
+
+    // The probe may have found streams that should be discarded
+    avbin_update_discard(file);
+}
+
+AVbinResult avbin_stream_info(AVbinFile *file, int32_t stream_index,
+                      AVbinStreamInfo *info)
+{
+    AVCodecContext *context;
+    AVbinStreamInfo8 *info_8 = NULL;
+    AVbinStream *stream;
+    enum AVSampleFormat sample_fmt;
+    int width, height;
+
+    /* Error if not large enough for version 1 */
+    if (info->structure_size < sizeof *info)
+        return AVBIN_RESULT_ERROR;
+
+    avbin_ensure_stream_info(file);
+    if (stream_index < 0 || stream_index >= file->context->nb_streams)
+        return AVBIN_RESULT_ERROR;
+    context = file->context->streams[stream_index]->codec;
+
+    /* Version 8 adds frame_rate feature, Version 11 removes it, see note on
+       avbin_have_feature() in avbin.h */
+    if (info->structure_size >= sizeof(AVbinStreamInfo8))
+        info_8 = (AVbinStreamInfo8 *) info;
+
+    switch (context->codec_type)
+    {
+        case AVMEDIA_TYPE_VIDEO:
+            info->type = AVBIN_STREAM_TYPE_VIDEO;
+            // Describe what avbin_decode_video() writes
+            stream = avbin_file_stream(file, stream_index);
+            if (stream)
+            {
+                avbin_get_output_dimensions(stream, &width, &height);
+                info->video.width = width;
+                info->video.height = height;
+            }
+            else
+            {
+                info->video.width = context->width;
+                info->video.height = context->height;
+            }
+            info->video.sample_aspect_num = context->sample_aspect_ratio.num;
+            info->video.sample_aspect_den = context->sample_aspect_ratio.den;
+
+/* See note on avbin_have_feature() in avbin.h
+            if (info_8)
+            {
+                AVRational frame_rate = \
+                    file->context->streams[stream_index]->r_frame_rate;
+                info_8->video.frame_rate_num = frame_rate.num;
+                info_8->video.frame_rate_den = frame_rate.den;
+
+                // Work around bug in Libav: if frame rate over 1000, divide
+                // by 1000.
+                if (info_8->video.frame_rate_num /
+                        info_8->video.frame_rate_den > 1000)
+                    info_8->video.frame_rate_den *= 1000;
+            }
+*/
+            if (info_8)
+            {
+                info_8->video.frame_rate_num = 0;
+                info_8->video.frame_rate_den = 0;
+            }
+            break;
+        case AVMEDIA_TYPE_AUDIO:
+            info->type = AVBIN_STREAM_TYPE_AUDIO;
+            // Describe what avbin_decode_audio() writes
+            stream = avbin_file_stream(file, stream_index);
+            if (stream)
+            {
+                info->audio.sample_rate = avbin_output_sample_rate(stream);
+                info->audio.channels = avbin_output_channels(stream);
+                sample_fmt = avbin_output_sample_fmt(stream);
+            }
+            else
+            {
+                info->audio.sample_rate = context->sample_rate;
+                info->audio.channels = context->channels;
+                // Planar audio is interleaved by avbin_decode_audio()
+                sample_fmt = avbin_packed_sample_fmt(context->sample_fmt);
+            }
+            switch (sample_fmt)
+            {
+                case AV_SAMPLE_FMT_U8:
+                    info->audio.sample_format = AVBIN_SAMPLE_FORMAT_U8;
+                    info->audio.sample_bits = 8;
+                    break;
+                case AV_SAMPLE_FMT_S16:
+                    info->audio.sample_format = AVBIN_SAMPLE_FORMAT_S16;
+                    info->audio.sample_bits = 16;
+                    break;
+                case AV_SAMPLE_FMT_S32:
+                    info->audio.sample_format = AVBIN_SAMPLE_FORMAT_S32;
+                    info->audio.sample_bits = 32;
+                    break;
+                case AV_SAMPLE_FMT_FLT:
+                    info->audio.sample_format = AVBIN_SAMPLE_FORMAT_FLOAT;
+                    info->audio.sample_bits = 32;
+                    break;
+                default:
+                  // Unknown sample format
+                  info->audio.sample_format = -1;
+                  info->audio.sample_bits = -1;
+                  break;
+            }
+            break;
+
+        default:
+            info->type = AVBIN_STREAM_TYPE_UNKNOWN;
+            break;
+    }
+
+    return AVBIN_RESULT_OK;
+}
+
+AVbinStream *avbin_open_stream(AVbinFile *file, int32_t index)
+{
+    return avbin_open_stream_with_options(file, index, NULL);
+}
+
+AVbinStream *avbin_open_stream_with_options(AVbinFile *file, int32_t index,
+                                            AVbinStreamOptions *options)
+{
+    AVCodecContext *codec_context;
+    AVCodec *codec;
+    int32_t thread_count = avbin_thread_count;
+
+    avbin_ensure_stream_info(file);
+
+    if (index < 0 || index >= file->context->nb_streams)
+        return NULL;
+
+    if (options && options->structure_size < sizeof *options)
+        return NULL;
+
+    codec_context = file->context->streams[index]->codec;
+    codec = avcodec_find_decoder(codec_context->codec_id);
+    if (!codec)
+        return NULL;
+
+    /* The Libav api example does this (see libav/libavcodec-api-example.c).
+     * The only explanation is "we do not send complete frames".  I tried
+     * adding it, and there seemed to be no effect either way.  I'm going to
+     * leave it here commented out just in case we find the need to enable it
+     * in the future.
+     */
+/*    if (codec->capabilities & CODEC_CAP_TRUNCATED)
+ *       codec_context->flags |= CODEC_FLAG_TRUNCATED;
+ */
+    if (options)
+    {
+        if (options->thread_count >= 0)
+            thread_count = options->thread_count;
+
+        if (options->lowres < 0 || options->lowres > 3)
+            return NULL;
+
+        switch (options->thread_type)
+        {
+            case AVBIN_THREAD_TYPE_FRAME:
+                codec_context->thread_type = FF_THREAD_FRAME;
+                break;
+            case AVBIN_THREAD_TYPE_SLICE:
+                codec_context->thread_type = FF_THREAD_SLICE;
+                break;
+            default:
+                codec_context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+                break;
+        }
+    }
+
+    // Streams may appear after the file is opened, so grow as needed
+    if (index >= file->n_streams)
+    {
+        AVbinStream **streams = realloc(file->streams,
+                                        (index + 1) * sizeof *streams);
+        if (!streams)
+            return NULL;
+        memset(streams + file->n_streams, 0,
+               (index + 1 - file->n_streams) * sizeof *streams);
+        file->streams = streams;
+        file->n_streams = index + 1;
+    }
+
+    // Saves avbin_set_lowres() from reopening the decoder
+    codec_context->lowres = 0;
+    if (options && codec_context->codec_type == AVMEDIA_TYPE_VIDEO)
+        codec_context->lowres = FFMIN(options->lowres, codec->max_lowres);
+
+    // Saves avbin_set_buffer_provider() from reopening the decoder
+    if (options && options->buffer_provider &&
+        options->buffer_provider->get_buffer)
+        codec_context->flags |= CODEC_FLAG_EMU_EDGE;
+
+    thread_count = avbin_reserve_threads(thread_count);
+    codec_context->thread_count = thread_count;
+
+    if (avcodec_open2(codec_context, codec, NULL) < 0)
+    {
+        avbin_release_threads(thread_count);
+        return NULL;
+    }
+
+    AVbinStream *stream = malloc(sizeof *stream);
+    stream->index = index;
+    stream->file = file;
+    stream->format_context = file->context;
+    stream->codec_context = codec_context;
+    stream->type = codec_context->codec_type;
+    stream->frame = avcodec_alloc_frame();
+    memset(&stream->stats, 0, sizeof stream->stats);
+    stream->input_buffer = NULL;
+    stream->input_buffer_size = 0;
+    stream->sws_context = NULL;
+    stream->output_pix_fmt = PIX_FMT_RGB24;
+    stream->output_width = 0;
+    stream->output_height = 0;
+    stream->video_output_width = 0;
+    stream->video_output_height = 0;
+    stream->sws_flags = SWS_FAST_BILINEAR;
+    stream->frame_held = 0;
+    stream->output_sample_fmt = AV_SAMPLE_FMT_NONE;
+    stream->output_sample_rate = 0;
+    stream->output_channels = 0;
+    stream->output_channel_layout = 0;
+    stream->resample_context = NULL;
+    stream->thread_count = thread_count;
+    stream->queue = NULL;
+    stream->batch_packet = NULL;
+    stream->batch_frame_pending = 0;
+    stream->batch_draining = 0;
+    stream->batch_finished = 0;
+    stream->leftover = NULL;
+    stream->leftover_size = 0;
+    stream->leftover_first = 0;
+    stream->leftover_samples = 0;
+    stream->seek_target = AV_NOPTS_VALUE;
+    stream->frame_offset = 0;
+    stream->frame_timestamp = AV_NOPTS_VALUE;
+    stream->frame_duration = 0;
+    stream->next_timestamp = AV_NOPTS_VALUE;
+    stream->last_pts = AV_NOPTS_VALUE;
+    stream->last_dts = AV_NOPTS_VALUE;
+    stream->pts_faults = 0;
+    stream->dts_faults = 0;
+    stream->output_timestamp = AV_NOPTS_VALUE;
+    stream->output_duration = 0;
+    stream->trimmed_planes = NULL;
+    stream->trimmed_planes_size = 0;
+    stream->skip_frame = codec_context->skip_frame;
+    stream->quality = AVBIN_QUALITY_FULL;
+    stream->current_quality = AVBIN_QUALITY_FULL;
+    stream->late_frames = 0;
+    stream->early_frames = 0;
+    stream->thumbnail = 0;
+    stream->lowres = codec_context->lowres;
+    stream->output_lowres = options && stream->type == AVMEDIA_TYPE_VIDEO ?
+        options->lowres : 0;
+    memset(&stream->provider, 0, sizeof stream->provider);
+
+    file->streams[index] = stream;
+    avbin_update_discard(file);
+
+    if (options && options->audio_output &&
+        stream->type == AVMEDIA_TYPE_AUDIO &&
+        avbin_set_audio_output(stream, options->audio_output) !=
+            AVBIN_RESULT_OK)
+    {
+        avbin_close_stream(stream);
+        return NULL;
+    }
+
+    if (options && options->buffer_provider &&
+        stream->type == AVMEDIA_TYPE_VIDEO &&
+        avbin_set_buffer_provider(stream, options->buffer_provider) !=
+            AVBIN_RESULT_OK)
+    {
+        avbin_close_stream(stream);
+        return NULL;
+    }
+
+    return stream;
+}
+
+void avbin_close_stream(AVbinStream *stream)
+{
+    AVbinFile *file = stream->file;
+
+    // The pipeline's threads may be using this stream
+    if (stream->queue)
+        avbin_pipeline_remove_stream(stream);
+    if (file->streams[stream->index] == stream)
+        file->streams[stream->index] = NULL;
+    avbin_update_discard(file);
+    avbin_reset_batch(stream);
+
+    if (stream->frame)
+        avcodec_free_frame(&stream->frame);
+    av_free(stream->input_buffer);
+    av_free(stream->trimmed_planes);
+    av_free(stream->leftover);
+    avresample_free(&stream->resample_context);
+    if (stream->sws_context)
+        sws_freeContext(stream->sws_context);
+    avcodec_close(stream->codec_context);
+    // The codec context outlives the stream; don't leave it pointing here
+    stream->codec_context->get_buffer = avcodec_default_get_buffer;
+    stream->codec_context->release_buffer = avcodec_default_release_buffer;
+    stream->codec_context->opaque = NULL;
+    avbin_release_threads(stream->thread_count);
+    free(stream);
+}
+
+/**
+ * The open stream with the given index, or NULL.
+ */
+static AVbinStream *avbin_file_stream(AVbinFile *file, int32_t index)
+{
+    if (index < 0 || index >= file->n_streams)
+        return NULL;
+    return file->streams[index];
+}
+
+/**
+ * Fill in the application's view of packet.
+ */
+static void avbin_fill_packet(AVbinFile *file, AVPacket *av_packet,
+                              AVbinPacket *packet)
+{
+    packet->timestamp = av_packet->dts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE :
+        av_rescale_q(av_packet->dts,
+                     file->context->streams[av_packet->stream_index]->time_base,
+                     AV_TIME_BASE_Q);
+    packet->stream_index = av_packet->stream_index;
+    packet->data = av_packet->data;
+    packet->size = av_packet->size;
+}
+
+/**
+ * Demux the next packet into a new packet from the file's pool.
+ */
+static AVbinPacketRef *avbin_demux_packet(AVbinFile *file)
+{
+    AVbinPacketRef *ref = avbin_packet_alloc(file->packet_pool);
+
+    if (!ref)
+        return NULL;
+
+    int64_t start = avbin_monotonic_time();
+    AVbinStream *stream;
+
+    /* Packets that point into demuxer-owned memory are not guaranteed to be
+     * padded.  Give those their own padded buffer so that the data we hand
+     * out can be passed to the decoder as-is.  This is a no-op for packets
+     * that already own their (padded) data, which is the common case.
+     */
+    if (av_read_frame(file->context, &ref->packet) < 0 ||
+        av_dup_packet(&ref->packet) < 0)
+    {
+        avbin_release_packet(ref);
+        return NULL;
+    }
+
+    avbin_stats_time(file, NULL, AVBIN_STAT(demux), start);
+    __sync_fetch_and_add(&file->stats.packets, 1);
+    __sync_fetch_and_add(&file->stats.bytes, ref->packet.size);
+    stream = avbin_file_stream(file, ref->packet.stream_index);
+    if (stream)
+    {
+        __sync_fetch_and_add(&stream->stats.packets, 1);
+        __sync_fetch_and_add(&stream->stats.bytes, ref->packet.size);
+    }
+
+    avbin_index_packet(file, &ref->packet);
+    return ref;
+}
+
+/**
+ * Take the next packet of the file: the oldest in the backlog, or else a
+ * newly demuxed one.
+ */
+static AVbinPacketRef *avbin_read_packet_ref(AVbinFile *file)
+{
+    AVbinPacketRef *ref = file->backlog_first;
+
+    if (!ref)
+        return avbin_demux_packet(file);
+
+    file->backlog_first = ref->next;
+    if (!file->backlog_first)
+        file->backlog_last = NULL;
+    file->backlog_packets--;
+    file->backlog_bytes -= ref->packet.size;
+    ref->next = NULL;
+    return ref;
+}
+
+/**
+ * Add ref to the end of the backlog, dropping the oldest packets if that
+ * takes it over its limits.
+ */
+static void avbin_backlog_packet(AVbinFile *file, AVbinPacketRef *ref)
+{
+    if (file->backlog_last)
+        file->backlog_last->next = ref;
+    else
+        file->backlog_first = ref;
+    file->backlog_last = ref;
+    file->backlog_packets++;
+    file->backlog_bytes += ref->packet.size;
+
+    while (file->backlog_packets > AVBIN_BACKLOG_MAX_PACKETS ||
+           file->backlog_bytes > AVBIN_BACKLOG_MAX_BYTES)
+    {
+        av_log(file->context, AV_LOG_WARNING,
+               "Dropping packets of a stream that is not being read\n");
+        avbin_release_packet(avbin_read_packet_ref(file));
+    }
+}
+
+/**
+ * Take the next packet belonging to stream index, from the backlog if there
+ * is one there.  Packets demuxed along the way for other open streams are
+ * added to the backlog; packets for streams that are not open are dropped.
+ */
+static AVbinPacketRef *avbin_read_stream_packet(AVbinFile *file,
+                                                int32_t index)
+{
+    AVbinPacketRef *ref, *prev = NULL;
+
+    for (ref = file->backlog_first; ref; prev = ref, ref = ref->next)
+    {
+        if (ref->packet.stream_index != index)
+            continue;
+
+        if (prev)
+            prev->next = ref->next;
+        else
+            file->backlog_first = ref->next;
+        if (file->backlog_last == ref)
+            file->backlog_last = prev;
+        file->backlog_packets--;
+        file->backlog_bytes -= ref->packet.size;
+        ref->next = NULL;
+        return ref;
+    }
+
+    while ((ref = avbin_demux_packet(file)))
+    {
+        if (ref->packet.stream_index == index)
+            return ref;
+
+        // Nobody will read packets of closed or deselected streams
+        if (!avbin_file_stream(file, ref->packet.stream_index) ||
+            avbin_discarded(file, &ref->packet))
+        {
+            avbin_release_packet(ref);
+            continue;
+        }
+
+        avbin_backlog_packet(file, ref);
+    }
+
+    return NULL;
+}
+
+static void avbin_flush_backlog(AVbinFile *file)
+{
+    AVbinPacketRef *ref, *next;
+
+    for (ref = file->backlog_first; ref; ref = next)
+    {
+        next = ref->next;
+        avbin_release_packet(ref);
+    }
+    file->backlog_first = NULL;
+    file->backlog_last = NULL;
+    file->backlog_packets = 0;
+    file->backlog_bytes = 0;
+}
+
+/**
+ * Whether packet is a non-key packet of a stream in thumbnail mode, which
+ * its decoder would only discard.
+ */
+static int avbin_thumbnail_skip(AVbinFile *file, AVPacket *packet)
+{
+    AVbinStream *stream = avbin_file_stream(file, packet->stream_index);
+
+    return stream && stream->thumbnail && !(packet->flags & AV_PKT_FLAG_KEY);
+}
+
+/**
+ * Whether packet belongs to a discarded stream.  Not every demuxer honours
+ * AVStream.discard, so these can still turn up.
+ */
+static int avbin_discarded(AVbinFile *file, AVPacket *packet)
+{
+    return file->context->streams[packet->stream_index]->discard ==
+        AVDISCARD_ALL;
+}
+
+/**
+ * Take the next packet for the application, first decoding and discarding
+ * any packets that an accurate seek lets us skip without its help.
+ */
+static AVbinPacketRef *avbin_read_forward(AVbinFile *file)
+{
+    AVbinPacketRef *ref;
+
+    while ((ref = avbin_read_packet_ref(file)) &&
+           (avbin_discarded(file, &ref->packet) ||
+            avbin_thumbnail_skip(file, &ref->packet) ||
+            avbin_decode_to_target(file, &ref->packet)))
+        avbin_release_packet(ref);
+
+    return ref;
+}
+
+int32_t avbin_read(AVbinFile *file, AVbinPacket *packet)
+{
+    AVbinPacketRef *ref;
+
+    if (packet->structure_size < sizeof *packet)
+        return AVBIN_RESULT_ERROR;
+
+    // The pipeline's demuxer thread owns the file while it runs
+    if (file->pipeline)
+        return AVBIN_RESULT_ERROR;
+
+    if (file->packet)
+        av_free_packet(file->packet);
+    else
+        file->packet = malloc(sizeof *file->packet);
+
+    ref = avbin_read_forward(file);
+    if (!ref)
+        return AVBIN_RESULT_ERROR;
+
+    // Take over the packet's data; file->packet owns it until the next read
+    *file->packet = ref->packet;
+    av_init_packet(&ref->packet);
+    ref->packet.data = NULL;
+    ref->packet.size = 0;
+    avbin_release_packet(ref);
+
+    avbin_fill_packet(file, file->packet, packet);
+
+    return AVBIN_RESULT_OK;
+}
+
+AVbinPacketRef *avbin_read_ref(AVbinFile *file, AVbinPacket *packet)
+{
+    AVbinPacketRef *ref;
+
+    if (packet->structure_size < sizeof *packet)
+        return NULL;
+
+    // The pipeline's demuxer thread owns the file while it runs
+    if (file->pipeline)
+        return NULL;
+
+    ref = avbin_read_forward(file);
+    if (ref)
+    {
+        avbin_fill_packet(file, &ref->packet, packet);
+        avbin_lend_packet(ref);
+    }
+    return ref;
+}
+
+/**
+ * Build the AVPacket to decode for an AVbinPacket.  Packets from avbin_read()
+ * and avbin_read_ref() are always padded, so no copy is needed.  The
+ * decoder is given the demuxed packet's own pts and dts, so that decoded
+ * frames can be timed; only for packets AVbin does not know is the dts
+ * rebuilt from packet->timestamp.
+ */
+static void avbin_unwrap_packet(AVbinStream *stream, AVbinPacket *packet,
+                                AVPacket *av_packet)
+{
+    AVPacket *current = stream->file->packet;
+
+    av_init_packet(av_packet);
+    if (current && current->data && current->data == packet->data)
+        avbin_copy_packet_props(av_packet, current);
+    else if (!avbin_find_lent_packet(stream->file->packet_pool, packet->data,
+                                     packet->size, av_packet) &&
+             packet->timestamp != AV_NOPTS_VALUE)
+        av_packet->dts = av_rescale_q(packet->timestamp, AV_TIME_BASE_Q,
+            stream->format_context->streams[stream->index]->time_base);
+    av_packet->data = packet->data;
+    av_packet->size = packet->size;
+}
+
+/**
+ * Point packet at data_in, making sure the decoder is allowed to overread
+ * by FF_INPUT_BUFFER_PADDING_SIZE bytes.  Data that lies within the packet
+ * most recently returned by avbin_read(), or at the start of one returned
+ * by avbin_read_ref(), is already padded and is used in place; anything
+ * else is copied once into a per-stream padded buffer.
+ */
+static int avbin_prepare_packet(AVbinStream *stream, AVPacket *packet,
+                                uint8_t *data_in, size_t size_in)
+{
+    AVPacket *current = stream->file->packet;
+
+    av_init_packet(packet);
+
+    if (current && current->data &&
+        data_in >= current->data &&
+        data_in + size_in <= current->data + current->size)
+    {
+        if (data_in == current->data)
+            avbin_copy_packet_props(packet, current);
+        packet->data = data_in;
+        packet->size = size_in;
+        return 0;
+    }
+
+    // Whole packets from avbin_read_ref() are padded too
+    if (avbin_find_lent_packet(stream->file->packet_pool, data_in, size_in,
+                               packet))
+    {
+        packet->data = data_in;
+        packet->size = size_in;
+        return 0;
+    }
+
+    av_fast_malloc(&stream->input_buffer, &stream->input_buffer_size,
+                   size_in + FF_INPUT_BUFFER_PADDING_SIZE);
+    if (!stream->input_buffer)
+        return -1;
+
+    // Set the padding portion of the buffer to all zeros
+    memset(stream->input_buffer + size_in, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+    // Copy the data into the padded buffer
+    memcpy(stream->input_buffer, data_in, size_in);
+
+    packet->data = stream->input_buffer;
+    packet->size = size_in;
+    return 0;
+}
+
+/**
+ * @name Sample conversion
+ *
+ * Interleaving and format conversion of decoded audio.  The common cases
+ * (S16P->S16, FLTP->FLT and FLTP/FLT->S16) have SSE2 kernels for mono and
+ * stereo; everything else goes through a generic per-sample path.
+ */
+/*@{*/
+
+static inline int16_t avbin_float_to_s16(float sample)
+{
+    sample *= 32768.0f;
+    if (sample >= 32767.0f)
+        return 32767;
+    if (sample <= -32768.0f)
+        return -32768;
+    return (int16_t) lrintf(sample);
+}
+
+static void avbin_interleave_s16(int16_t *out, int16_t **in,
+                                 int nb_samples, int channels)
+{
+    int i = 0, c;
+
+#if defined(__SSE2__)
+    if (channels == 2)
+    {
+        for (; i + 8 <= nb_samples; i += 8)
+        {
+            __m128i l = _mm_loadu_si128((const __m128i *) (in[0] + i));
+            __m128i r = _mm_loadu_si128((const __m128i *) (in[1] + i));
+            _mm_storeu_si128((__m128i *) (out + 2 * i),
+                             _mm_unpacklo_epi16(l, r));
+            _mm_storeu_si128((__m128i *) (out + 2 * i + 8),
+                             _mm_unpackhi_epi16(l, r));
+        }
+    }
+#endif
+
+    for (; i < nb_samples; i++)
+        for (c = 0; c < channels; c++)
+            out[i * channels + c] = in[c][i];
+}
+
+/* For both FLTP and S32P.  Samples are moved as integers so that float
+ * loads and stores cannot touch the bits of S32 samples that happen to
+ * look like signalling NaNs. */
+static void avbin_interleave_32(uint32_t *out, uint32_t **in,
+                                int nb_samples, int channels)
+{
+    int i = 0, c;
+
+#if defined(__SSE2__)
+    if (channels == 2)
+    {
+        for (; i + 4 <= nb_samples; i += 4)
+        {
+            __m128i l = _mm_loadu_si128((const __m128i *) (in[0] + i));
+            __m128i r = _mm_loadu_si128((const __m128i *) (in[1] + i));
+            _mm_storeu_si128((__m128i *) (out + 2 * i),
+                             _mm_unpacklo_epi32(l, r));
+            _mm_storeu_si128((__m128i *) (out + 2 * i + 4),
+                             _mm_unpackhi_epi32(l, r));
+        }
+    }
+#endif
+
+    for (; i < nb_samples; i++)
+        for (c = 0; c < channels; c++)
+            out[i * channels + c] = in[c][i];
+}
+
+#if defined(__SSE2__)
+/* Convert 8 floats to saturated 16-bit integers. */
+static inline __m128i avbin_float8_to_s16(const float *in, __m128 scale)
+{
+    __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in), scale));
+    __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(in + 4), scale));
+    return _mm_packs_epi32(lo, hi);
+}
+#endif
+
+/* Planar (or, with channels == 1, packed) float to interleaved S16. */
+static void avbin_float_to_s16_interleave(int16_t *out, float **in,
+                                          int nb_samples, int channels)
+{
+    int i = 0, c;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(32768.0f);
+
+    if (channels == 1)
+    {
+        for (; i + 8 <= nb_samples; i += 8)
+            _mm_storeu_si128((__m128i *) (out + i),
+                             avbin_float8_to_s16(in[0] + i, scale));
+    }
+    else if (channels == 2)
+    {
+        for (; i + 8 <= nb_samples; i += 8)
+        {
+            __m128i l = avbin_float8_to_s16(in[0] + i, scale);
+            __m128i r = avbin_float8_to_s16(in[1] + i, scale);
+            _mm_storeu_si128((__m128i *) (out + 2 * i),
+                             _mm_unpacklo_epi16(l, r));
+            _mm_storeu_si128((__m128i *) (out + 2 * i + 8),
+                             _mm_unpackhi_epi16(l, r));
+        }
+    }
+#endif
+
+    for (; i < nb_samples; i++)
+        for (c = 0; c < channels; c++)
+            out[i * channels + c] = avbin_float_to_s16(in[c][i]);
+}
+
+static double avbin_read_sample(const uint8_t *p, enum AVSampleFormat fmt)
+{
+    switch (fmt)
+    {
+        case AV_SAMPLE_FMT_U8:
+            return (*p - 128) / 128.0;
+        case AV_SAMPLE_FMT_S16:
+            return *(const int16_t *) p / 32768.0;
+        case AV_SAMPLE_FMT_S32:
+            return *(const int32_t *) p / 2147483648.0;
+        case AV_SAMPLE_FMT_FLT:
+            return *(const float *) p;
+        case AV_SAMPLE_FMT_DBL:
+            return *(const double *) p;
+        default:
+            return 0.0;
+    }
+}
+
+static void avbin_write_sample(uint8_t *p, enum AVSampleFormat fmt,
+                               double sample)
+{
+    if (fmt != AV_SAMPLE_FMT_FLT)
+    {
+        if (sample > 1.0)
+            sample = 1.0;
+        else if (sample < -1.0)
+            sample = -1.0;
+    }
+
+    switch (fmt)
+    {
+        case AV_SAMPLE_FMT_U8:
+            *p = (uint8_t) FFMIN(lrint(sample * 128.0) + 128, 255);
+            break;
+        case AV_SAMPLE_FMT_S16:
+            *(int16_t *) p = (int16_t) FFMIN(lrint(sample * 32768.0), 32767);
+            break;
+        case AV_SAMPLE_FMT_S32:
+            *(int32_t *) p = (int32_t) FFMIN(llrint(sample * 2147483648.0),
+                                             2147483647LL);
+            break;
+        case AV_SAMPLE_FMT_FLT:
+            *(float *) p = (float) sample;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Write nb_samples of channels-channel audio from in (in_fmt, packed or
+ * planar) to out as interleaved out_fmt.
+ */
+static void avbin_convert_samples(uint8_t *out, enum AVSampleFormat out_fmt,
+                                  uint8_t **in, enum AVSampleFormat in_fmt,
+                                  int nb_samples, int channels)
+{
+    int planar = av_sample_fmt_is_planar(in_fmt);
+    enum AVSampleFormat in_packed = av_get_packed_sample_fmt(in_fmt);
+    int in_bps = av_get_bytes_per_sample(in_fmt);
+    int out_bps = av_get_bytes_per_sample(out_fmt);
+    int i, c;
+
+    if (in_fmt == out_fmt || (planar && channels == 1 && in_packed == out_fmt))
+    {
+        memcpy(out, in[0], nb_samples * channels * out_bps);
+        return;
+    }
+
+    if (planar && in_packed == out_fmt)
+    {
+        if (out_bps == 2)
+        {
+            avbin_interleave_s16((int16_t *) out, (int16_t **) in,
+                                 nb_samples, channels);
+            return;
+        }
+        if (out_bps == 4)
+        {
+            avbin_interleave_32((uint32_t *) out, (uint32_t **) in,
+                                nb_samples, channels);
+            return;
+        }
+    }
+
+    if (in_packed == AV_SAMPLE_FMT_FLT && out_fmt == AV_SAMPLE_FMT_S16)
+    {
+        if (planar)
+            avbin_float_to_s16_interleave((int16_t *) out, (float **) in,
+                                          nb_samples, channels);
+        else
+            avbin_float_to_s16_interleave((int16_t *) out, (float **) in,
+                                          nb_samples * channels, 1);
+        return;
+    }
+
+    for (i = 0; i < nb_samples; i++)
+    {
+        for (c = 0; c < channels; c++)
+        {
+            const uint8_t *p = planar ? in[c] + i * in_bps :
+                                        in[0] + (i * channels + c) * in_bps;
+            avbin_write_sample(out + (i * channels + c) * out_bps, out_fmt,
+                               avbin_read_sample(p, in_packed));
+        }
+    }
+}
+/*@}*/
+
+/**
+ * Number of samples per channel of the most recently decoded audio frame,
+ * not counting any trimmed by an accurate seek.
+ */
+static int avbin_audio_samples(AVbinStream *stream)
+{
+    return stream->frame->nb_samples - stream->frame_offset;
+}
+
+/**
+ * Plane pointers of the most recently decoded audio frame, past any samples
+ * trimmed by an accurate seek.
+ */
+static uint8_t **avbin_audio_planes(AVbinStream *stream)
+{
+    AVCodecContext *codec_context = stream->codec_context;
+    int planar = av_sample_fmt_is_planar(codec_context->sample_fmt);
+    int planes = planar ? codec_context->channels : 1;
+    int offset;
+    int i;
+
+    if (!stream->frame_offset)
+        return stream->frame->extended_data;
+
+    av_fast_malloc(&stream->trimmed_planes, &stream->trimmed_planes_size,
+                   planes * sizeof *stream->trimmed_planes);
+    if (!stream->trimmed_planes)
+    {
+        // Better untrimmed than nothing
+        stream->frame_offset = 0;
+        return stream->frame->extended_data;
+    }
+
+    offset = stream->frame_offset *
+        av_get_bytes_per_sample(codec_context->sample_fmt) *
+        (planar ? 1 : codec_context->channels);
+    for (i = 0; i < planes; i++)
+        stream->trimmed_planes[i] = stream->frame->extended_data[i] + offset;
+    return stream->trimmed_planes;
+}
+
+static enum AVSampleFormat avbin_output_sample_fmt(AVbinStream *stream)
+{
+    if (stream->output_sample_fmt != AV_SAMPLE_FMT_NONE)
+        return stream->output_sample_fmt;
+    return avbin_packed_sample_fmt(stream->codec_context->sample_fmt);
+}
+
+static int avbin_output_sample_rate(AVbinStream *stream)
+{
+    if (stream->output_sample_rate)
+        return stream->output_sample_rate;
+    return stream->codec_context->sample_rate;
+}
+
+static int avbin_output_channels(AVbinStream *stream)
+{
+    if (stream->output_channel_layout)
+        return av_get_channel_layout_nb_channels(stream->output_channel_layout);
+    if (stream->output_channels)
+        return stream->output_channels;
+    return stream->codec_context->channels;
+}
+
+static uint64_t avbin_input_channel_layout(AVbinStream *stream)
+{
+    AVCodecContext *codec_context = stream->codec_context;
+
+    if (codec_context->channel_layout &&
+        av_get_channel_layout_nb_channels(codec_context->channel_layout) ==
+            codec_context->channels)
+        return codec_context->channel_layout;
+    return av_get_default_channel_layout(codec_context->channels);
+}
+
+static uint64_t avbin_output_channel_layout(AVbinStream *stream)
+{
+    if (stream->output_channel_layout)
+        return stream->output_channel_layout;
+    // The same number of channels is passed through as it is
+    if (avbin_output_channels(stream) == stream->codec_context->channels)
+        return avbin_input_channel_layout(stream);
+    return av_get_default_channel_layout(avbin_output_channels(stream));
+}
+
+static int avbin_resampling(AVbinStream *stream)
+{
+    return avbin_output_sample_rate(stream) !=
+               stream->codec_context->sample_rate ||
+           avbin_output_channel_layout(stream) !=
+               avbin_input_channel_layout(stream);
+}
+
+/**
+ * Make sure the stream's resampler matches the decoder's current output,
+ * (re)opening it if not.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int avbin_setup_resampler(AVbinStream *stream)
+{
+    AVCodecContext *codec_context = stream->codec_context;
+    AVAudioResampleContext *context = stream->resample_context;
+    uint64_t in_layout = avbin_input_channel_layout(stream);
+
+    if (context &&
+        stream->resample_in_fmt == codec_context->sample_fmt &&
+        stream->resample_in_layout == in_layout &&
+        stream->resample_in_rate == codec_context->sample_rate)
+        return 0;
+
+    avresample_free(&stream->resample_context);
+    context = avresample_alloc_context();
+    if (!context)
+        return -1;
+
+    av_opt_set_int(context, "in_channel_layout", in_layout, 0);
+    av_opt_set_int(context, "in_sample_fmt", codec_context->sample_fmt, 0);
+    av_opt_set_int(context, "in_sample_rate", codec_context->sample_rate, 0);
+    av_opt_set_int(context, "out_channel_layout",
+                   avbin_output_channel_layout(stream), 0);
+    av_opt_set_int(context, "out_sample_fmt", avbin_output_sample_fmt(stream),
+                   0);
+    av_opt_set_int(context, "out_sample_rate", avbin_output_sample_rate(stream),
+                   0);
+    // Twice the default filter length, for a flatter passband
+    av_opt_set_int(context, "filter_size", 32, 0);
+
+    if (avresample_open(context) < 0)
+    {
+        avresample_free(&context);
+        return -1;
+    }
+
+    stream->resample_context = context;
+    stream->resample_in_fmt = codec_context->sample_fmt;
+    stream->resample_in_layout = in_layout;
+    stream->resample_in_rate = codec_context->sample_rate;
+    return 0;
+}
+
+/**
+ * Upper bound on the number of samples per channel avbin_output_samples()
+ * will write for the most recently decoded audio frame, or -1 on error.
+ */
+static int avbin_output_samples_count(AVbinStream *stream)
+{
+    int in_samples = avbin_audio_samples(stream);
+
+    if (!avbin_resampling(stream))
+        return in_samples;
+
+    if (avbin_setup_resampler(stream) < 0)
+        return -1;
+
+    return av_rescale_rnd(avresample_get_delay(stream->resample_context) +
+                              in_samples,
+                          avbin_output_sample_rate(stream),
+                          stream->codec_context->sample_rate,
+                          AV_ROUND_UP) +
+           avresample_available(stream->resample_context);
+}
+
+/**
+ * Upper bound on the number of bytes avbin_output_samples() will write for
+ * the most recently decoded audio frame, or -1 on error.
+ */
+static int avbin_output_samples_size(AVbinStream *stream)
+{
+    int count = avbin_output_samples_count(stream);
+
+    if (count < 0)
+        return -1;
+
+    return av_samples_get_buffer_size(NULL,
+                                      avbin_output_channels(stream),
+                                      count,
+                                      avbin_output_sample_fmt(stream), 1);
+}
+
+/**
+ * Write the most recently decoded audio frame to data_out, interleaved and
+ * in the stream's output format, rate and channels.  data_out must have
+ * room for avbin_output_samples_size() bytes.
+ *
+ * @return the number of bytes written, or -1 on error.
+ */
+static int avbin_write_samples(AVbinStream *stream, uint8_t *data_out)
+{
+    int count;
+
+    if (!avbin_resampling(stream))
+    {
+        avbin_convert_samples(data_out, avbin_output_sample_fmt(stream),
+                              avbin_audio_planes(stream),
+                              stream->codec_context->sample_fmt,
+                              avbin_audio_samples(stream),
+                              stream->codec_context->channels);
+        return avbin_output_samples_size(stream);
+    }
+
+    count = avbin_output_samples_count(stream);
+    if (count < 0)
+        return -1;
+
+    count = avresample_convert(stream->resample_context, &data_out, 0, count,
+                               avbin_audio_planes(stream), 0,
+                               avbin_audio_samples(stream));
+    if (count < 0)
+        return -1;
+
+    return count * avbin_output_channels(stream) *
+        av_get_bytes_per_sample(avbin_output_sample_fmt(stream));
+}
+
+static int avbin_output_samples(AVbinStream *stream, uint8_t *data_out)
+{
+    int64_t start = avbin_monotonic_time();
+    int size = avbin_write_samples(stream, data_out);
+
+    avbin_stats_time(stream->file, stream, AVBIN_STAT(convert), start);
+    return size;
+}
+
+/**
+ * Duration in microseconds of size bytes of output samples.
+ */
+static AVbinTimestamp avbin_output_duration(AVbinStream *stream, int size)
+{
+    return av_rescale(size / (avbin_output_channels(stream) *
+                          av_get_bytes_per_sample(avbin_output_sample_fmt(stream))),
+                      AV_TIME_BASE, avbin_output_sample_rate(stream));
+}
+
+/**
+ * The most samples per channel avbin_flush_samples() can write.
+ */
+static int avbin_held_samples(AVbinStream *stream)
+{
+    AVAudioResampleContext *context = stream->resample_context;
+
+    if (!context)
+        return 0;
+
+    return avresample_available(context) +
+        av_rescale_rnd(avresample_get_delay(context),
+                       avbin_output_sample_rate(stream),
+                       stream->resample_in_rate, AV_ROUND_UP);
+}
+
+/**
+ * Presentation time of the first sample avbin_output_samples() will write
+ * for the most recently decoded audio frame.  That is the frame's own time,
+ * less whatever the resampler is still holding from earlier frames.
+ */
+static AVbinTimestamp avbin_samples_timestamp(AVbinStream *stream)
+{
+    AVbinTimestamp timestamp = avbin_frame_timestamp(stream);
+
+    if (timestamp == AV_NOPTS_VALUE)
+        return timestamp;
+    return timestamp - av_rescale(avbin_held_samples(stream), AV_TIME_BASE,
+                                  avbin_output_sample_rate(stream));
+}
+
+/**
+ * Write the most recently decoded audio frame into data_out, which holds
+ * *size_out bytes, set *size_out to the number of bytes written, and note
+ * their timing.
+ */
+static int avbin_output_audio(AVbinStream *stream, uint8_t *data_out,
+                              int *size_out)
+{
+    int data_size = avbin_output_samples_size(stream);
+    AVbinTimestamp timestamp = avbin_samples_timestamp(stream);
+
+    if (data_size < 0)
+        return -1;
+    if (*size_out < data_size) {
+        av_log(stream->codec_context, AV_LOG_ERROR, "Output audio buffer is too small for current audio frame!");
+        return -1;
+    }
+
+    data_size = avbin_output_samples(stream, data_out);
+    if (data_size < 0)
+        return -1;
+    *size_out = data_size;
+
+    stream->output_timestamp = timestamp;
+    stream->output_duration = avbin_output_duration(stream, data_size);
+    return 0;
+}
+
+static int32_t avbin_decode_audio_internal(AVbinStream *stream,
+                                           AVPacket *packet,
+                                           uint8_t *data_out, int *size_out)
+{
+    int bytes_used;
+    int got_frame = 0;
+
+    avbin_set_skip_frame(stream, packet);
+    bytes_used = avbin_decode_frame(stream, &got_frame, packet);
+
+    if (bytes_used < 0)
+        return AVBIN_RESULT_ERROR;
+
+    if (got_frame && !avbin_accept_frame(stream))
+        got_frame = 0;
+
+    if (got_frame) {
+      if (avbin_output_audio(stream, data_out, size_out) < 0)
+         return AVBIN_RESULT_ERROR;
+    } else {
+      *size_out = 0;
+    }
+
+    return bytes_used;
+}
+
+static void avbin_get_output_dimensions(AVbinStream *stream,
+                                        int *width, int *height)
+{
+    // Scale down by whatever the decoder's own lowres fell short of
+    int shift = FFMAX(stream->output_lowres - stream->lowres, 0);
+
+    *width = stream->output_width ?
+        stream->output_width : -((-stream->codec_context->width) >> shift);
+    *height = stream->output_height ?
+        stream->output_height : -((-stream->codec_context->height) >> shift);
+}
+
+/**
+ * Convert the most recently decoded frame into data_out, in the stream's
+ * output format and size.
+ */
+static int avbin_scale_picture(AVbinStream *stream, AVPicture *picture_out)
+{
+    AVCodecContext *codec_context = stream->codec_context;
+    int width, height;
+
+    avbin_get_output_dimensions(stream, &width, &height);
+
+    // Nothing to convert, just copy the planes
+    if (codec_context->pix_fmt == stream->output_pix_fmt &&
+        codec_context->width == width &&
+        codec_context->height == height)
+    {
+        av_picture_copy(picture_out, (const AVPicture *) stream->frame,
+                        stream->output_pix_fmt, width, height);
+        return 0;
+    }
+
+    stream->sws_context = sws_getCachedContext(stream->sws_context,
+        codec_context->width, codec_context->height, codec_context->pix_fmt,
+        width, height, stream->output_pix_fmt,
+        stream->sws_flags, NULL, NULL, NULL);
+    if (!stream->sws_context)
+        return -1;
+
+    sws_scale(stream->sws_context,
+              (const uint8_t* const*)stream->frame->data,
+              stream->frame->linesize, 0, codec_context->height,
+              picture_out->data, picture_out->linesize);
+    return 0;
+}
+
+/**
+ * Convert the most recently decoded picture into picture_out, in the
+ * stream's output format and size.
+ */
+static int avbin_convert_picture(AVbinStream *stream, AVPicture *picture_out)
+{
+    int64_t start = avbin_monotonic_time();
+    int result = avbin_scale_picture(stream, picture_out);
+
+    avbin_stats_time(stream->file, stream, AVBIN_STAT(convert), start);
+    return result;
+}
+
+/**
+ * Convert the most recently decoded picture into data_out, with its planes
+ * laid out contiguously.
+ */
+static int avbin_convert_frame(AVbinStream *stream, uint8_t *data_out)
+{
+    AVPicture picture_out;
+    int width, height;
+
+    avbin_get_output_dimensions(stream, &width, &height);
+    avpicture_fill(&picture_out, data_out, stream->output_pix_fmt,
+                   width, height);
+    return avbin_convert_picture(stream, &picture_out);
+}
+
+/**
+ * Best guess at the presentation time of the most recently decoded frame, in
+ * microseconds.
+ */
+static AVbinTimestamp avbin_frame_timestamp(AVbinStream *stream)
+{
+    AVbinTimestamp timestamp = stream->frame_timestamp;
+
+    if (timestamp == AV_NOPTS_VALUE)
+        return AV_NOPTS_VALUE;
+
+    // Audio samples trimmed by an accurate seek
+    if (stream->frame_offset)
+        timestamp += av_rescale(stream->frame_offset, AV_TIME_BASE,
+                                stream->codec_context->sample_rate);
+    return timestamp;
+}
+
+/**
+ * Duration of the most recently decoded frame in microseconds, or 0 if it
+ * is not known.
+ */
+static AVbinTimestamp avbin_frame_duration(AVbinStream *stream)
+{
+    if (stream->type == AVMEDIA_TYPE_AUDIO &&
+        stream->codec_context->sample_rate > 0)
+        return av_rescale(avbin_audio_samples(stream), AV_TIME_BASE,
+                          stream->codec_context->sample_rate);
+    return stream->frame_duration;
+}
+
+/**
+ * @name Accurate seeking
+ *
+ * After avbin_seek_file_accurate() every open stream has a seek_target.
+ * Frames decoded before the target are dropped without being converted,
+ * and non-reference frames before it are not decoded at all.  Where the
+ * decoder does not reorder frames, avbin_read() decodes and discards the
+ * packets before the target itself, so the application never sees them.
+ */
+/*@{*/
+
+/**
+ * The presentation time of packet in microseconds, or AV_NOPTS_VALUE.
+ */
+static AVbinTimestamp avbin_packet_timestamp(AVbinStream *stream,
+                                             AVPacket *packet)
+{
+    int64_t timestamp = packet->pts;
+
+    if (timestamp == AV_NOPTS_VALUE)
+        timestamp = packet->dts;
+    if (timestamp == AV_NOPTS_VALUE)
+        return AV_NOPTS_VALUE;
+
+    return av_rescale_q(timestamp,
+                        stream->format_context->streams[stream->index]->time_base,
+                        AV_TIME_BASE_Q);
+}
+
+/**
+ * Use the cheapest decode for a packet that lies before the seek target:
+ * a non-reference frame there is only going to be dropped, so need not be
+ * decoded.
+ */
+static void avbin_set_skip_frame(AVbinStream *stream, AVPacket *packet)
+{
+    AVbinTimestamp timestamp;
+    enum AVDiscard skip_frame = stream->skip_frame;
+
+    if (stream->seek_target != AV_NOPTS_VALUE &&
+        stream->type == AVMEDIA_TYPE_VIDEO &&
+        !(packet->flags & AV_PKT_FLAG_KEY))
+    {
+        timestamp = avbin_packet_timestamp(stream, packet);
+        if (timestamp != AV_NOPTS_VALUE && timestamp < stream->seek_target &&
+            skip_frame < AVDISCARD_NONREF)
+            skip_frame = AVDISCARD_NONREF;
+    }
+
+    stream->codec_context->skip_frame = skip_frame;
+}
+
+/**
+ * Check the frame just decoded against the stream's seek target.  Frames
+ * wholly before it are rejected; an audio frame straddling it has its
+ * leading samples trimmed.  The first frame accepted clears the target.
+ *
+ * @return non-zero if the frame should be used.
+ */
+static int avbin_accept_frame(AVbinStream *stream)
+{
+    AVbinTimestamp timestamp;
+    int64_t skip;
+
+    stream->frame_offset = 0;
+    if (stream->seek_target == AV_NOPTS_VALUE)
+        return 1;
+
+    // Without a timestamp there is nothing to compare; take the frame
+    timestamp = avbin_frame_timestamp(stream);
+    if (timestamp != AV_NOPTS_VALUE)
+    {
+        if (stream->type == AVMEDIA_TYPE_AUDIO)
+        {
+            skip = av_rescale(stream->seek_target - timestamp,
+                              stream->codec_context->sample_rate,
+                              AV_TIME_BASE);
+            if (skip >= stream->frame->nb_samples)
+            {
+                avbin_drop_frame(stream);
+                return 0;
+            }
+            if (skip > 0)
+                stream->frame_offset = skip;
+        }
+        else if (timestamp < stream->seek_target)
+        {
+            avbin_drop_frame(stream);
+            return 0;
+        }
+    }
+
+    stream->seek_target = AV_NOPTS_VALUE;
+    return 1;
+}
+
+/**
+ * If packet belongs to an open stream that is still short of its seek
+ * target, and nothing it makes the decoder output can reach the target,
+ * decode and discard it.
+ *
+ * Audio decoders and video decoders without B-frames never output a frame
+ * later than the packet they were given, so this holds for any packet that
+ * ends before the target.
+ *
+ * @return non-zero if the packet was used up.
+ */
+static int avbin_decode_to_target(AVbinFile *file, AVPacket *packet)
+{
+    AVbinStream *stream = avbin_file_stream(file, packet->stream_index);
+    AVPacket remaining;
+    AVbinTimestamp timestamp;
+    int bytes_used, got_frame;
+
+    if (!stream || stream->seek_target == AV_NOPTS_VALUE)
+        return 0;
+
+    timestamp = avbin_packet_timestamp(stream, packet);
+    if (timestamp == AV_NOPTS_VALUE)
+        return 0;
+
+    if (stream->type == AVMEDIA_TYPE_AUDIO)
+    {
+        if (packet->duration <= 0 ||
+            timestamp + av_rescale_q(packet->duration,
+                stream->format_context->streams[stream->index]->time_base,
+                AV_TIME_BASE_Q) > stream->seek_target)
+            return 0;
+    }
+    else if (stream->type == AVMEDIA_TYPE_VIDEO)
+    {
+        if (stream->codec_context->has_b_frames ||
+            timestamp >= stream->seek_target)
+            return 0;
+    }
+    else
+        return 0;
+
+    remaining = *packet;
+    avbin_set_skip_frame(stream, &remaining);
+    while (remaining.size > 0)
+    {
+        got_frame = 0;
+        bytes_used = avbin_decode_frame(stream, &got_frame, &remaining);
+        if (bytes_used >= 0 && got_frame)
+            avbin_drop_frame(stream);
+
+        if (bytes_used < 0 || stream->type == AVMEDIA_TYPE_VIDEO)
+            break;
+        if (bytes_used == 0 && !got_frame)
+            break;
+        remaining.data += bytes_used;
+        remaining.size -= bytes_used;
+    }
+
+    return 1;
+}
+/*@}*/
+
+/**
+ * @name Buffer providers
+ *
+ * A video stream's decoder can be given an AVbinBufferProvider.  Its
+ * get_buffer callback is installed, through the codec's own get_buffer
+ * mechanism, for decoders with CODEC_CAP_DR1, and then supplies the memory
+ * pictures are decoded into.  Edge emulation is turned on so that buffers
+ * need no border around the picture, only the decoder's alignment and
+ * padding.  Where the application declines or returns an unsuitable buffer,
+ * the decoder's default allocator is used for that picture instead.
+ *
+ * get_output_buffer likewise supplies the destination of each conversion
+ * made by avbin_decode_video().
+ */
+/*@{*/
+
+/**
+ * Describe a buffer for a pix_fmt picture of width x height whose planes
+ * and rows start on alignment byte boundaries, with a suggested layout of
+ * a single block.
+ *
+ * @return 0, or -1 if pix_fmt has no layout.
+ */
+static int avbin_describe_buffer(AVbinBuffer *buffer, enum PixelFormat pix_fmt,
+                                 int width, int height, int alignment)
+{
+    uint8_t *data[4];
+    int linesize[4];
+    int32_t full_range;
+    int i, size;
+
+    memset(buffer, 0, sizeof *buffer);
+    buffer->structure_size = sizeof *buffer;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->backend_pixel_format = pix_fmt;
+    buffer->pixel_format = avbin_pixel_format(pix_fmt, &full_range);
+    buffer->alignment = alignment;
+
+    if (av_image_fill_linesizes(linesize, pix_fmt, width) < 0)
+        return -1;
+    for (i = 0; i < 4; i++)
+        linesize[i] = FFALIGN(linesize[i], alignment);
+
+    size = av_image_fill_pointers(data, pix_fmt, height, NULL, linesize);
+    if (size < 0)
+        return -1;
+
+    // Decoders may read a little past the end of the last plane
+    buffer->size = size + FF_INPUT_BUFFER_PADDING_SIZE;
+    for (i = 0; i < 4; i++)
+        buffer->linesize[i] = linesize[i];
+    return 0;
+}
+
+/**
+ * Fill in the remaining planes of a buffer the application gave only
+ * data[0] for, and check the result is usable.
+ *
+ * @return 0, or -1 if the buffer is missing or misaligned.
+ */
+static int avbin_complete_buffer(AVbinBuffer *buffer, int check_alignment)
+{
+    int linesize[4];
+    int i;
+
+    if (!buffer->data[0])
+        return -1;
+
+    if (!buffer->data[1] && !buffer->data[2] && !buffer->data[3])
+    {
+        for (i = 0; i < 4; i++)
+            linesize[i] = buffer->linesize[i];
+        av_image_fill_pointers(buffer->data, buffer->backend_pixel_format,
+                               buffer->height, buffer->data[0], linesize);
+    }
+
+    if (!check_alignment)
+        return 0;
+
+    for (i = 0; i < AVBIN_FRAME_PLANES; i++)
+        if (buffer->data[i] &&
+            ((uintptr_t) buffer->data[i] % buffer->alignment ||
+             buffer->linesize[i] % buffer->alignment))
+            return -1;
+    return 0;
+}
+
+static int avbin_codec_get_buffer(AVCodecContext *codec_context,
+                                  AVFrame *frame)
+{
+    AVbinStream *stream = codec_context->opaque;
+    AVbinProvidedBuffer *provided;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    int width = codec_context->width;
+    int height = codec_context->height;
+    int alignment = 32;
+    int i;
+
+    if (!stream || !stream->provider.get_buffer)
+        return avcodec_default_get_buffer(codec_context, frame);
+
+    avcodec_align_dimensions2(codec_context, &width, &height, linesize_align);
+    for (i = 0; i < AV_NUM_DATA_POINTERS; i++)
+        alignment = FFMAX(alignment, linesize_align[i]);
+
+    provided = av_mallocz(sizeof *provided);
+    if (!provided)
+        return avcodec_default_get_buffer(codec_context, frame);
+    provided->release_buffer = stream->provider.release_buffer;
+    provided->user_data = stream->provider.user_data;
+
+    if (avbin_describe_buffer(&provided->buffer, codec_context->pix_fmt,
+                              width, height, alignment) < 0 ||
+        stream->provider.get_buffer(stream->provider.user_data,
+                                    &provided->buffer) != AVBIN_RESULT_OK)
+    {
+        av_free(provided);
+        return avcodec_default_get_buffer(codec_context, frame);
+    }
+
+    if (avbin_complete_buffer(&provided->buffer, 1) < 0)
+    {
+        av_log(codec_context, AV_LOG_WARNING,
+               "Provided buffer is misaligned, using our own\n");
+        if (provided->release_buffer)
+            provided->release_buffer(provided->user_data, &provided->buffer);
+        av_free(provided);
+        return avcodec_default_get_buffer(codec_context, frame);
+    }
+
+    for (i = 0; i < AVBIN_FRAME_PLANES; i++)
+    {
+        frame->base[i] = frame->data[i] = provided->buffer.data[i];
+        frame->linesize[i] = provided->buffer.linesize[i];
+    }
+    frame->extended_data = frame->data;
+    frame->type = FF_BUFFER_TYPE_USER;
+    frame->opaque = provided;
+
+    // What avcodec_default_get_buffer() would have filled in
+    frame->width = codec_context->width;
+    frame->height = codec_context->height;
+    frame->format = codec_context->pix_fmt;
+    frame->sample_aspect_ratio = codec_context->sample_aspect_ratio;
+    frame->reordered_opaque = codec_context->reordered_opaque;
+    frame->pkt_pts = codec_context->pkt ? codec_context->pkt->pts
+                                        : AV_NOPTS_VALUE;
+    return 0;
+}
+
+static void avbin_codec_release_buffer(AVCodecContext *codec_context,
+                                       AVFrame *frame)
+{
+    AVbinProvidedBuffer *provided = frame->opaque;
+    int i;
+
+    // Pictures allocated before the provider was set, or in its place
+    if (frame->type != FF_BUFFER_TYPE_USER)
+    {
+        avcodec_default_release_buffer(codec_context, frame);
+        return;
+    }
+
+    if (provided->release_buffer)
+        provided->release_buffer(provided->user_data, &provided->buffer);
+    av_free(provided);
+
+    for (i = 0; i < AV_NUM_DATA_POINTERS; i++)
+        frame->base[i] = frame->data[i] = NULL;
+    frame->opaque = NULL;
+}
+
+/**
+ * The application's opaque pointer for the buffer holding the most recently
+ * decoded picture, or NULL if the decoder allocated it.
+ */
+static void *avbin_frame_opaque(AVbinStream *stream)
+{
+    AVbinProvidedBuffer *provided = stream->frame->opaque;
+
+    if (stream->frame->type != FF_BUFFER_TYPE_USER || !provided)
+        return NULL;
+    return provided->buffer.opaque;
+}
+
+/**
+ * Convert the most recently decoded picture into a buffer from the
+ * stream's get_output_buffer callback.
+ */
+static int avbin_convert_provided(AVbinStream *stream)
+{
+    AVbinBufferProvider *provider = &stream->provider;
+    AVbinBuffer buffer;
+    AVPicture picture_out;
+    int width, height;
+    int i;
+
+    avbin_get_output_dimensions(stream, &width, &height);
+    if (avbin_describe_buffer(&buffer, stream->output_pix_fmt,
+                              width, height, 16) < 0)
+        return -1;
+
+    if (provider->get_output_buffer(provider->user_data, &buffer) !=
+            AVBIN_RESULT_OK ||
+        avbin_complete_buffer(&buffer, 0) < 0)
+        return -1;
+
+    memset(&picture_out, 0, sizeof picture_out);
+    for (i = 0; i < AVBIN_FRAME_PLANES; i++)
+    {
+        picture_out.data[i] = buffer.data[i];
+        picture_out.linesize[i] = buffer.linesize[i];
+    }
+    return avbin_convert_picture(stream, &picture_out);
+}
+
+AVbinResult avbin_set_buffer_provider(AVbinStream *stream,
+                                      AVbinBufferProvider *provider)
+{
+    AVCodecContext *codec_context = stream->codec_context;
+    const AVCodec *codec = codec_context->codec;
+
+    if (stream->type != AVMEDIA_TYPE_VIDEO || stream->queue)
+        return AVBIN_RESULT_ERROR;
+
+    if (!provider)
+    {
+        // The codec callbacks stay, to release buffers already handed out
+        memset(&stream->provider, 0, sizeof stream->provider);
+        return AVBIN_RESULT_OK;
+    }
+
+    if (provider->structure_size < sizeof *provider)
+        return AVBIN_RESULT_ERROR;
+
+    // A decoder that failed to reopen earlier is gone for good
+    if (!codec)
+        return AVBIN_RESULT_ERROR;
+
+    if (provider->get_buffer && codec->capabilities & CODEC_CAP_DR1)
+    {
+        // Edge emulation must be on from the start of decoding
+        if (!(codec_context->flags & CODEC_FLAG_EMU_EDGE))
+        {
+            if (stream->frame_held)
+                return AVBIN_RESULT_ERROR;
+            avcodec_close(codec_context);
+            codec_context->flags |= CODEC_FLAG_EMU_EDGE;
+            if (avcodec_open2(codec_context, codec, NULL) < 0)
+            {
+                // Put the decoder back as it was
+                codec_context->flags &= ~CODEC_FLAG_EMU_EDGE;
+                if (avcodec_open2(codec_context, codec, NULL) < 0)
+                    av_log(codec_context, AV_LOG_ERROR,
+                           "Could not reopen decoder; stream unusable\n");
+                return AVBIN_RESULT_ERROR;
+            }
+        }
+
+        codec_context->opaque = stream;
+        codec_context->get_buffer = avbin_codec_get_buffer;
+        codec_context->release_buffer = avbin_codec_release_buffer;
+    }
+
+    stream->provider = *provider;
+    return AVBIN_RESULT_OK;
+}
+/*@}*/
+
+/**
+ * Decode packet into stream->frame.
+ *
+ * @return the number of bytes used, or AVBIN_RESULT_ERROR if no picture was
+ *         produced.
+ */
+static int32_t avbin_decode_picture(AVbinStream *stream, AVPacket *packet)
+{
+    int got_picture;
+    int bytes_used;
+
+    avbin_set_skip_frame(stream, packet);
+    bytes_used = avbin_decode_frame(stream, &got_picture, packet);
+
+    if (bytes_used < 0 || !got_picture || !avbin_accept_frame(stream))
+        return AVBIN_RESULT_ERROR;
+
+    return bytes_used;
+}
+
+/**
+ * Convert the most recently decoded picture into data_out, or into a buffer
+ * from the stream's provider, and note its timing.
+ */
+static int avbin_output_picture(AVbinStream *stream, uint8_t *data_out)
+{
+    if (stream->provider.get_output_buffer)
+    {
+        if (avbin_convert_provided(stream) < 0)
+            return -1;
+    }
+    else if (avbin_convert_frame(stream, data_out) < 0)
+        return -1;
+
+    stream->output_timestamp = avbin_frame_timestamp(stream);
+    stream->output_duration = avbin_frame_duration(stream);
+    return 0;
+}
+
+static int32_t avbin_decode_video_internal(AVbinStream *stream,
+                                           AVPacket *packet,
+                                           uint8_t *data_out)
+{
+    int bytes_used = avbin_decode_picture(stream, packet);
+
+    if (bytes_used < 0)
+        return AVBIN_RESULT_ERROR;
+
+    if (avbin_output_picture(stream, data_out) < 0)
+        return AVBIN_RESULT_ERROR;
+
+    return bytes_used;
+}
+
+int32_t avbin_decode_audio(AVbinStream *stream,
+                       uint8_t *data_in, size_t size_in,
+                       uint8_t *data_out, int *size_out)
+{
+    AVPacket packet;
+
+    if (stream->type != AVMEDIA_TYPE_AUDIO)
+        return AVBIN_RESULT_ERROR;
+
+    if (avbin_prepare_packet(stream, &packet, data_in, size_in) < 0)
+        return AVBIN_RESULT_ERROR;
+
+    return avbin_decode_audio_internal(stream, &packet, data_out, size_out);
+}
+
+int32_t avbin_decode_video(AVbinStream *stream,
+                       uint8_t *data_in, size_t size_in,
+                       uint8_t *data_out)
+{
+    AVPacket packet;
+
+    if (stream->type != AVMEDIA_TYPE_VIDEO)
+        return AVBIN_RESULT_ERROR;
+
+    if (avbin_prepare_packet(stream, &packet, data_in, size_in) < 0)
+        return AVBIN_RESULT_ERROR;
+
+    return avbin_decode_video_internal(stream, &packet, data_out);
+}
+
+int32_t avbin_decode_audio_packet(AVbinStream *stream, AVbinPacket *packet,
+                                  uint8_t *data_out, int *size_out)
+{
+    AVPacket av_packet;
+
+    if (stream->type != AVMEDIA_TYPE_AUDIO)
+        return AVBIN_RESULT_ERROR;
+
+    avbin_unwrap_packet(stream, packet, &av_packet);
+
+    return avbin_decode_audio_internal(stream, &av_packet, data_out, size_out);
+}
+
+int32_t avbin_decode_video_packet(AVbinStream *stream, AVbinPacket *packet,
+                                  uint8_t *data_out)
+{
+    AVPacket av_packet;
+
+    if (stream->type != AVMEDIA_TYPE_VIDEO)
+        return AVBIN_RESULT_ERROR;
+
+    avbin_unwrap_packet(stream, packet, &av_packet);
+
+    return avbin_decode_video_internal(stream, &av_packet, data_out);
+}
+
+/**
+ * @name Draining
+ *
+ * Decoders with CODEC_CAP_DELAY hold frames back, to reorder them or
+ * because they need lookahead, and frame-threaded decoders hold one for
+ * each thread still working.  At the end of the stream they are fed
+ * empty packets until they have nothing more to give; for audio, the
+ * resampler is then flushed too.
+ */
+/*@{*/
+
+/**
+ * Decode the next frame the decoder is still holding back into
+ * stream->frame, skipping any before the seek target.
+ *
+ * @return non-zero if there was one.
+ */
+static int avbin_drain_frame(AVbinStream *stream)
+{
+    AVPacket packet;
+    int got_frame;
+
+    if (!avbin_decoder_delayed(stream))
+        return 0;
+
+    av_init_packet(&packet);
+    packet.data = NULL;
+    packet.size = 0;
+    avbin_set_skip_frame(stream, &packet);
+    do
+    {
+        got_frame = 0;
+        if (avbin_decode_frame(stream, &got_frame, &packet) < 0 || !got_frame)
+            return 0;
+    } while (!avbin_accept_frame(stream));
+
+    return 1;
+}
+
+/**
+ * Write samples still buffered in the resampler into data_out, which holds
+ * size bytes.
+ *
+ * @return the number of bytes written, or -1 on error.
+ */
+static int avbin_flush_samples(AVbinStream *stream, uint8_t *data_out,
+                               int size)
+{
+    AVAudioResampleContext *context = stream->resample_context;
+    int sample_size = avbin_output_channels(stream) *
+        av_get_bytes_per_sample(avbin_output_sample_fmt(stream));
+    int count;
+
+    if (!context)
+        return 0;
+
+    count = FFMIN(avbin_held_samples(stream), size / sample_size);
+    if (count <= 0)
+        return 0;
+
+    count = avresample_convert(context, &data_out, 0, count, NULL, 0, 0);
+    if (count < 0)
+        return -1;
+    return count * sample_size;
+}
+
+/**
+ * Once a stream is drained, leave its decoder and batch state as a seek
+ * would, so that it can be decoded again.
+ */
+static void avbin_finish_drain(AVbinStream *stream)
+{
+    avbin_reset_batch(stream);
+    avcodec_flush_buffers(stream->codec_context);
+}
+
+int32_t avbin_drain_video(AVbinStream *stream, uint8_t *data_out)
+{
+    if (stream->type != AVMEDIA_TYPE_VIDEO)
+        return AVBIN_RESULT_ERROR;
+
+    // The pipeline's decoder thread owns the decoder
+    if (stream->queue)
+        return AVBIN_RESULT_ERROR;
+
+    // Draining would otherwise end early and flush the held frame away
+    if (stream->frame_held)
+        return AVBIN_RESULT_ERROR;
+
+    if (!avbin_drain_frame(stream))
+    {
+        avbin_finish_drain(stream);
+        return 0;
+    }
+
+    if (avbin_output_picture(stream, data_out) < 0)
+        return AVBIN_RESULT_ERROR;
+    return 1;
+}
+
+int32_t avbin_drain_audio(AVbinStream *stream, uint8_t *data_out,
+                          int *size_out)
+{
+    int size;
+
+    if (stream->type != AVMEDIA_TYPE_AUDIO)
+        return AVBIN_RESULT_ERROR;
+
+    // The pipeline's decoder thread owns the decoder
+    if (stream->queue)
+        return AVBIN_RESULT_ERROR;
+
+    if (avbin_drain_frame(stream))
+    {
+        if (avbin_output_audio(stream, data_out, size_out) < 0)
+            return AVBIN_RESULT_ERROR;
+        return 1;
+    }
+
+    size = avbin_flush_samples(stream, data_out, *size_out);
+    if (size < 0)
+        return AVBIN_RESULT_ERROR;
+    *size_out = size;
+    if (size == 0)
+    {
+        avbin_finish_drain(stream);
+        return 0;
+    }
+
+    // The held samples follow whatever was written last
+    if (stream->output_timestamp != AV_NOPTS_VALUE)
+        stream->output_timestamp += stream->output_duration;
+    stream->output_duration = avbin_output_duration(stream, size);
+    return 1;
+}
+
+AVbinResult avbin_get_frame_time(AVbinStream *stream,
+                                 AVbinTimestamp *timestamp,
+                                 AVbinTimestamp *duration)
+{
+    if (stream->type != AVMEDIA_TYPE_VIDEO &&
+        stream->type != AVMEDIA_TYPE_AUDIO)
+        return AVBIN_RESULT_ERROR;
+
+    *timestamp = stream->output_timestamp;
+    *duration = stream->output_duration;
+    return AVBIN_RESULT_OK;
+}
+/*@}*/
+
+AVbinResult avbin_set_video_output(AVbinStream *stream,
+                                   AVbinVideoOutput *output)
+{
+    enum PixelFormat pix_fmt;
+    int sws_flags;
+
+    if (stream->type != AVMEDIA_TYPE_VIDEO)
+        return AVBIN_RESULT_ERROR;
+
+    if (output->structure_size < sizeof *output)
+        return AVBIN_RESULT_ERROR;
+
+    if (output->width < 0 || output->height < 0)
+        return AVBIN_RESULT_ERROR;
+
+    switch (output->pixel_format)
+    {
+        case AVBIN_PIXEL_FORMAT_RGB24:
+            pix_fmt = PIX_FMT_RGB24;
+            break;
+        case AVBIN_PIXEL_FORMAT_RGBA:
+            pix_fmt = PIX_FMT_RGBA;
+            break;
+        case AVBIN_PIXEL_FORMAT_BGRA:
+            pix_fmt = PIX_FMT_BGRA;
+            break;
+        case AVBIN_PIXEL_FORMAT_YUV420P:
+            pix_fmt = PIX_FMT_YUV420P;
+            break;
+        default:
+            return AVBIN_RESULT_ERROR;
+    }
+
+    switch (output->scale_quality)
+    {
+        case AVBIN_SCALE_FAST_BILINEAR:
+            sws_flags = SWS_FAST_BILINEAR;
+            break;
+        case AVBIN_SCALE_BILINEAR:
+            sws_flags = SWS_BILINEAR;
+            break;
+        case AVBIN_SCALE_BICUBIC:
+            sws_flags = SWS_BICUBIC;
+            break;
+        case AVBIN_SCALE_POINT:
+            sws_flags = SWS_POINT;
+            break;
+        case AVBIN_SCALE_AREA:
+            sws_flags = SWS_AREA;
+            break;
+        case AVBIN_SCALE_LANCZOS:
+            sws_flags = SWS_LANCZOS;
+            break;
+        default:
+            return AVBIN_RESULT_ERROR;
+    }
+
+    stream->output_pix_fmt = pix_fmt;
+    stream->sws_flags = sws_flags;
+    stream->video_output_width = output->width;
+    stream->video_output_height = output->height;
+
+    // Thumbnail mode keeps its own size, until it ends
+    if (!stream->thumbnail)
+    {
+        stream->output_width = output->width;
+        stream->output_height = output->height;
+    }
+
+    return AVBIN_RESULT_OK;
+}
+
+size_t avbin_get_video_output_size(AVbinStream *stream)
+{
+    int width, height, size;
+
+    if (stream->type != AVMEDIA_TYPE_VIDEO)
+        return 0;
+
+    avbin_get_output_dimensions(stream, &width, &height);
+    size = avpicture_get_size(stream->output_pix_fmt, width, height);
+
+    return size < 0 ? 0 : size;
+}
+
+static AVbinPixelFormat avbin_pixel_format(enum PixelFormat pix_fmt,
+                                           int32_t *full_range)
+{
+    *full_range = 0;
+    switch (pix_fmt)
+    {
+        case PIX_FMT_RGB24:
+            return AVBIN_PIXEL_FORMAT_RGB24;
+        case PIX_FMT_RGBA:
+            return AVBIN_PIXEL_FORMAT_RGBA;
+        case PIX_FMT_BGRA:
+            return AVBIN_PIXEL_FORMAT_BGRA;
+        case PIX_FMT_YUVJ420P:
+            *full_range = 1;
+            /* fall through */
+        case PIX_FMT_YUV420P:
+            return AVBIN_PIXEL_FORMAT_YUV420P;
+        case PIX_FMT_YUVJ422P:
+            *full_range = 1;
+            /* fall through */
+        case PIX_FMT_YUV422P:
+            return AVBIN_PIXEL_FORMAT_YUV422P;
+        case PIX_FMT_YUVJ444P:
+            *full_range = 1;
+            /* fall through */
+        case PIX_FMT_YUV444P:
+            return AVBIN_PIXEL_FORMAT_YUV444P;
+        case PIX_FMT_NV12:
+            return AVBIN_PIXEL_FORMAT_NV12;
+        default:
+            return AVBIN_PIXEL_FORMAT_UNKNOWN;
+    }
+}
+
+int32_t avbin_decode_video_frame(AVbinStream *stream, AVbinPacket *packet,
+                                 AVbinFrame *frame)
+{
+    AVPacket av_packet;
+    int bytes_used;
+    int i;
+
+    if (stream->type != AVMEDIA_TYPE_VIDEO)
+        return AVBIN_RESULT_ERROR;
+
+    if (frame->structure_size < sizeof *frame)
+        return AVBIN_RESULT_ERROR;
+
+    avbin_unwrap_packet(stream, packet, &av_packet);
+
+    bytes_used = avbin_decode_picture(stream, &av_packet);
+    if (bytes_used < 0)
+        return AVBIN_RESULT_ERROR;
+
+    frame->timestamp = avbin_frame_timestamp(stream);
+    frame->duration = avbin_frame_duration(stream);
+    frame->width = stream->codec_context->width;
+    frame->height = stream->codec_context->height;
+    frame->backend_pixel_format = stream->codec_context->pix_fmt;
+    frame->pixel_format = avbin_pixel_format(stream->codec_context->pix_fmt,
+                                             &frame->full_range);
+    frame->key_frame = stream->frame->key_frame;
+    for (i = 0; i < AVBIN_FRAME_PLANES; i++)
+    {
+        frame->data[i] = stream->frame->data[i];
+        frame->linesize[i] = stream->frame->linesize[i];
+    }
+    frame->opaque = avbin_frame_opaque(stream);
+
+    stream->frame_held = 1;
+    return bytes_used;
+}
+
+void avbin_release_frame(AVbinStream *stream)
+{
+    stream->frame_held = 0;
+}
+
+int32_t avbin_decode_audio_frame(AVbinStream *stream, AVbinPacket *packet,
+                                 AVbinAudioFrame *frame)
+{
+    AVPacket av_packet;
+    int bytes_used;
+    int got_frame = 0;
+
+    if (stream->type != AVMEDIA_TYPE_AUDIO)
+        return AVBIN_RESULT_ERROR;
+
+    if (frame->structure_size < sizeof *frame)
+        return AVBIN_RESULT_ERROR;
+
+    avbin_unwrap_packet(stream, packet, &av_packet);
+
+    avbin_set_skip_frame(stream, &av_packet);
+    bytes_used = avbin_decode_frame(stream, &got_frame, &av_packet);
+    if (bytes_used < 0)
+        return AVBIN_RESULT_ERROR;
+
+    if (got_frame && !avbin_accept_frame(stream))
+        got_frame = 0;
+
+    frame->sample_format = avbin_sample_format(stream->codec_context->sample_fmt);
+    frame->backend_sample_format = stream->codec_context->sample_fmt;
+    frame->planar = av_sample_fmt_is_planar(stream->codec_context->sample_fmt);
+    frame->channels = stream->codec_context->channels;
+    frame->sample_rate = stream->codec_context->sample_rate;
+
+    if (!got_frame)
+    {
+        frame->timestamp = AV_NOPTS_VALUE;
+        frame->duration = 0;
+        frame->nb_samples = 0;
+        frame->data = NULL;
+        frame->linesize = 0;
+        return bytes_used;
+    }
+
+    frame->timestamp = avbin_frame_timestamp(stream);
+    frame->duration = avbin_frame_duration(stream);
+    frame->nb_samples = avbin_audio_samples(stream);
+    frame->data = avbin_audio_planes(stream);
+    frame->linesize = av_get_bytes_per_sample(stream->codec_context->sample_fmt) *
+        frame->nb_samples * (frame->planar ? 1 : frame->channels);
+
+    return bytes_used;
+}
+
+/**
+ * The backend's interleaved sample format for an output sample format, or
+ * AV_SAMPLE_FMT_NONE if it cannot be written.
+ */
+static enum AVSampleFormat avbin_backend_sample_fmt(AVbinSampleFormat format)
+{
+    switch (format)
+    {
+        case AVBIN_SAMPLE_FORMAT_U8:
+            return AV_SAMPLE_FMT_U8;
+        case AVBIN_SAMPLE_FORMAT_S16:
+            return AV_SAMPLE_FMT_S16;
+        case AVBIN_SAMPLE_FORMAT_S32:
+            return AV_SAMPLE_FMT_S32;
+        case AVBIN_SAMPLE_FORMAT_FLOAT:
+            return AV_SAMPLE_FMT_FLT;
+        default:
+            return AV_SAMPLE_FMT_NONE;
+    }
+}
+
+/**
+ * Check the rate, channels and channel layout of an audio output
+ * configuration.
+ *
+ * @return the number of channels it asks for, 0 for the stream's own, or -1
+ *         if it is invalid.
+ */
+static int avbin_audio_output_channels(AVbinAudioOutput *output)
+{
+    int channels;
+
+    if (output->sample_rate < 0 || output->channels < 0 ||
+        output->channels > 8)
+        return -1;
+
+    if (!output->channel_layout)
+        return output->channels;
+
+    channels = av_get_channel_layout_nb_channels(output->channel_layout);
+    if (channels > 8 || (output->channels && output->channels != channels))
+        return -1;
+    return channels;
+}
+
+AVbinResult avbin_set_audio_output(AVbinStream *stream,
+                                   AVbinAudioOutput *output)
+{
+    enum AVSampleFormat sample_fmt;
+
+    if (stream->type != AVMEDIA_TYPE_AUDIO)
+        return AVBIN_RESULT_ERROR;
+
+    if (output->structure_size < sizeof *output)
+        return AVBIN_RESULT_ERROR;
+
+    if (avbin_audio_output_channels(output) < 0)
+        return AVBIN_RESULT_ERROR;
+
+    sample_fmt = avbin_backend_sample_fmt(output->sample_format);
+    if (sample_fmt == AV_SAMPLE_FMT_NONE)
+        return AVBIN_RESULT_ERROR;
+
+    stream->output_sample_fmt = sample_fmt;
+    stream->output_sample_rate = output->sample_rate;
+    stream->output_channels = output->channels;
+    stream->output_channel_layout = output->channel_layout;
+
+    // Samples kept back from sample-exact decoding are in the old format
+    stream->leftover_samples = 0;
+
+    // Reopened for the new output on the next frame, if needed
+    avresample_free(&stream->resample_context);
+    return AVBIN_RESULT_OK;
+}
+
+/**
+ * @name Decode quality
+ *
+ * Each quality level adds one more decoding shortcut to those of the level
+ * before.  avbin_decode_video_deadline() drops a level quickly when
+ * pictures come out late, and climbs back slowly once they are early again,
+ * so that it does not oscillate.
+ */
+/*@{*/
+
+/* Consecutive late pictures before dropping a level, and early ones before
+ * climbing back */
+#define AVBIN_QUALITY_DOWN_FRAMES 2
+#define AVBIN_QUALITY_UP_FRAMES 60
+
+/**
+ * Set the decoder's shortcuts for a quality level.  Decoders ignore those
+ * they do not support.
+ */
+static void avbin_apply_quality(AVbinStream *stream,
+                                AVbinDecodeQuality quality)
+{
+    AVCodecContext *codec_context = stream->codec_context;
+
+    codec_context->skip_loop_filter = AVDISCARD_DEFAULT;
+    codec_context->skip_idct = AVDISCARD_DEFAULT;
+    if (quality >= AVBIN_QUALITY_FAST_LOOP_FILTER)
+        codec_context->skip_loop_filter = AVDISCARD_NONREF;
+    if (quality >= AVBIN_QUALITY_NO_LOOP_FILTER)
+        codec_context->skip_loop_filter = AVDISCARD_ALL;
+    if (quality >= AVBIN_QUALITY_SKIP_IDCT)
+        codec_context->skip_idct = AVDISCARD_NONREF;
+
+    // Thumbnail mode already skips more than any quality level
+    if (!stream->thumbnail)
+        stream->skip_frame = quality >= AVBIN_QUALITY_SKIP_NONREF ?
+            AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+
+    stream->current_quality = quality;
+}
+
+AVbinResult avbin_set_decode_quality(AVbinStream *stream,
+                                     AVbinDecodeQuality quality)
+{
+    if (stream->type != AVMEDIA_TYPE_VIDEO ||
+        quality < AVBIN_QUALITY_FULL || quality > AVBIN_QUALITY_SKIP_NONREF)
+        return AVBIN_RESULT_ERROR;
+
+    // The pipeline's decoder thread may be using the decoder
+    if (stream->queue)
+        return AVBIN_RESULT_ERROR;
+
+    stream->quality = quality;
+    stream->late_frames = 0;
+    stream->early_frames = 0;
+    avbin_apply_quality(stream, quality);
+    return AVBIN_RESULT_OK;
+}
+
+/**
+ * Step the stream's quality level down after a run of late pictures, or
+ * back up towards the level the application set after a run of early ones.
+ */
+static void avbin_adapt_quality(AVbinStream *stream, AVbinDeadline *deadline)
+{
+    AVbinDecodeQuality quality = stream->current_quality;
+
+    if (deadline->timestamp == AV_NOPTS_VALUE)
+        return;
+
+    if (deadline->status == AVBIN_FRAME_LATE)
+    {
+        stream->early_frames = 0;
+        if (++stream->late_frames >= AVBIN_QUALITY_DOWN_FRAMES &&
+            quality < AVBIN_QUALITY_SKIP_NONREF)
+        {
+            stream->late_frames = 0;
+            avbin_apply_quality(stream, quality + 1);
+        }
+    }
+    else if (deadline->timestamp >= deadline->clock)
+    {
+        stream->late_frames = 0;
+        if (++stream->early_frames >= AVBIN_QUALITY_UP_FRAMES &&
+            quality > stream->quality)
+        {
+            stream->early_frames = 0;
+            avbin_apply_quality(stream, quality - 1);
+        }
+    }
+    else
+    {
+        // Behind the clock but within tolerance: hold the current level
+        stream->late_frames = 0;
+        stream->early_frames = 0;
+    }
+}
+
+int32_t avbin_decode_video_deadline(AVbinStream *stream, AVbinPacket *packet,
+                                    uint8_t *data_out,
+                                    AVbinDeadline *deadline)
+{
+    AVPacket av_packet;
+    int got_picture = 0;
+    int bytes_used;
+
+    if (stream->type != AVMEDIA_TYPE_VIDEO ||
+        deadline->structure_size < sizeof *deadline)
+        return AVBIN_RESULT_ERROR;
+
+    avbin_unwrap_packet(stream, packet, &av_packet);
+
+    avbin_set_skip_frame(stream, &av_packet);
+    bytes_used = avbin_decode_frame(stream, &got_picture, &av_packet);
+    if (bytes_used < 0)
+        return AVBIN_RESULT_ERROR;
+
+    deadline->status = AVBIN_FRAME_NONE;
+    deadline->timestamp = AV_NOPTS_VALUE;
+    deadline->duration = 0;
+    if (got_picture && avbin_accept_frame(stream))
+    {
+        deadline->timestamp = avbin_frame_timestamp(stream);
+        deadline->duration = avbin_frame_duration(stream);
+
+        // Too late to show: the decode was needed, the conversion is not
+        if (deadline->timestamp != AV_NOPTS_VALUE &&
+            deadline->timestamp < deadline->clock - deadline->tolerance)
+        {
+            deadline->status = AVBIN_FRAME_LATE;
+            avbin_drop_frame(stream);
+        }
+        else
+        {
+            if (avbin_output_picture(stream, data_out) < 0)
+                return AVBIN_RESULT_ERROR;
+            deadline->status = AVBIN_FRAME_READY;
+        }
+
+        if (deadline->adaptive)
+            avbin_adapt_quality(stream, deadline);
+    }
+
+    deadline->quality = stream->current_quality;
+    return bytes_used;
+}
+
+/*@}*/
+
+/**
+ * @name Batched decoding
+ */
+/*@{*/
+
+static void avbin_reset_batch(AVbinStream *stream)
+{
+    if (stream->batch_packet)
+        avbin_release_packet(stream->batch_packet);
+    stream->batch_packet = NULL;
+    stream->batch_frame_pending = 0;
+    stream->batch_draining = 0;
+    stream->batch_finished = 0;
+    stream->leftover_samples = 0;
+}
+
+/**
+ * Decode from the stream's current packet, reading the next one if needed,
+ * until a frame is produced or the stream ends.
+ *
+ * @return 1 if a frame was decoded, 0 at the end of the stream.
+ */
+static int avbin_batch_decode(AVbinStream *stream)
+{
+    AVPacket *packet = &stream->batch_remaining;
+    int bytes_used, got_frame;
+
+    while (!stream->batch_finished)
+    {
+        if (!stream->batch_packet && !stream->batch_draining)
+        {
+            stream->batch_packet = avbin_read_stream_packet(stream->file,
+                                                            stream->index);
+            if (stream->batch_packet)
+                *packet = stream->batch_packet->packet;
+            else
+            {
+                // End of file; collect frames still buffered in the decoder
+                stream->batch_draining = 1;
+                av_init_packet(packet);
+                packet->data = NULL;
+                packet->size = 0;
+            }
+        }
+
+        if (stream->batch_draining && !avbin_decoder_delayed(stream))
+        {
+            stream->batch_finished = 1;
+            break;
+        }
+
+        got_frame = 0;
+        avbin_set_skip_frame(stream, packet);
+        bytes_used = avbin_decode_frame(stream, &got_frame, packet);
+
+        if (stream->batch_draining)
+        {
+            if (bytes_used < 0 || !got_frame)
+                stream->batch_finished = 1;
+        }
+        else
+        {
+            /* Video decoders always take the whole packet; audio packets may
+             * hold several frames.  Undecodable data is skipped rather than
+             * failing the whole batch. */
+            if (bytes_used < 0 || stream->type == AVMEDIA_TYPE_VIDEO)
+                bytes_used = packet->size;
+            packet->data += bytes_used;
+            packet->size -= bytes_used;
+            if (packet->size <= 0)
+            {
+                avbin_release_packet(stream->batch_packet);
+                stream->batch_packet = NULL;
+            }
+        }
+
+        if (got_frame && avbin_accept_frame(stream))
+            return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Append the decoded frame to batch, if it fits within its limits.
+ *
+ * @return 1 if the frame was consumed, 0 if it must wait for the next batch,
+ *         -1 if it can never fit.
+ */
+static int avbin_batch_append(AVbinStream *stream, AVbinBatch *batch)
+{
+    AVbinBatchFrame *frame = &batch->frames[batch->n_frames];
+    AVbinTimestamp timestamp = stream->type == AVMEDIA_TYPE_VIDEO ?
+        avbin_frame_timestamp(stream) : avbin_samples_timestamp(stream);
+    int32_t nb_samples = 0;
+    int size;
+
+    if (stream->type == AVMEDIA_TYPE_VIDEO)
+        size = avbin_get_video_output_size(stream);
+    else
+    {
+        // Upper bounds, until the samples are actually written
+        size = avbin_output_samples_size(stream);
+        nb_samples = avbin_output_samples_count(stream);
+        if (size < 0)
+            return -1;
+    }
+
+    if (batch->horizon && timestamp != AV_NOPTS_VALUE &&
+        timestamp >= batch->horizon)
+        return 0;
+
+    // Always take at least one frame, so that a small limit cannot stall
+    if (batch->n_frames > 0 && batch->max_samples &&
+        batch->n_samples + nb_samples > batch->max_samples)
+        return 0;
+
+    if (batch->buffer_used + size > batch->buffer_size)
+    {
+        if (batch->n_frames > 0)
+            return 0;
+        av_log(stream->codec_context, AV_LOG_ERROR,
+               "Batch buffer is too small for a single frame\n");
+        return -1;
+    }
+
+    if (stream->type == AVMEDIA_TYPE_VIDEO)
+    {
+        if (avbin_convert_frame(stream, batch->buffer + batch->buffer_used) < 0)
+            return -1;
+    }
+    else
+    {
+        size = avbin_output_samples(stream, batch->buffer + batch->buffer_used);
+        if (size < 0)
+            return -1;
+        // Held back by the resampler; nothing to add yet
+        if (size == 0)
+            return 1;
+        nb_samples = size / (avbin_output_channels(stream) *
+            av_get_bytes_per_sample(avbin_output_sample_fmt(stream)));
+    }
+
+    frame->timestamp = timestamp;
+    frame->duration = stream->type == AVMEDIA_TYPE_VIDEO ?
+        avbin_frame_duration(stream) :
+        av_rescale(nb_samples, AV_TIME_BASE, avbin_output_sample_rate(stream));
+    frame->offset = batch->buffer_used;
+    frame->size = size;
+    frame->nb_samples = nb_samples;
+
+    batch->n_frames++;
+    batch->n_samples += nb_samples;
+    batch->buffer_used += size;
+    return 1;
+}
+
+AVbinResult avbin_decode_batch(AVbinStream *stream, AVbinBatch *batch)
+{
+    int result;
+
+    if (batch->structure_size < sizeof *batch)
+        return AVBIN_RESULT_ERROR;
+
+    // The pipeline's demuxer thread owns the file while it runs
+    if (stream->file->pipeline)
+        return AVBIN_RESULT_ERROR;
+
+    if (batch->max_frames <= 0 || !batch->frames || !batch->buffer)
+        return AVBIN_RESULT_ERROR;
+
+    batch->n_frames = 0;
+    batch->n_samples = 0;
+    batch->buffer_used = 0;
+
+    while (batch->n_frames < batch->max_frames)
+    {
+        if (!stream->batch_frame_pending)
+        {
+            if (!avbin_batch_decode(stream))
+                break;
+            stream->batch_frame_pending = 1;
+        }
+
+        result = avbin_batch_append(stream, batch);
+        if (result == 0)
+            return AVBIN_RESULT_OK;
+
+        // A frame that can never fit is dropped, so the next call moves on
+        stream->batch_frame_pending = 0;
+        if (result < 0)
+            return AVBIN_RESULT_ERROR;
+    }
+
+    if (batch->n_frames == 0 && stream->batch_finished)
+        return AVBIN_RESULT_ERROR;
+    return AVBIN_RESULT_OK;
+}
+
+/*@}*/
+
+/**
+ * @name Sample-exact audio
+ *
+ * avbin_decode_audio_samples() and avbin_decode_audio_ring() share the
+ * batch decoder's packet handling, and keep decoded samples that do not fit
+ * in the stream's leftover buffer for the next call.  Frames that fit are
+ * converted straight into the application's memory.
+ */
+/*@{*/
+
+/**
+ * Fill the two parts of dest in turn with samples in the stream's output
+ * format, decoding as needed.
+ *
+ * @return the number of samples per channel written, which is fewer than
+ *         asked only at the end of the stream or on an error, or -1 on an
+ *         error before anything was written.
+ */
+static int32_t avbin_take_samples(AVbinStream *stream, uint8_t *dest[2],
+                                  int32_t dest_samples[2])
+{
+    int sample_size = avbin_output_channels(stream) *
+        av_get_bytes_per_sample(avbin_output_sample_fmt(stream));
+    int32_t written = 0, part = 0, count;
+    int size;
+
+    for (;;)
+    {
+        while (part < 2 && dest_samples[part] == 0)
+            part++;
+        if (part == 2)
+            break;
+
+        if (stream->leftover_samples > 0)
+        {
+            count = FFMIN(stream->leftover_samples, dest_samples[part]);
+            memcpy(dest[part], stream->leftover +
+                       (size_t) stream->leftover_first * sample_size,
+                   (size_t) count * sample_size);
+            stream->leftover_first += count;
+            stream->leftover_samples -= count;
+        }
+        else if (!stream->batch_frame_pending && !avbin_batch_decode(stream))
+        {
+            // Then whatever the resampler is still holding
+            count = avbin_held_samples(stream);
+            if (count <= 0)
+                break;
+            av_fast_malloc(&stream->leftover, &stream->leftover_size,
+                           (size_t) count * sample_size);
+            if (!stream->leftover)
+                goto error;
+            size = avbin_flush_samples(stream, stream->leftover,
+                                       count * sample_size);
+            if (size < 0)
+                goto error;
+            if (size == 0)
+                break;
+            stream->leftover_first = 0;
+            stream->leftover_samples = size / sample_size;
+            continue;
+        }
+        else
+        {
+            stream->batch_frame_pending = 0;
+
+            count = avbin_output_samples_count(stream);
+            if (count < 0)
+            {
+                avbin_drop_frame(stream);
+                continue;
+            }
+
+            if (count <= dest_samples[part])
+            {
+                size = avbin_output_samples(stream, dest[part]);
+                if (size < 0)
+                    goto error;
+                count = size / sample_size;
+            }
+            else
+            {
+                av_fast_malloc(&stream->leftover, &stream->leftover_size,
+                               (size_t) count * sample_size);
+                if (!stream->leftover)
+                    goto error;
+                size = avbin_output_samples(stream, stream->leftover);
+                if (size < 0)
+                    goto error;
+                stream->leftover_first = 0;
+                stream->leftover_samples = size / sample_size;
+                continue;
+            }
+        }
+
+        dest[part] += (size_t) count * sample_size;
+        dest_samples[part] -= count;
+        written += count;
+    }
+
+    return written;
+
+error:
+    // Don't lose what was already written
+    return written ? written : -1;
+}
+
+/**
+ * Whether sample-exact decoding may be used on the stream.
+ */
+static int avbin_can_take_samples(AVbinStream *stream)
+{
+    // The pipeline's demuxer thread owns the file while it runs
+    return stream->type == AVMEDIA_TYPE_AUDIO && !stream->file->pipeline;
+}
+
+int32_t avbin_decode_audio_samples(AVbinStream *stream, uint8_t *data_out,
+                                   int32_t nb_samples)
+{
+    uint8_t *dest[2] = { data_out, NULL };
+    int32_t dest_samples[2] = { nb_samples, 0 };
+    int32_t count;
+
+    if (!avbin_can_take_samples(stream) || nb_samples <= 0)
+        return AVBIN_RESULT_ERROR;
+
+    count = avbin_take_samples(stream, dest, dest_samples);
+    return count == 0 ? AVBIN_RESULT_ERROR : count;
+}
+
+int32_t avbin_decode_audio_ring(AVbinStream *stream, AVbinAudioRing *ring,
+                                int32_t nb_samples)
+{
+    uint8_t *dest[2];
+    int32_t dest_samples[2];
+    int64_t write_count = ring->write_count;
+    int64_t free_samples;
+    int32_t position, count;
+    int sample_size;
+
+    if (ring->structure_size < sizeof *ring || !ring->buffer ||
+        ring->capacity <= 0 || !avbin_can_take_samples(stream))
+        return AVBIN_RESULT_ERROR;
+
+    free_samples = ring->capacity - (write_count - ring->read_count);
+    if (free_samples < 0 || free_samples > ring->capacity)
+        return AVBIN_RESULT_ERROR;
+    if (nb_samples <= 0 || nb_samples > free_samples)
+        nb_samples = free_samples;
+    if (nb_samples == 0)
+        return 0;
+
+    // Write up to the end of the buffer, then carry on from its start
+    sample_size = avbin_output_channels(stream) *
+        av_get_bytes_per_sample(avbin_output_sample_fmt(stream));
+    position = write_count % ring->capacity;
+    dest[0] = ring->buffer + (size_t) position * sample_size;
+    dest_samples[0] = FFMIN(nb_samples, ring->capacity - position);
+    dest[1] = ring->buffer;
+    dest_samples[1] = nb_samples - dest_samples[0];
+
+    count = avbin_take_samples(stream, dest, dest_samples);
+    if (count <= 0)
+        return AVBIN_RESULT_ERROR;
+
+    // The samples must be in place before the application can see them
+    __sync_synchronize();
+    ring->write_count = write_count + count;
+    return count;
+}
+
+/*@}*/
+
+/**
+ * @name Stream selection
+ */
+/*@{*/
+
+static AVbinStreamSelection avbin_stream_selection(AVbinFile *file,
+                                                   int32_t index)
+{
+    if (index >= file->n_selection)
+        return AVBIN_STREAM_AUTO;
+    return file->selection[index];
+}
+
+/**
+ * Mark each stream of the file discarded or not, so that the demuxer can
+ * skip what nobody wants.  Until a stream is opened every stream is read,
+ * so applications that only look at packets are unaffected.
+ */
+static void avbin_update_discard(AVbinFile *file)
+{
+    AVStream *av_stream;
+    int any_open = 0;
+    int wanted;
+    int i;
+
+    // The demuxer thread reads these while it runs
+    if (file->pipeline)
+        return;
+
+    for (i = 0; i < file->n_streams; i++)
+        if (file->streams[i])
+            any_open = 1;
+
+    for (i = 0; i < file->context->nb_streams; i++)
+    {
+        switch (avbin_stream_selection(file, i))
+        {
+            case AVBIN_STREAM_ENABLED:
+                wanted = 1;
+                break;
+            case AVBIN_STREAM_DISABLED:
+                wanted = 0;
+                break;
+            default:
+                wanted = !any_open || avbin_file_stream(file, i);
+                break;
+        }
+
+        av_stream = file->context->streams[i];
+        if (!wanted)
+            av_stream->discard = AVDISCARD_ALL;
+        else if (av_stream->discard == AVDISCARD_ALL)
+            av_stream->discard = AVDISCARD_DEFAULT;
+    }
+}
+
+AVbinResult avbin_select_stream(AVbinFile *file, int32_t stream_index,
+                                AVbinStreamSelection selection)
+{
+    int8_t *array;
+
+    if (file->pipeline)
+        return AVBIN_RESULT_ERROR;
+
+    avbin_ensure_stream_info(file);
+    if (stream_index < 0 || stream_index >= file->context->nb_streams)
+        return AVBIN_RESULT_ERROR;
+
+    switch (selection)
+    {
+        case AVBIN_STREAM_AUTO:
+        case AVBIN_STREAM_ENABLED:
+        case AVBIN_STREAM_DISABLED:
+            break;
+        default:
+            return AVBIN_RESULT_ERROR;
+    }
+
+    if (stream_index >= file->n_selection)
+    {
+        array = realloc(file->selection, stream_index + 1);
+        if (!array)
+            return AVBIN_RESULT_ERROR;
+        memset(array + file->n_selection, AVBIN_STREAM_AUTO,
+               stream_index + 1 - file->n_selection);
+        file->selection = array;
+        file->n_selection = stream_index + 1;
+    }
+
+    file->selection[stream_index] = selection;
+    avbin_update_discard(file);
+    return AVBIN_RESULT_OK;
+}
+
+/*@}*/
+
+/**
+ * @name Thumbnails
+ */
+/*@{*/
+
+/**
+ * Close and reopen the stream's decoder to decode at 1/2^lowres of the full
+ * size, or as close to it as the decoder can.  Decoders that cannot reduce
+ * the size at all are reopened at full size, and the scaler does all of the
+ * work.
+ *
+ * @return 0 on success, -1 if the decoder could not be reopened at the new
+ *         size.  It is then reopened at its previous size; should that fail
+ *         too the decoder is left closed and the stream refuses to decode.
+ */
+static int avbin_reopen_lowres(AVbinStream *stream, int lowres)
+{
+    AVCodecContext *codec_context = stream->codec_context;
+    const AVCodec *codec = codec_context->codec;
+
+    // A decoder that failed to reopen earlier is gone for good
+    if (!codec)
+        return -1;
+
+    lowres = FFMIN(lowres, codec->max_lowres);
+    if (lowres == stream->lowres)
+        return 0;
+    if (stream->frame_held)
+        return -1;
+
+    avcodec_close(codec_context);
+    if (av_opt_set_int(codec_context, "lowres", lowres, 0) < 0 ||
+        avcodec_open2(codec_context, codec, NULL) < 0)
+    {
+        // Put the decoder back as it was
+        av_opt_set_int(codec_context, "lowres", stream->lowres, 0);
+        if (avcodec_open2(codec_context, codec, NULL) < 0)
+            av_log(codec_context, AV_LOG_ERROR,
+                   "Could not reopen decoder; stream unusable\n");
+        return -1;
+    }
+
+    stream->lowres = lowres;
+    return 0;
+}
+
+/**
+ * Fill in whichever of width and height is 0 from the other, keeping the
+ * stream's display aspect ratio.
+ */
+static void avbin_fit_dimensions(AVbinStream *stream, int *width, int *height)
+{
+    AVCodecContext *codec_context = stream->codec_context;
+    AVRational aspect = codec_context->sample_aspect_ratio;
+
+    if (!*width == !*height || !codec_context->width || !codec_context->height)
+        return;
+
+    if (aspect.num <= 0 || aspect.den <= 0)
+        aspect.num = aspect.den = 1;
+    aspect.num *= codec_context->width;
+    aspect.den *= codec_context->height;
+
+    if (*width)
+        *height = FFMAX(1, av_rescale(*width, aspect.den, aspect.num));
+    else
+        *width = FFMAX(1, av_rescale(*height, aspect.num, aspect.den));
+}
+
+AVbinResult avbin_set_thumbnail_mode(AVbinStream *stream,
+                                     AVbinThumbnailOptions *options)
+{
+    int width, height, lowres;
+
+    if (stream->type != AVMEDIA_TYPE_VIDEO)
+        return AVBIN_RESULT_ERROR;
+
+    if (stream->queue)
+        return AVBIN_RESULT_ERROR;
+
+    if (!options)
+    {
+        stream->thumbnail = 0;
+        stream->output_width = stream->video_output_width;
+        stream->output_height = stream->video_output_height;
+        avbin_apply_quality(stream, stream->current_quality);
+        if (avbin_reopen_lowres(stream, stream->output_lowres) < 0)
+            return AVBIN_RESULT_ERROR;
+        return AVBIN_RESULT_OK;
+    }
+
+    if (options->structure_size < sizeof *options)
+        return AVBIN_RESULT_ERROR;
+
+    if (options->width < 0 || options->height < 0 ||
+        options->lowres < 0 || options->lowres > 3)
+        return AVBIN_RESULT_ERROR;
+
+    // Size the output from the full-size picture, before any lowres
+    lowres = stream->lowres;
+    if (avbin_reopen_lowres(stream, 0) < 0)
+        return AVBIN_RESULT_ERROR;
+    width = options->width;
+    height = options->height;
+    avbin_fit_dimensions(stream, &width, &height);
+
+    if (avbin_reopen_lowres(stream, options->lowres) < 0)
+    {
+        avbin_reopen_lowres(stream, lowres);
+        return AVBIN_RESULT_ERROR;
+    }
+
+    stream->thumbnail = 1;
+    stream->skip_frame = AVDISCARD_NONKEY;
+    stream->output_width = width;
+    stream->output_height = height;
+    return AVBIN_RESULT_OK;
+}
+
+AVbinResult avbin_set_lowres(AVbinStream *stream, int32_t lowres)
+{
+    if (stream->type != AVMEDIA_TYPE_VIDEO || lowres < 0 || lowres > 3)
+        return AVBIN_RESULT_ERROR;
+
+    // The pipeline's decoder thread may be using the decoder
+    if (stream->queue)
+        return AVBIN_RESULT_ERROR;
+
+    // Thumbnail mode picks its own lowres, until it ends
+    if (!stream->thumbnail && avbin_reopen_lowres(stream, lowres) < 0)
+        return AVBIN_RESULT_ERROR;
+
+    stream->output_lowres = lowres;
+    return AVBIN_RESULT_OK;
+}
+
+/**
+ * Decode the first keyframe picture from the file's current position into
+ * stream->frame.
+ *
+ * @return 0 on success, -1 at the end of the file.
+ */
+static int avbin_decode_keyframe(AVbinStream *stream)
+{
+    AVbinPacketRef *ref;
+    AVPacket packet;
+    int got_picture;
+
+    stream->codec_context->skip_frame = AVDISCARD_NONKEY;
+    while ((ref = avbin_read_stream_packet(stream->file, stream->index)))
+    {
+        got_picture = 0;
+        if (ref->packet.flags & AV_PKT_FLAG_KEY)
+        {
+            avbin_decode_frame(stream, &got_picture, &ref->packet);
+
+            // Decoders with a delay only give up the picture when drained
+            if (!got_picture)
+            {
+                av_init_packet(&packet);
+                packet.data = NULL;
+                packet.size = 0;
+                avbin_decode_frame(stream, &got_picture, &packet);
+                if (!got_picture)
+                    avcodec_flush_buffers(stream->codec_context);
+            }
+        }
+        avbin_release_packet(ref);
+
+        if (got_picture)
+            return 0;
+    }
+    return -1;
+}
+
+AVbinResult avbin_extract_thumbnails(AVbinStream *stream, int32_t count,
+                                     uint8_t *data_out,
+                                     AVbinTimestamp *timestamps)
+{
+    AVFormatContext *context = stream->format_context;
+    AVbinTimestamp start, timestamp;
+    size_t size = avbin_get_video_output_size(stream);
+    int found = 0;
+    int i;
+
+    if (stream->type != AVMEDIA_TYPE_VIDEO || count <= 0 || !size ||
+        !data_out)
+        return AVBIN_RESULT_ERROR;
+
+    // The pipeline's demuxer thread owns the file while it runs
+    if (stream->file->pipeline)
+        return AVBIN_RESULT_ERROR;
+
+    if (context->duration == AV_NOPTS_VALUE || context->duration <= 0)
+        return AVBIN_RESULT_ERROR;
+    start = context->start_time == AV_NOPTS_VALUE ? 0 : context->start_time;
+
+    for (i = 0; i < count; i++)
+    {
+        // The middle of each of count equal parts of the file
+        timestamp = start + av_rescale(context->duration, 2 * i + 1,
+                                       2 * count);
+        if (timestamps)
+            timestamps[i] = AV_NOPTS_VALUE;
+
+        if (avbin_seek_file(stream->file, timestamp) != AVBIN_RESULT_OK ||
+            avbin_decode_keyframe(stream) < 0 ||
+            avbin_convert_frame(stream, data_out + i * size) < 0)
+            continue;
+
+        if (timestamps)
+            timestamps[i] = avbin_frame_timestamp(stream);
+        found++;
+    }
+
+    stream->codec_context->skip_frame = stream->skip_frame;
+    return found ? AVBIN_RESULT_OK : AVBIN_RESULT_ERROR;
+}
+
+/*@}*/
+
+/**
+ * @name Pipeline
+ *
+ * A demuxer thread reads ahead into a bounded packet queue for each open
+ * stream, and a decoder thread per stream turns those packets into decoded
+ * and converted frames in a bounded ring of slots.  The application pops
+ * ready frames without blocking.
+ *
+ * Everything shared between threads is protected by the pipeline's single
+ * mutex, and every state change is broadcast on its single condition
+ * variable; the queues are short, so this is not a point of contention.
+ */
+/*@{*/
+
+#define AVBIN_PIPELINE_DEFAULT_PACKETS 64
+#define AVBIN_PIPELINE_DEFAULT_BYTES (8 * 1024 * 1024)
+#define AVBIN_PIPELINE_DEFAULT_FRAMES 4
+
+typedef struct _AVbinQueueSlot {
+    uint8_t *data;
+    unsigned int capacity;
+    size_t size;
+    AVbinTimestamp timestamp;
+    AVbinTimestamp duration;
+} AVbinQueueSlot;
+
+struct _AVbinStreamQueue {
+    /* Demuxed packets waiting to be decoded, linked through next */
+    AVbinPacketRef *first_packet;
+    AVbinPacketRef *last_packet;
+    int32_t packets;
+    int64_t bytes;
+    int end_of_packets;
+
+    /* Ring of decoded frames.  filled_slots counts from first_slot and
+     * includes the slot held by the application, if any. */
+    AVbinQueueSlot *slots;
+    int32_t n_slots;
+    int32_t first_slot;
+    int32_t filled_slots;
+    int slot_held;
+
+    /* Set by the decoder thread when it will produce no more frames */
+    int finished;
+
+    /* Set when the stream is closed while the pipeline runs: its decoder
+     * thread stops, and the demuxer drops its packets. */
+    int closing;
+
+    pthread_t thread;
+    int thread_started;
+};
+
+struct _AVbinPipeline {
+    AVbinFile *file;
+    AVbinPipelineOptions options;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int stop;
+
+    pthread_t demux_thread;
+    int demux_thread_started;
+};
+
+static AVbinPipelineOptions *avbin_pipeline_options(AVbinPipeline *pipeline)
+{
+    return &pipeline->options;
+}
+
+static void *avbin_demux_thread(void *arg)
+{
+    AVbinPipeline *pipeline = arg;
+    AVbinFile *file = pipeline->file;
+    AVbinStreamQueue *queue;
+    AVbinPacketRef *entry;
+    AVbinStream *stream;
+    int i;
+
+    for (;;)
+    {
+        entry = avbin_read_packet_ref(file);
+        if (!entry)
+            break;
+
+        // Streams can be closed under us; look them up under the lock
+        pthread_mutex_lock(&pipeline->mutex);
+        stream = avbin_file_stream(file, entry->packet.stream_index);
+        queue = stream ? stream->queue : NULL;
+        while (!pipeline->stop && queue && !queue->closing &&
+               (queue->packets >= pipeline->options.max_packets ||
+                queue->bytes >= pipeline->options.max_bytes))
+            pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+
+        if (pipeline->stop)
+        {
+            pthread_mutex_unlock(&pipeline->mutex);
+            avbin_release_packet(entry);
+            break;
+        }
+
+        if (!queue || queue->closing)
+        {
+            pthread_mutex_unlock(&pipeline->mutex);
+            avbin_release_packet(entry);
+            continue;
+        }
+
+        if (queue->last_packet)
+            queue->last_packet->next = entry;
+        else
+            queue->first_packet = entry;
+        queue->last_packet = entry;
+        queue->packets++;
+        queue->bytes += entry->packet.size;
+        pthread_cond_broadcast(&pipeline->cond);
+        pthread_mutex_unlock(&pipeline->mutex);
+    }
+
+    pthread_mutex_lock(&pipeline->mutex);
+    for (i = 0; i < file->n_streams; i++)
+        if (file->streams[i] && file->streams[i]->queue)
+            file->streams[i]->queue->end_of_packets = 1;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    return NULL;
+}
+
+/**
+ * Wait for a free slot in the stream's frame ring.
+ *
+ * @retval NULL if the pipeline is stopping.
+ */
+static AVbinQueueSlot *avbin_acquire_slot(AVbinPipeline *pipeline,
+                                          AVbinStreamQueue *queue)
+{
+    AVbinQueueSlot *slot = NULL;
+
+    pthread_mutex_lock(&pipeline->mutex);
+    while (!pipeline->stop && !queue->closing &&
+           queue->filled_slots == queue->n_slots)
+        pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+    if (!pipeline->stop && !queue->closing)
+        slot = &queue->slots[(queue->first_slot + queue->filled_slots) %
+                             queue->n_slots];
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    return slot;
+}
+
+static void avbin_commit_slot(AVbinPipeline *pipeline,
+                              AVbinStreamQueue *queue)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    queue->filled_slots++;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+/**
+ * Store the most recently decoded frame of stream in the next free slot.
+ * Frames that cannot be converted are dropped.
+ *
+ * @retval -1 if the pipeline is stopping, or out of memory.
+ */
+static int avbin_queue_frame(AVbinPipeline *pipeline, AVbinStream *stream)
+{
+    AVbinQueueSlot *slot = avbin_acquire_slot(pipeline, stream->queue);
+    AVbinTimestamp timestamp = avbin_frame_timestamp(stream);
+    int size;
+
+    if (!slot)
+        return -1;
+
+    if (stream->type == AVMEDIA_TYPE_VIDEO)
+        size = avbin_get_video_output_size(stream);
+    else
+        size = avbin_output_samples_size(stream);
+
+    // An unconvertible frame is dropped, and the slot stays free for the next
+    if (size < 0)
+    {
+        avbin_drop_frame(stream);
+        return 0;
+    }
+
+    av_fast_malloc(&slot->data, &slot->capacity, size);
+    if (!slot->data)
+        return -1;
+
+    if (stream->type == AVMEDIA_TYPE_VIDEO)
+    {
+        // As above; one bad picture must not end the whole stream
+        if (avbin_convert_frame(stream, slot->data) < 0)
+        {
+            avbin_drop_frame(stream);
+            return 0;
+        }
+    }
+    else
+    {
+        // The resampler may hold on to all of a frame while it fills
+        timestamp = avbin_samples_timestamp(stream);
+        size = avbin_output_samples(stream, slot->data);
+        if (size <= 0)
+            return 0;
+    }
+
+    slot->size = size;
+    slot->timestamp = timestamp;
+    slot->duration = avbin_frame_duration(stream);
+    avbin_commit_slot(pipeline, stream->queue);
+    return 0;
+}
+
+/**
+ * Decode all of packet into the stream's frame ring.  An empty packet
+ * drains frames still buffered in the decoder.
+ *
+ * @retval -1 if the pipeline is stopping.
+ */
+static int avbin_queue_decode(AVbinPipeline *pipeline, AVbinStream *stream,
+                              AVPacket *packet)
+{
+    AVPacket remaining = *packet;
+    int drain = packet->size == 0;
+    int bytes_used, got_frame;
+
+    do
+    {
+        got_frame = 0;
+        avbin_set_skip_frame(stream, &remaining);
+        bytes_used = avbin_decode_frame(stream, &got_frame, &remaining);
+
+        // Skip over undecodable data rather than stalling the stream
+        if (bytes_used < 0)
+            return 0;
+
+        if (got_frame && avbin_accept_frame(stream) &&
+            avbin_queue_frame(pipeline, stream) < 0)
+            return -1;
+
+        // Video decoders always consume the whole packet
+        if (stream->type == AVMEDIA_TYPE_VIDEO)
+            bytes_used = remaining.size;
+
+        remaining.data += bytes_used;
+        remaining.size -= bytes_used;
+    } while (drain ? got_frame : (remaining.size > 0 &&
+                                  (bytes_used > 0 || got_frame)));
+
+    return 0;
+}
+
+static void *avbin_decode_thread(void *arg)
+{
+    AVbinStream *stream = arg;
+    AVbinPipeline *pipeline = stream->file->pipeline;
+    AVbinStreamQueue *queue = stream->queue;
+    AVbinPacketRef *entry;
+    AVPacket flush_packet;
+    int result;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&pipeline->mutex);
+        while (!pipeline->stop && !queue->closing && !queue->first_packet &&
+               !queue->end_of_packets)
+            pthread_cond_wait(&pipeline->cond, &pipeline->mutex);
+
+        if (pipeline->stop || queue->closing)
+        {
+            pthread_mutex_unlock(&pipeline->mutex);
+            break;
+        }
+
+        entry = queue->first_packet;
+        if (entry)
+        {
+            queue->first_packet = entry->next;
+            if (!queue->first_packet)
+                queue->last_packet = NULL;
+            queue->packets--;
+            queue->bytes -= entry->packet.size;
+            pthread_cond_broadcast(&pipeline->cond);
+        }
+        pthread_mutex_unlock(&pipeline->mutex);
+
+        if (!entry)
+        {
+            // End of file; get out any frames the decoder is still holding
+            if (avbin_decoder_delayed(stream))
+            {
+                av_init_packet(&flush_packet);
+                flush_packet.data = NULL;
+                flush_packet.size = 0;
+                avbin_queue_decode(pipeline, stream, &flush_packet);
+            }
+            break;
+        }
+
+        result = avbin_queue_decode(pipeline, stream, &entry->packet);
+        avbin_release_packet(entry);
+        if (result < 0)
+            break;
+    }
+
+    pthread_mutex_lock(&pipeline->mutex);
+    queue->finished = 1;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    return NULL;
+}
+
+static void avbin_free_queue(AVbinStreamQueue *queue)
+{
+    AVbinPacketRef *entry, *next;
+    int i;
+
+    for (entry = queue->first_packet; entry; entry = next)
+    {
+        next = entry->next;
+        avbin_release_packet(entry);
+    }
+
+    for (i = 0; i < queue->n_slots; i++)
+        av_free(queue->slots[i].data);
+    free(queue->slots);
+    free(queue);
+}
+
+/**
+ * Take a stream that is being closed out of the running pipeline, leaving
+ * the other streams' threads running.
+ */
+static void avbin_pipeline_remove_stream(AVbinStream *stream)
+{
+    AVbinPipeline *pipeline = stream->file->pipeline;
+    AVbinStreamQueue *queue = stream->queue;
+
+    pthread_mutex_lock(&pipeline->mutex);
+    queue->closing = 1;
+    stream->file->streams[stream->index] = NULL;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    if (queue->thread_started)
+        pthread_join(queue->thread, NULL);
+    stream->queue = NULL;
+    avbin_free_queue(queue);
+}
+
+AVbinResult avbin_start_pipeline(AVbinFile *file,
+                                 AVbinPipelineOptions *options)
+{
+    AVbinPipeline *pipeline;
+    AVbinStream *stream;
+    int i;
+
+    if (file->pipeline)
+        return AVBIN_RESULT_ERROR;
+
+    if (options && options->structure_size < sizeof *options)
+        return AVBIN_RESULT_ERROR;
+
+    // Probing reads the file, which the demuxer thread is about to own
+    avbin_ensure_stream_info(file);
+    avbin_update_discard(file);
+
+    pipeline = calloc(1, sizeof *pipeline);
+    if (!pipeline)
+        return AVBIN_RESULT_ERROR;
+
+    pipeline->file = file;
+    if (options)
+        pipeline->options = *options;
+    pipeline->options.structure_size = sizeof pipeline->options;
+    if (pipeline->options.max_packets <= 0)
+        pipeline->options.max_packets = AVBIN_PIPELINE_DEFAULT_PACKETS;
+    if (pipeline->options.max_bytes <= 0)
+        pipeline->options.max_bytes = AVBIN_PIPELINE_DEFAULT_BYTES;
+    if (pipeline->options.max_frames <= 0)
+        pipeline->options.max_frames = AVBIN_PIPELINE_DEFAULT_FRAMES;
+
+    pthread_mutex_init(&pipeline->mutex, NULL);
+    pthread_cond_init(&pipeline->cond, NULL);
+    file->pipeline = pipeline;
+
+    // Every stream open right now takes part
+    for (i = 0; i < file->n_streams; i++)
+    {
+        stream = file->streams[i];
+        if (!stream)
+            continue;
+
+        stream->queue = calloc(1, sizeof *stream->queue);
+        if (!stream->queue)
+            goto error;
+        stream->queue->slots = calloc(pipeline->options.max_frames,
+                                      sizeof *stream->queue->slots);
+        if (!stream->queue->slots)
+            goto error;
+        stream->queue->n_slots = pipeline->options.max_frames;
+    }
+
+    for (i = 0; i < file->n_streams; i++)
+    {
+        stream = file->streams[i];
+        if (!stream)
+            continue;
+
+        if (pthread_create(&stream->queue->thread, NULL,
+                           avbin_decode_thread, stream) != 0)
+            goto error;
+        stream->queue->thread_started = 1;
+    }
+
+    if (pthread_create(&pipeline->demux_thread, NULL,
+                       avbin_demux_thread, pipeline) != 0)
+        goto error;
+    pipeline->demux_thread_started = 1;
+
+    return AVBIN_RESULT_OK;
+
+error:
+    avbin_stop_pipeline(file);
+    return AVBIN_RESULT_ERROR;
+}
+
+void avbin_stop_pipeline(AVbinFile *file)
+{
+    AVbinPipeline *pipeline = file->pipeline;
+    AVbinStream *stream;
+    int i;
+
+    if (!pipeline)
+        return;
+
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->stop = 1;
+    pthread_cond_broadcast(&pipeline->cond);
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    if (pipeline->demux_thread_started)
+        pthread_join(pipeline->demux_thread, NULL);
+
+    for (i = 0; i < file->n_streams; i++)
+    {
+        stream = file->streams[i];
+        if (!stream || !stream->queue)
+            continue;
+
+        if (stream->queue->thread_started)
+            pthread_join(stream->queue->thread, NULL);
+        avbin_free_queue(stream->queue);
+        stream->queue = NULL;
+
+        // The decoder saw packets the application never will
+        avcodec_flush_buffers(stream->codec_context);
+    }
+
+    pthread_cond_destroy(&pipeline->cond);
+    pthread_mutex_destroy(&pipeline->mutex);
+    free(pipeline);
+    file->pipeline = NULL;
+
+    // Streams closed while it ran are still being demuxed
+    avbin_update_discard(file);
+}
+
+AVbinResult avbin_pipeline_pop(AVbinStream *stream, AVbinQueuedFrame *frame)
+{
+    AVbinPipeline *pipeline = stream->file->pipeline;
+    AVbinStreamQueue *queue = stream->queue;
+    AVbinQueueSlot *slot;
+    AVbinResult result;
+
+    if (!queue || frame->structure_size < sizeof *frame)
+        return AVBIN_RESULT_ERROR;
+
+    pthread_mutex_lock(&pipeline->mutex);
+
+    // The frame handed out last time is no longer needed
+    if (queue->slot_held)
+    {
+        queue->first_slot = (queue->first_slot + 1) % queue->n_slots;
+        queue->filled_slots--;
+        queue->slot_held = 0;
+        pthread_cond_broadcast(&pipeline->cond);
+    }
+
+    if (queue->filled_slots == 0)
+    {
+        result = queue->finished ? AVBIN_RESULT_ERROR : AVBIN_RESULT_AGAIN;
+        pthread_mutex_unlock(&pipeline->mutex);
+        return result;
+    }
+
+    slot = &queue->slots[queue->first_slot];
+    queue->slot_held = 1;
+    pthread_mutex_unlock(&pipeline->mutex);
+
+    frame->timestamp = slot->timestamp;
+    frame->duration = slot->duration;
+    frame->data = slot->data;
+    frame->size = slot->size;
+    return AVBIN_RESULT_OK;
+}
+/*@}*/
+
+/**
+ * @name Playlist
+ *
+ * Each playlist has one background thread, which opens its files in turn,
+ * decodes the first audio stream of each and writes trimmed, converted
+ * samples into a ring that avbin_playlist_read() copies out of.  The ring
+ * has one writer and one reader, so samples are copied in and out without
+ * holding the mutex; the mutex only guards the ring's positions and the list
+ * of entries.
+ */
+/*@{*/
+
+/* _AVbinPlaylistEntry::start of an entry that produced no samples */
+#define AVBIN_PLAYLIST_SKIPPED -2
+
+typedef struct _AVbinPlaylistEntry {
+    char *filename;
+
+    /* Samples written to the ring before this entry's first, or -1 until its
+     * first sample is written, or AVBIN_PLAYLIST_SKIPPED */
+    int64_t start;
+} AVbinPlaylistEntry;
+
+/* An open file of the playlist, owned by the playlist thread */
+typedef struct _AVbinPlaylistTrack {
+    int32_t entry;
+    AVbinFile *file;
+    AVbinStream *stream;
+    int32_t stream_index;
+
+    /* Samples still to drop from the start for encoder delay, and still to
+     * keep before the end padding (-1 for no limit) */
+    int64_t skip;
+    int64_t remaining;
+
+    /* Set once the track has written samples to the ring */
+    int started;
+} AVbinPlaylistTrack;
+
+struct _AVbinPlaylist {
+    AVbinAudioOutput output;
+    int32_t keep_padding;
+    int sample_size;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int stop;
+    pthread_t thread;
+    int thread_started;
+
+    AVbinPlaylistEntry *entries;
+    int32_t n_entries;
+    int32_t max_entries;
+    int32_t next_entry;
+    int idle;
+
+    /* Ring of samples.  written and read count every sample ever written
+     * and read. */
+    uint8_t *ring;
+    int32_t ring_samples;
+    int32_t ring_first;
+    int32_t ring_filled;
+    int64_t written;
+    int64_t read;
+    int32_t track;
+
+    /* Used only by the playlist thread */
+    AVbinPlaylistTrack current;
+    AVbinPlaylistTrack next;
+    uint8_t *scratch;
+    unsigned int scratch_size;
+};
+
+static int avbin_playlist_stopping(AVbinPlaylist *playlist)
+{
+    int stop;
+
+    pthread_mutex_lock(&playlist->mutex);
+    stop = playlist->stop;
+    pthread_mutex_unlock(&playlist->mutex);
+    return stop;
+}
+
+static int32_t avbin_playlist_audio_stream(AVbinFile *file)
+{
+    int i;
+
+    avbin_ensure_stream_info(file);
+    for (i = 0; i < file->context->nb_streams; i++)
+        if (file->context->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO)
+            return i;
+    return -1;
+}
+
+/**
+ * Work out from the file's iTunSMPB tag, if it has one, how much encoder
+ * delay to drop from the start of the track and how much to keep in all.
+ * The tag counts samples at the file's own rate.
+ */
+static void avbin_playlist_trim(AVbinPlaylist *playlist,
+                                AVbinPlaylistTrack *track)
+{
+    AVStream *st = track->file->context->streams[track->stream_index];
+    int in_rate = track->stream->codec_context->sample_rate;
+    int out_rate = playlist->output.sample_rate;
+    AVDictionaryEntry *tag;
+    unsigned int delay;
+    unsigned long long length;
+
+    track->skip = 0;
+    track->remaining = -1;
+    if (playlist->keep_padding || in_rate <= 0)
+        return;
+
+    tag = av_dict_get(st->metadata, "iTunSMPB", NULL, 0);
+    if (!tag)
+        tag = av_dict_get(track->file->context->metadata, "iTunSMPB", NULL, 0);
+    if (!tag ||
+        sscanf(tag->value, " %*x %x %*x %llx", &delay, &length) != 2)
+        return;
+
+    track->skip = av_rescale(delay, out_rate, in_rate);
+    if (length > 0)
+        track->remaining = av_rescale(length, out_rate, in_rate);
+}
+
+static void avbin_playlist_close_track(AVbinPlaylist *playlist,
+                                       AVbinPlaylistTrack *track)
+{
+    if (track->stream)
+        avbin_close_stream(track->stream);
+    if (track->file)
+        avbin_close_file(track->file);
+
+    pthread_mutex_lock(&playlist->mutex);
+    if (playlist->entries[track->entry].start < 0)
+        playlist->entries[track->entry].start = AVBIN_PLAYLIST_SKIPPED;
+    pthread_mutex_unlock(&playlist->mutex);
+
+    memset(track, 0, sizeof *track);
+}
+
+/**
+ * Open the next waiting entry of the playlist into track, skipping any that
+ * cannot be played.
+ *
+ * @return 1 if a file was opened, 0 if no entries are waiting.
+ */
+static int avbin_playlist_open_next(AVbinPlaylist *playlist,
+                                    AVbinPlaylistTrack *track)
+{
+    AVbinStreamOptions options;
+    const char *filename;
+    int32_t entry;
+
+    memset(&options, 0, sizeof options);
+    options.structure_size = sizeof options;
+    options.thread_count = -1;
+    options.audio_output = &playlist->output;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&playlist->mutex);
+        if (playlist->stop || playlist->next_entry == playlist->n_entries)
+        {
+            pthread_mutex_unlock(&playlist->mutex);
+            return 0;
+        }
+        entry = playlist->next_entry++;
+        filename = playlist->entries[entry].filename;
+        pthread_mutex_unlock(&playlist->mutex);
+
+        memset(track, 0, sizeof *track);
+        track->entry = entry;
+        track->file = avbin_open_filename(filename);
+        if (track->file)
+            track->stream_index = avbin_playlist_audio_stream(track->file);
+        if (track->file && track->stream_index >= 0)
+            track->stream = avbin_open_stream_with_options(track->file,
+                track->stream_index, &options);
+        if (track->stream)
+        {
+            avbin_playlist_trim(playlist, track);
+            return 1;
+        }
+
+        av_log(NULL, AV_LOG_WARNING, "Skipping unplayable file %s\n",
+               filename);
+        avbin_playlist_close_track(playlist, track);
+    }
+}
+
+/**
+ * Trim samples to the track's limits and write them into the ring, waiting
+ * for room as needed.
+ *
+ * @retval -1 if the playlist is stopping.
+ */
+static int avbin_playlist_write(AVbinPlaylist *playlist,
+                                AVbinPlaylistTrack *track,
+                                const uint8_t *data, int64_t samples)
+{
+    int64_t skip = FFMIN(track->skip, samples);
+    int32_t position, count;
+
+    data += skip * playlist->sample_size;
+    samples -= skip;
+    track->skip -= skip;
+    if (track->remaining >= 0)
+    {
+        samples = FFMIN(samples, track->remaining);
+        track->remaining -= samples;
+    }
+
+    while (samples > 0)
+    {
+        pthread_mutex_lock(&playlist->mutex);
+        while (!playlist->stop &&
+               playlist->ring_filled == playlist->ring_samples)
+            pthread_cond_wait(&playlist->cond, &playlist->mutex);
+        if (playlist->stop)
+        {
+            pthread_mutex_unlock(&playlist->mutex);
+            return -1;
+        }
+        position = (playlist->ring_first + playlist->ring_filled) %
+            playlist->ring_samples;
+        count = FFMIN(samples, playlist->ring_samples - playlist->ring_filled);
+        count = FFMIN(count, playlist->ring_samples - position);
+        pthread_mutex_unlock(&playlist->mutex);
+
+        // The reader never touches the free part of the ring
+        memcpy(playlist->ring + (size_t) position * playlist->sample_size,
+               data, (size_t) count * playlist->sample_size);
+
+        pthread_mutex_lock(&playlist->mutex);
+        if (!track->started)
+            playlist->entries[track->entry].start = playlist->written;
+        playlist->ring_filled += count;
+        playlist->written += count;
+        pthread_mutex_unlock(&playlist->mutex);
+
+        track->started = 1;
+        data += (size_t) count * playlist->sample_size;
+        samples -= count;
     }
 
-    for (i = 0; i < file->context->nb_streams; i++)
+    return 0;
+}
+
+/**
+ * Write the most recently decoded frame of the track into the ring.
+ *
+ * @retval -1 if the playlist is stopping.
+ */
+static int avbin_playlist_write_frame(AVbinPlaylist *playlist,
+                                      AVbinPlaylistTrack *track)
+{
+    int size = avbin_output_samples_size(track->stream);
+
+    // An unconvertible frame is dropped, like a corrupt one
+    if (size < 0)
     {
-        codec_context = file->context->streams[i]->codec;
-        if (codec_context && codec_context->codec)
-            avcodec_flush_buffers(codec_context);
+        avbin_drop_frame(track->stream);
+        return 0;
     }
-    return AVBIN_RESULT_OK;
+
+    av_fast_malloc(&playlist->scratch, &playlist->scratch_size, size);
+    if (!playlist->scratch)
+        return 0;
+
+    // The resampler may hold on to all of a frame while it fills
+    size = avbin_output_samples(track->stream, playlist->scratch);
+    if (size <= 0)
+        return 0;
+
+    return avbin_playlist_write(playlist, track, playlist->scratch,
+                                size / playlist->sample_size);
 }
 
-AVbinResult avbin_file_info(AVbinFile *file, AVbinFileInfo *info)
+/**
+ * Write out the samples the track's resampler is still holding, at the end
+ * of the track.
+ *
+ * @retval -1 if the playlist is stopping.
+ */
+static int avbin_playlist_flush_resampler(AVbinPlaylist *playlist,
+                                          AVbinPlaylistTrack *track)
 {
-    if (info->structure_size < sizeof *info)
-        return AVBIN_RESULT_ERROR;
+    AVbinStream *stream = track->stream;
+    AVAudioResampleContext *context = stream->resample_context;
+    int count;
 
-    info->n_streams = file->context->nb_streams;
-    info->start_time = file->context->start_time;
-    info->duration = file->context->duration;
+    if (!context)
+        return 0;
 
-    // Zero-initialize fields first
-    memset(info->title, 0, sizeof(info->title));
-    memset(info->author, 0, sizeof(info->author));
-    memset(info->copyright, 0, sizeof(info->copyright));
-    memset(info->comment, 0, sizeof(info->comment));
-    memset(info->album, 0, sizeof(info->album));
-    memset(info->genre, 0, sizeof(info->genre));
-    info->year = 0;
-    info->track = 0;
+    count = avresample_available(context) +
+        av_rescale_rnd(avresample_get_delay(context),
+                       playlist->output.sample_rate, stream->resample_in_rate,
+                       AV_ROUND_UP);
+    if (count <= 0)
+        return 0;
 
-    AVDictionaryEntry* entry;
-    if ((entry = av_dict_get(file->context->metadata, "title", NULL, 0)) != NULL)  {
-      strncpy(info->title, entry->value, sizeof(info->title));
-    }
+    av_fast_malloc(&playlist->scratch, &playlist->scratch_size,
+                   (size_t) count * playlist->sample_size);
+    if (!playlist->scratch)
+        return 0;
 
-    if (((entry = av_dict_get(file->context->metadata, "artist", NULL, 0)) != NULL) ||
-       (entry = av_dict_get(file->context->metadata, "album_artist", NULL, 0)) != NULL) {
-      strncpy(info->author, entry->value, sizeof(info->author));
-    }
-    if ((entry = av_dict_get(file->context->metadata, "copyright", NULL, 0)) != NULL)  {
-      strncpy(info->copyright, entry->value, sizeof(info->copyright));
-    }
-    if ((entry = av_dict_get(file->context->metadata, "comment", NULL, 0)) != NULL)  {
-      strncpy(info->comment, entry->value, sizeof(info->comment));
-    }
-    if ((entry = av_dict_get(file->context->metadata, "album", NULL, 0)) != NULL)  {
-      strncpy(info->album, entry->value, sizeof(info->album));
-    }
-    if ((entry = av_dict_get(file->context->metadata, "date", NULL, 0)) != NULL)  {
-      info->year = atoi(entry->value);
-    }
-    if ((entry = av_dict_get(file->context->metadata, "track", NULL, 0)) != NULL)  {
-      info->track = atoi(entry->value);
-    }
-    if ((entry = av_dict_get(file->context->metadata, "genre", NULL, 0)) != NULL)  {
-      strncpy(info->genre, entry->value, sizeof(info->genre));
-    }
+    count = avresample_convert(context, &playlist->scratch, 0, count,
+                               NULL, 0, 0);
+    if (count <= 0)
+        return 0;
 
-    return AVBIN_RESULT_OK;
+    return avbin_playlist_write(playlist, track, playlist->scratch, count);
 }
 
-AVbinResult avbin_stream_info(AVbinFile *file, int32_t stream_index,
-                      AVbinStreamInfo *info)
+/**
+ * Decode all of packet into the ring.  An empty packet drains frames still
+ * buffered in the decoder.
+ *
+ * @retval -1 if the playlist is stopping.
+ */
+static int avbin_playlist_decode(AVbinPlaylist *playlist,
+                                 AVbinPlaylistTrack *track, AVPacket *packet)
 {
-    AVCodecContext *context = file->context->streams[stream_index]->codec;
-    AVbinStreamInfo8 *info_8 = NULL;
+    AVPacket remaining = *packet;
+    int drain = packet->size == 0;
+    int bytes_used, got_frame;
 
-    /* Error if not large enough for version 1 */
-    if (info->structure_size < sizeof *info)
-        return AVBIN_RESULT_ERROR;
+    do
+    {
+        got_frame = 0;
+        bytes_used = avbin_decode_frame(track->stream, &got_frame,
+                                        &remaining);
 
-    /* Version 8 adds frame_rate feature, Version 11 removes it, see note on
-       avbin_have_feature() in avbin.h */
-    if (info->structure_size >= sizeof(AVbinStreamInfo8))
-        info_8 = (AVbinStreamInfo8 *) info;
+        // Skip over undecodable data rather than stalling the playlist
+        if (bytes_used < 0)
+            return 0;
 
-    switch (context->codec_type)
+        if (got_frame && avbin_accept_frame(track->stream) &&
+            avbin_playlist_write_frame(playlist, track) < 0)
+            return -1;
+
+        remaining.data += bytes_used;
+        remaining.size -= bytes_used;
+    } while (drain ? got_frame : (remaining.size > 0 &&
+                                  (bytes_used > 0 || got_frame)));
+
+    return 0;
+}
+
+/**
+ * Decode the next packet of the current track, or finish and close the track
+ * at its end.
+ *
+ * @retval -1 if the playlist is stopping.
+ */
+static int avbin_playlist_step(AVbinPlaylist *playlist)
+{
+    AVbinPlaylistTrack *track = &playlist->current;
+    AVbinPacketRef *ref = NULL;
+    AVPacket flush_packet;
+    int result = 0;
+
+    // Past the end of the padding there is nothing left worth decoding
+    if (track->remaining != 0)
+        ref = avbin_read_stream_packet(track->file, track->stream_index);
+
+    if (ref)
     {
-        case AVMEDIA_TYPE_VIDEO:
-            info->type = AVBIN_STREAM_TYPE_VIDEO;
-            info->video.width = context->width;
-            info->video.height = context->height;
-            info->video.sample_aspect_num = context->sample_aspect_ratio.num;
-            info->video.sample_aspect_den = context->sample_aspect_ratio.den;
+        result = avbin_playlist_decode(playlist, track, &ref->packet);
+        avbin_release_packet(ref);
+        return result;
+    }
 
-/* See note on avbin_have_feature() in avbin.h
-            if (info_8)
-            {
-                AVRational frame_rate = \
-                    file->context->streams[stream_index]->r_frame_rate;
-                info_8->video.frame_rate_num = frame_rate.num;
-                info_8->video.frame_rate_den = frame_rate.den;
+    if (track->remaining != 0 && avbin_decoder_delayed(track->stream))
+    {
+        av_init_packet(&flush_packet);
+        flush_packet.data = NULL;
+        flush_packet.size = 0;
+        result = avbin_playlist_decode(playlist, track, &flush_packet);
+    }
+    if (result == 0 && track->remaining != 0)
+        result = avbin_playlist_flush_resampler(playlist, track);
 
-                // Work around bug in Libav: if frame rate over 1000, divide
-                // by 1000.
-                if (info_8->video.frame_rate_num /
-                        info_8->video.frame_rate_den > 1000)
-                    info_8->video.frame_rate_den *= 1000;
-            }
-*/
-            if (info_8)
+    avbin_playlist_close_track(playlist, track);
+    return result;
+}
+
+static void *avbin_playlist_thread(void *arg)
+{
+    AVbinPlaylist *playlist = arg;
+
+    while (!avbin_playlist_stopping(playlist))
+    {
+        if (!playlist->current.file)
+        {
+            if (playlist->next.file)
             {
-                info_8->video.frame_rate_num = 0;
-                info_8->video.frame_rate_den = 0;
+                playlist->current = playlist->next;
+                memset(&playlist->next, 0, sizeof playlist->next);
             }
-            break;
-        case AVMEDIA_TYPE_AUDIO:
-            info->type = AVBIN_STREAM_TYPE_AUDIO;
-            info->audio.sample_rate = context->sample_rate;
-            info->audio.channels = context->channels;
-            switch (context->sample_fmt)
+            else if (!avbin_playlist_open_next(playlist, &playlist->current))
             {
-                case AV_SAMPLE_FMT_U8:
-                    info->audio.sample_format = AVBIN_SAMPLE_FORMAT_U8;
-                    info->audio.sample_bits = 8;
-                    break;
-                case AV_SAMPLE_FMT_S16:
-                    info->audio.sample_format = AVBIN_SAMPLE_FORMAT_S16;
-                    info->audio.sample_bits = 16;
-                    break;
-                case AV_SAMPLE_FMT_S32:
-                    info->audio.sample_format = AVBIN_SAMPLE_FORMAT_S32;
-                    info->audio.sample_bits = 32;
-                    break;
-                case AV_SAMPLE_FMT_FLT:
-                    info->audio.sample_format = AVBIN_SAMPLE_FORMAT_FLOAT;
-                    info->audio.sample_bits = 32;
-                    break;
-                default:
-                  // Unknown sample format
-                  info->audio.sample_format = -1;
-                  info->audio.sample_bits = -1;
-                  break;
-
-                // TODO: support planar formats
+                // Everything has been decoded; wait for more files
+                pthread_mutex_lock(&playlist->mutex);
+                playlist->idle = 1;
+                while (!playlist->stop &&
+                       playlist->next_entry == playlist->n_entries)
+                    pthread_cond_wait(&playlist->cond, &playlist->mutex);
+                playlist->idle = 0;
+                pthread_mutex_unlock(&playlist->mutex);
+                continue;
             }
-            break;
+        }
 
-        default:
-            info->type = AVBIN_STREAM_TYPE_UNKNOWN;
+        /* Open and probe the next file as soon as this one is playing, so
+         * that it is ready long before it is needed, however slow it is to
+         * open. */
+        if (playlist->current.started && !playlist->next.file)
+            avbin_playlist_open_next(playlist, &playlist->next);
+
+        if (avbin_playlist_step(playlist) < 0)
             break;
     }
 
-    return AVBIN_RESULT_OK;
+    return NULL;
 }
 
-AVbinStream *avbin_open_stream(AVbinFile *file, int32_t index)
+AVbinPlaylist *avbin_open_playlist(AVbinPlaylistOptions *options)
 {
-    AVCodecContext *codec_context;
-    AVCodec *codec;
+    AVbinPlaylist *playlist;
+    enum AVSampleFormat sample_fmt;
+    AVbinAudioOutput *output;
 
-    if (index < 0 || index >= file->context->nb_streams)
+    if (options && options->structure_size < sizeof *options)
         return NULL;
 
-    codec_context = file->context->streams[index]->codec;
-    codec = avcodec_find_decoder(codec_context->codec_id);
-    if (!codec)
+    playlist = calloc(1, sizeof *playlist);
+    if (!playlist)
         return NULL;
 
-    /* The Libav api example does this (see libav/libavcodec-api-example.c).
-     * The only explanation is "we do not send complete frames".  I tried
-     * adding it, and there seemed to be no effect either way.  I'm going to
-     * leave it here commented out just in case we find the need to enable it
-     * in the future.
-     */
-/*    if (codec->capabilities & CODEC_CAP_TRUNCATED)
- *       codec_context->flags |= CODEC_FLAG_TRUNCATED;
- */
-    if (avbin_thread_count != 1)
-        codec_context->thread_count = avbin_thread_count;
+    pthread_mutex_init(&playlist->mutex, NULL);
+    pthread_cond_init(&playlist->cond, NULL);
+    playlist->track = -1;
 
-    if (avcodec_open2(codec_context, codec, NULL) < 0)
-        return NULL;
+    output = &playlist->output;
+    output->sample_format = AVBIN_SAMPLE_FORMAT_S16;
+    if (options && options->audio_output)
+    {
+        if (options->audio_output->structure_size < sizeof *output)
+            goto error;
+        *output = *options->audio_output;
+    }
+    output->structure_size = sizeof *output;
 
-    AVbinStream *stream = malloc(sizeof *stream);
-    stream->format_context = file->context;
-    stream->codec_context = codec_context;
-    stream->type = codec_context->codec_type;
-    stream->frame = avcodec_alloc_frame();
+    output->channels = avbin_audio_output_channels(output);
+    if (output->channels < 0)
+        goto error;
 
-    return stream;
-}
+    // The output must not change from file to file
+    if (!output->sample_rate)
+        output->sample_rate = 44100;
+    if (!output->channels)
+        output->channels = 2;
 
-void avbin_close_stream(AVbinStream *stream)
-{
-    if (stream->frame)
-        avcodec_free_frame(&stream->frame);
-    avcodec_close(stream->codec_context);
-    free(stream);
-}
+    sample_fmt = avbin_backend_sample_fmt(output->sample_format);
+    if (sample_fmt == AV_SAMPLE_FMT_NONE)
+        goto error;
+    playlist->sample_size = output->channels *
+        av_get_bytes_per_sample(sample_fmt);
 
-int32_t avbin_read(AVbinFile *file, AVbinPacket *packet)
-{
-    if (packet->structure_size < sizeof *packet)
-        return AVBIN_RESULT_ERROR;
+    if (options)
+    {
+        playlist->ring_samples = options->buffer_samples;
+        playlist->keep_padding = options->keep_padding;
+    }
+    if (playlist->ring_samples <= 0)
+        playlist->ring_samples = output->sample_rate;
 
-    if (file->packet)
-        av_free_packet(file->packet);
-    else
-        file->packet = malloc(sizeof *file->packet);
+    playlist->ring = malloc((size_t) playlist->ring_samples *
+                            playlist->sample_size);
+    if (!playlist->ring)
+        goto error;
 
-    if (av_read_frame(file->context, file->packet) < 0)
-        return AVBIN_RESULT_ERROR;
+    if (pthread_create(&playlist->thread, NULL, avbin_playlist_thread,
+                       playlist) != 0)
+        goto error;
+    playlist->thread_started = 1;
 
-    packet->timestamp = av_rescale_q(file->packet->dts,
-        file->context->streams[file->packet->stream_index]->time_base,
-        AV_TIME_BASE_Q);
-    packet->stream_index = file->packet->stream_index;
-    packet->data = file->packet->data;
-    packet->size = file->packet->size;
+    return playlist;
 
-    return AVBIN_RESULT_OK;
+error:
+    avbin_close_playlist(playlist);
+    return NULL;
 }
 
-int32_t avbin_decode_audio(AVbinStream *stream,
-                       uint8_t *data_in, size_t size_in,
-                       uint8_t *data_out, int *size_out)
+void avbin_close_playlist(AVbinPlaylist *playlist)
 {
-    int bytes_used;
-    if (stream->type != AVMEDIA_TYPE_AUDIO)
-        return AVBIN_RESULT_ERROR;
+    int32_t i;
 
-    // Some decoders read big chunks at a time, so you have to make a bigger buffer
-    uint8_t inbuf[size_in + FF_INPUT_BUFFER_PADDING_SIZE];
-    // Set the padding portion of the buffer to all zeros
-    memset(inbuf + size_in, 0, FF_INPUT_BUFFER_PADDING_SIZE);
-    // Copy the data into the padded buffer
-    memcpy(inbuf, data_in, size_in);
+    pthread_mutex_lock(&playlist->mutex);
+    playlist->stop = 1;
+    pthread_cond_broadcast(&playlist->cond);
+    pthread_mutex_unlock(&playlist->mutex);
 
-    AVPacket packet;
-    av_init_packet(&packet);
-    packet.data = inbuf;
-    packet.size = size_in;
+    if (playlist->thread_started)
+        pthread_join(playlist->thread, NULL);
 
-    int got_frame = 0;
-    bytes_used = avcodec_decode_audio4(stream->codec_context, stream->frame, &got_frame, &packet);
+    if (playlist->current.file)
+        avbin_playlist_close_track(playlist, &playlist->current);
+    if (playlist->next.file)
+        avbin_playlist_close_track(playlist, &playlist->next);
 
-    if (bytes_used < 0)
-        return AVBIN_RESULT_ERROR;
+    for (i = 0; i < playlist->n_entries; i++)
+        free(playlist->entries[i].filename);
+    free(playlist->entries);
+    free(playlist->ring);
+    av_free(playlist->scratch);
 
-    // TODO: support planar formats
-    if (got_frame) {
-      int plane_size;
-      int data_size = av_samples_get_buffer_size(&plane_size,
-                                       stream->codec_context->channels,
-                                       stream->frame->nb_samples,
-                                       stream->codec_context->sample_fmt, 1);
-      if (*size_out < data_size) {
-         av_log(stream->codec_context, AV_LOG_ERROR, "Output audio buffer is too small for current audio frame!");
-         return AVBIN_RESULT_ERROR;
-      }
+    pthread_cond_destroy(&playlist->cond);
+    pthread_mutex_destroy(&playlist->mutex);
+    free(playlist);
+}
 
-      memcpy(data_out, stream->frame->extended_data[0], data_size);
-      *size_out = data_size;
-    } else {
-      *size_out = 0;
+int32_t avbin_playlist_append(AVbinPlaylist *playlist, const char *filename)
+{
+    AVbinPlaylistEntry *entries;
+    char *copy = strdup(filename);
+    int32_t max_entries, track;
+
+    if (!copy)
+        return -1;
+
+    pthread_mutex_lock(&playlist->mutex);
+    if (playlist->n_entries == playlist->max_entries)
+    {
+        max_entries = playlist->max_entries ? playlist->max_entries * 2 : 16;
+        entries = realloc(playlist->entries, max_entries * sizeof *entries);
+        if (!entries)
+        {
+            pthread_mutex_unlock(&playlist->mutex);
+            free(copy);
+            return -1;
+        }
+        playlist->entries = entries;
+        playlist->max_entries = max_entries;
     }
 
-    return bytes_used;
+    track = playlist->n_entries++;
+    playlist->entries[track].filename = copy;
+    playlist->entries[track].start = -1;
+    pthread_cond_broadcast(&playlist->cond);
+    pthread_mutex_unlock(&playlist->mutex);
+
+    return track;
 }
 
-int32_t avbin_decode_video(AVbinStream *stream,
-                       uint8_t *data_in, size_t size_in,
-                       uint8_t *data_out)
+int32_t avbin_playlist_read(AVbinPlaylist *playlist, uint8_t *buffer,
+                            int32_t nb_samples)
 {
-    AVPicture picture_rgb;
-    int got_picture;
-    int width = stream->codec_context->width;
-    int height = stream->codec_context->height;
-    int bytes_used;
+    size_t sample_size = playlist->sample_size;
+    int32_t first, count, part, i;
+    int64_t start;
 
-    if (stream->type != AVMEDIA_TYPE_VIDEO)
-        return AVBIN_RESULT_ERROR;
-
-    // Some decoders read big chunks at a time, so you have to make a bigger buffer
-    uint8_t inbuf[size_in + FF_INPUT_BUFFER_PADDING_SIZE];
-    // Set the padding portion of the buffer to all zeros
-    memset(inbuf + size_in, 0, FF_INPUT_BUFFER_PADDING_SIZE);
-    // Copy the data into the padded buffer
-    memcpy(inbuf, data_in, size_in);
+    pthread_mutex_lock(&playlist->mutex);
+    if (playlist->ring_filled == 0 && playlist->idle &&
+        playlist->next_entry == playlist->n_entries)
+    {
+        pthread_mutex_unlock(&playlist->mutex);
+        return -1;
+    }
+    first = playlist->ring_first;
+    count = FFMAX(FFMIN(nb_samples, playlist->ring_filled), 0);
+    pthread_mutex_unlock(&playlist->mutex);
 
-    AVPacket packet;
-    av_init_packet(&packet);
-    packet.data = inbuf;
-    packet.size = size_in;
+    // The writer never touches the filled part of the ring
+    part = FFMIN(count, playlist->ring_samples - first);
+    memcpy(buffer, playlist->ring + first * sample_size, part * sample_size);
+    memcpy(buffer + part * sample_size, playlist->ring,
+           (count - part) * sample_size);
 
-    bytes_used = avcodec_decode_video2(stream->codec_context,
-                                stream->frame, &got_picture,
-                                &packet);
+    pthread_mutex_lock(&playlist->mutex);
+    playlist->ring_first = (first + count) % playlist->ring_samples;
+    playlist->ring_filled -= count;
+    playlist->read += count;
 
-    if (!got_picture)
-        return AVBIN_RESULT_ERROR;
+    // Follow the samples across the start of any tracks they reached
+    for (i = playlist->track + 1; i < playlist->n_entries; i++)
+    {
+        start = playlist->entries[i].start;
+        if (start == AVBIN_PLAYLIST_SKIPPED)
+            continue;
+        if (start < 0 || start >= playlist->read)
+            break;
+        playlist->track = i;
+    }
+    pthread_cond_broadcast(&playlist->cond);
+    pthread_mutex_unlock(&playlist->mutex);
 
+    return count;
+}
 
-    avpicture_fill(&picture_rgb, data_out, PIX_FMT_RGB24, width, height);
-    static struct SwsContext *img_convert_ctx = NULL;
-    img_convert_ctx = sws_getCachedContext(img_convert_ctx,width, height,stream->codec_context->pix_fmt,width, height,PIX_FMT_RGB24, SWS_FAST_BILINEAR, NULL, NULL, NULL);
-    sws_scale(img_convert_ctx, (const uint8_t* const*)stream->frame->data, stream->frame->linesize,0, height, picture_rgb.data, picture_rgb.linesize);
+int32_t avbin_playlist_track(AVbinPlaylist *playlist)
+{
+    int32_t track;
 
-    return bytes_used;
+    pthread_mutex_lock(&playlist->mutex);
+    track = playlist->track;
+    pthread_mutex_unlock(&playlist->mutex);
+    return track;
 }
+/*@}*/